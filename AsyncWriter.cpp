@@ -0,0 +1,81 @@
+#include "AsyncWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace mcad;
+
+AsyncWriter::AsyncWriter(std::unique_ptr<raw_fd_ostream> &&OS)
+  : OS(std::move(OS)), IsWriting(false), IsClosing(false),
+    Worker(&AsyncWriter::run, this) {}
+
+Expected<std::unique_ptr<AsyncWriter>> AsyncWriter::create(StringRef Path) {
+  std::error_code EC;
+  auto OS = std::make_unique<raw_fd_ostream>(Path, EC, sys::fs::OF_None);
+  if (EC)
+    return llvm::errorCodeToError(EC);
+  return std::unique_ptr<AsyncWriter>(new AsyncWriter(std::move(OS)));
+}
+
+AsyncWriter::~AsyncWriter() {
+  if (Worker.joinable())
+    if (auto E = close())
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << "Failed to write: ");
+}
+
+void AsyncWriter::run() {
+  std::unique_lock<std::mutex> LK(Lock);
+  while (true) {
+    QueueCV.wait(LK, [this] { return !Queue.empty() || IsClosing; });
+    if (Queue.empty())
+      break;
+
+    std::string Data = std::move(Queue.front());
+    Queue.pop_front();
+    IsWriting = true;
+    LK.unlock();
+    OS->write(Data.data(), Data.size());
+    // Chunks are usually large, so there is little point to keep
+    // them in the stream's buffer.
+    OS->flush();
+    LK.lock();
+    IsWriting = false;
+    if (Queue.empty())
+      DrainedCV.notify_all();
+  }
+}
+
+void AsyncWriter::write(std::string &&Data) {
+  if (Data.empty())
+    return;
+  {
+    std::lock_guard<std::mutex> LK(Lock);
+    assert(!IsClosing && "Writing to a closed AsyncWriter");
+    Queue.push_back(std::move(Data));
+  }
+  QueueCV.notify_one();
+}
+
+void AsyncWriter::flush() {
+  std::unique_lock<std::mutex> LK(Lock);
+  DrainedCV.wait(LK, [this] { return Queue.empty() && !IsWriting; });
+}
+
+Error AsyncWriter::close() {
+  {
+    std::lock_guard<std::mutex> LK(Lock);
+    IsClosing = true;
+  }
+  QueueCV.notify_one();
+  Worker.join();
+
+  OS->close();
+  if (OS->has_error()) {
+    std::error_code EC = OS->error();
+    OS->clear_error();
+    return llvm::errorCodeToError(EC);
+  }
+  return ErrorSuccess();
+}
@@ -0,0 +1,54 @@
+#ifndef MCAD_ASYNCWRITER_H
+#define MCAD_ASYNCWRITER_H
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace llvm {
+class raw_fd_ostream;
+
+namespace mcad {
+/// Write data to a file from a background thread, such that the caller
+/// never blocks on disk I/O. Data is written in the order it's queued.
+class AsyncWriter {
+  std::unique_ptr<raw_fd_ostream> OS;
+
+  std::mutex Lock;
+  // Signaled when new data is queued or we're closing
+  std::condition_variable QueueCV;
+  // Signaled when the queue is drained
+  std::condition_variable DrainedCV;
+  std::deque<std::string> Queue;
+  // Whether the background thread is in the middle of a write
+  bool IsWriting;
+  bool IsClosing;
+
+  std::thread Worker;
+  void run();
+
+  explicit AsyncWriter(std::unique_ptr<raw_fd_ostream> &&OS);
+
+public:
+  static Expected<std::unique_ptr<AsyncWriter>> create(StringRef Path);
+
+  /// Drain the queue and stop the background thread, if it's not
+  /// closed yet.
+  ~AsyncWriter();
+
+  void write(std::string &&Data);
+
+  /// Block until everything queued so far is written.
+  void flush();
+
+  /// Drain the queue and stop the background thread. Return an error if
+  /// any of the writes failed.
+  Error close();
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -12,6 +12,8 @@ class MCInstrInfo;
 namespace mcad {
 class Broker;
 class MCAWorker;
+class MemoryAccounting;
+class Metrics;
 
 // An interface that provides objects that might be needed
 // to build a Broker. It's also the interface to register a
@@ -35,6 +37,10 @@ public:
   const MCInstrInfo &getInstrInfo() const;
 
   const MCSubtargetInfo &getSTI() const;
+
+  Metrics &getMetrics() const;
+
+  MemoryAccounting &getMemoryAccounting() const;
 };
 } // end namespace mcad
 } // end namespace llvm
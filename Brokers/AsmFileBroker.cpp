@@ -137,3 +137,33 @@ AsmFileBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
   return std::make_pair(int(i),
                         RegionDescriptor(EndOfRegion, LastRegionDescription));
 }
+
+int AsmFileBroker::fetchRegions(MutableArrayRef<const MCInst*> MCIS, int Size,
+                                SmallVectorImpl<RegionBoundary> &Boundaries,
+                                Optional<MDExchanger> MDE) {
+  assert(Size <= int(MCIS.size()));
+  size_t MaxLen = Size < 0? MCIS.size() : Size;
+
+  size_t i;
+  for (i = 0U; i < MaxLen; ++i) {
+    const MCInst *MCI = fetch();
+    if (!MCI) {
+      // End of stream
+      if (!i)
+        return -1;
+      else
+        break;
+    }
+    MCIS[i] = MCI;
+
+    // `fetch` always leaves IterRegion pointing to the
+    // region MCI belongs to
+    assert(IterRegion != IterRegionEnd);
+    const mca::CodeRegion &CurRegion = **IterRegion;
+    if (CurInstIdx >= CurRegion.getInstructions().size())
+      // This is the last instruction of the current region
+      Boundaries.emplace_back(unsigned(i + 1), CurRegion.getDescription());
+  }
+
+  return int(i);
+}
@@ -39,6 +39,10 @@ public:
   std::pair<int, RegionDescriptor>
   fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size = -1,
               Optional<MDExchanger> MDE = llvm::None) override;
+
+  int fetchRegions(MutableArrayRef<const MCInst*> MCIS, int Size,
+                   SmallVectorImpl<RegionBoundary> &Boundaries,
+                   Optional<MDExchanger> MDE = llvm::None) override;
 };
 } // end namespace mcad
 } // end namespace llvm
@@ -3,8 +3,10 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/MC/MCInst.h"
+#include <chrono>
 #include <utility>
 
 namespace llvm {
@@ -13,10 +15,14 @@ class MetadataRegistry;
 }
 
 namespace mcad {
+struct TypedMetadata;
+
 struct MDExchanger {
   mca::MetadataRegistry &MDRegistry;
+  // Metadata categories known by MCAD, which are stored unboxed
+  TypedMetadata &TypedMD;
   // Mapping MCInst index in the current batch
-  // to index in MetadataRegistry
+  // to index in MetadataRegistry and TypedMD
   DenseMap<unsigned, unsigned> &IndexMap;
 };
 
@@ -31,6 +37,13 @@ struct Broker {
   // use `fetchRegion` method instead.
   static constexpr unsigned Feature_Region = 1;
   static constexpr unsigned Feature_Metadata = (1 << 1);
+  // The Broker honors the timeout set by `setFetchTimeout`.
+  static constexpr unsigned Feature_FetchTimeout = (1 << 2);
+
+  // Returned by any of the fetch methods, instead of the number of MCInst,
+  // if no MCInst became available before the fetch timeout expired. Unlike
+  // -1, the instruction stream is still open.
+  static constexpr int FetchTimedOut = -2;
 
   // Broker should own the MCInst so only return the pointer
   //
@@ -41,7 +54,10 @@ struct Broker {
   // Note that for performance reason we're using mutable ArrayRef so the caller
   // should supply a fixed size array. And the Broker will always write from
   // index 0.
-  // Return the number of MCInst put into the buffer, or -1 if no MCInst left
+  // The MCInst pointed by MCIS only need to stay valid until the next call
+  // to any of the fetch methods, so a Broker is free to reuse their storage.
+  // Return the number of MCInst put into the buffer, -1 if no MCInst left,
+  // or FetchTimedOut.
   virtual int fetch(MutableArrayRef<const MCInst*> MCIS, int Size = -1,
                     Optional<MDExchanger> MDE = llvm::None) {
     return -1;
@@ -75,6 +91,86 @@ struct Broker {
     return std::make_pair(-1, RegionDescriptor(true));
   }
 
+  struct RegionBoundary {
+    // Index in MCIS right after the last instruction of this Region
+    unsigned EndIdx;
+    llvm::StringRef Description;
+
+    RegionBoundary(unsigned EndIdx, llvm::StringRef Text = "")
+      : EndIdx(EndIdx), Description(Text) {}
+  };
+
+  // Similar to `fetchRegion`, but a single batch is allowed to carry
+  // several complete Regions, which saves the per-fetch overhead when Regions
+  // are short. For every Region that ends inside MCIS, a RegionBoundary is
+  // appended to `Boundaries` in ascending order of EndIdx. Instructions after
+  // the last boundary belong to a Region that continues in the next batch.
+  // Return the number of MCInst put into the buffer, -1 if no MCInst left,
+  // or FetchTimedOut.
+  //
+  // The default implementation simply delegates to `fetchRegion`, so Brokers
+  // that only implement the latter still work.
+  virtual int fetchRegions(MutableArrayRef<const MCInst*> MCIS, int Size,
+                           SmallVectorImpl<RegionBoundary> &Boundaries,
+                           Optional<MDExchanger> MDE = llvm::None) {
+    auto Res = fetchRegion(MCIS, Size, MDE);
+    if (Res.first >= 0 && Res.second)
+      Boundaries.emplace_back(unsigned(Res.first), Res.second.Description);
+    return Res.first;
+  }
+
+  // Timestamps, in nanoseconds of the host's monotonic clock (i.e.
+  // std::chrono::steady_clock), of the oldest instruction in a batch.
+  // A zero value means it's not available.
+  struct BatchTimestamps {
+    // When the instruction was executed, for instance, by the guest
+    uint64_t Executed = 0U;
+    // When the instruction was received by the Broker
+    uint64_t Received = 0U;
+  };
+
+  // Timestamps of the batch returned by the last fetch, if the Broker
+  // keeps track of them.
+  virtual Optional<BatchTimestamps> getLastBatchTimestamps() const {
+    return llvm::None;
+  }
+
+  // Summary of an analyzed Region
+  struct RegionResult {
+    llvm::StringRef Description;
+    uint64_t NumInstructions;
+    uint64_t NumCycles;
+    uint64_t NumMicroOps;
+    // Instructions not simulated because of sampled simulation. All
+    // the other numbers only cover the simulated ones.
+    uint64_t NumSampledOutInstructions = 0U;
+  };
+
+  // Called by MCAWorker every time the results of a Region are ready,
+  // so the Broker can forward them to its clients. It's called on the
+  // same thread as the fetch methods, so it should not block.
+  virtual void onRegionResult(const RegionResult &Result) {}
+
+  // Only meaningful for Brokers with Feature_FetchTimeout. Limit the time
+  // every subsequent fetch waits for new MCInsts to Timeout, after which
+  // FetchTimedOut is returned. Wait indefinitely if Timeout is zero, which
+  // is the default.
+  virtual void setFetchTimeout(std::chrono::milliseconds Timeout) {}
+
+  enum MemoryPressureResponse {
+    // Release data that can be re-created later, like decoded instructions
+    MPR_EvictCaches,
+    // Attach less (optional) metadata to instructions from now on
+    MPR_ReduceMetadata
+  };
+
+  // Called by MCAWorker when the process is running out of its memory
+  // budget. The response doesn't need to happen synchronously.
+  // Return false if the Broker doesn't support the requested response.
+  virtual bool onMemoryPressure(MemoryPressureResponse Response) {
+    return false;
+  }
+
   virtual ~Broker() {}
 };
 } // end namespace mcad
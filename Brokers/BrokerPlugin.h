@@ -13,7 +13,7 @@ namespace mcad {
 // Forward declaration
 class BrokerFacade;
 
-#define LLVM_MCAD_BROKER_PLUGIN_API_VERSION 1
+#define LLVM_MCAD_BROKER_PLUGIN_API_VERSION 9
 
 extern "C" {
 struct BrokerPluginLibraryInfo {
@@ -0,0 +1,405 @@
+#include "EventLog.h"
+#include "TypedMetadata.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MCA/InstrBuilder.h"
+#include "llvm/MCA/Instruction.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <system_error>
+
+using namespace llvm;
+using namespace mcad;
+using namespace event_log;
+
+static constexpr StringLiteral Magic("MCADEVT1");
+
+// Records are handed to the AsyncWriter in chunks of (at least) this size
+static constexpr size_t ChunkSize = 64 * 1024;
+
+// Kinds of logged MCOperand
+enum OperandKind : uint8_t { OK_Reg = 0, OK_Imm, OK_SFPImm, OK_DFPImm };
+
+static Error makeFormatError(const Twine &Msg) {
+  return llvm::createStringError(
+    std::make_error_code(std::errc::illegal_byte_sequence),
+    "Invalid event log: " + Msg);
+}
+
+static void writeString(raw_ostream &OS, StringRef Str) {
+  encodeULEB128(Str.size(), OS);
+  OS << Str;
+}
+
+Writer::Writer(std::unique_ptr<AsyncWriter> &&Output)
+  : Output(std::move(Output)), NextDescID(1U),
+    LastSourceIndex(0U), LastMDToken(0U) {}
+
+Writer::~Writer() {
+  if (Output)
+    if (auto E = close())
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << "Event log: ");
+}
+
+Expected<std::unique_ptr<Writer>>
+Writer::create(StringRef Path, const MCSubtargetInfo &STI,
+               bool UseLoadLatency) {
+  auto OutOrErr = AsyncWriter::create(Path);
+  if (!OutOrErr)
+    return OutOrErr.takeError();
+
+  std::unique_ptr<Writer> W(new Writer(std::move(*OutOrErr)));
+  raw_string_ostream OS(W->Buffer);
+  OS << Magic;
+  writeString(OS, LLVM_VERSION_STRING);
+  writeString(OS, STI.getTargetTriple().str());
+  writeString(OS, STI.getCPU());
+  writeString(OS, STI.getFeatureString());
+  OS << char(UseLoadLatency);
+  return W;
+}
+
+void Writer::flushBuffer(bool Force) {
+  if (Buffer.size() < ChunkSize && !Force)
+    return;
+  std::string Chunk;
+  Chunk.reserve(ChunkSize + ChunkSize / 4);
+  std::swap(Chunk, Buffer);
+  Output->write(std::move(Chunk));
+}
+
+void Writer::addDescriptor(const mca::InstrDesc &Desc, const MCInst &MCI) {
+  unsigned ID = NextDescID++;
+  DescIDs[&Desc] = ID;
+
+  raw_string_ostream OS(Buffer);
+  OS << char(RK_Descriptor);
+  encodeULEB128(ID, OS);
+  encodeULEB128(MCI.getOpcode(), OS);
+  encodeULEB128(MCI.getNumOperands(), OS);
+  for (const MCOperand &MO : MCI) {
+    if (MO.isReg()) {
+      OS << char(OK_Reg);
+      encodeULEB128(MO.getReg(), OS);
+    } else if (MO.isImm()) {
+      OS << char(OK_Imm);
+      encodeSLEB128(MO.getImm(), OS);
+    } else if (MO.isSFPImm()) {
+      OS << char(OK_SFPImm);
+      encodeULEB128(MO.getSFPImm(), OS);
+    } else if (MO.isDFPImm()) {
+      OS << char(OK_DFPImm);
+      encodeULEB128(MO.getDFPImm(), OS);
+    } else {
+      // Operands like expressions never affect the descriptor, but
+      // they have to be there s.t. operand indices still match.
+      OS << char(OK_Imm);
+      encodeSLEB128(0, OS);
+    }
+  }
+}
+
+void Writer::addMarker(unsigned MDToken, bool IsBegin, bool IsEnd,
+                       StringRef Description) {
+  LoggedMarkers.insert(MDToken);
+
+  raw_string_ostream OS(Buffer);
+  OS << char(RK_Marker);
+  encodeULEB128(MDToken, OS);
+  OS << char((IsBegin? 0b01 : 0) | (IsEnd? 0b10 : 0));
+  writeString(OS, Description);
+}
+
+void Writer::addCycleBegin() {
+  Buffer.push_back(char(RK_CycleBegin));
+}
+
+void Writer::addCycleEnd() {
+  Buffer.push_back(char(RK_CycleEnd));
+  flushBuffer();
+}
+
+void Writer::addEvents(ArrayRef<mca::HWInstructionEventRecord> Events) {
+  raw_string_ostream OS(Buffer);
+  OS << char(RK_Events);
+  encodeULEB128(Events.size(), OS);
+  for (const auto &E : Events) {
+    encodeULEB128(uint64_t(E.Type) << 1 | E.MDToken.hasValue(), OS);
+    encodeSLEB128(int64_t(E.SourceIndex) - int64_t(LastSourceIndex), OS);
+    LastSourceIndex = E.SourceIndex;
+    encodeULEB128(DescIDs.lookup(E.Desc), OS);
+    if (E.MDToken) {
+      encodeSLEB128(int64_t(*E.MDToken) - int64_t(LastMDToken), OS);
+      LastMDToken = *E.MDToken;
+    }
+  }
+}
+
+void Writer::addRegionEnd(StringRef Description, size_t NumInstructions) {
+  LoggedMarkers.clear();
+
+  raw_string_ostream OS(Buffer);
+  OS << char(RK_RegionEnd);
+  encodeULEB128(NumInstructions, OS);
+  writeString(OS, Description);
+  flushBuffer();
+}
+
+Error Writer::close() {
+  assert(Output && "Event log is already closed");
+  flushBuffer(/*Force=*/true);
+  auto E = Output->close();
+  Output.reset();
+  return E;
+}
+
+void LogView::onEvents(ArrayRef<mca::HWInstructionEventRecord> Events) {
+  // Markers have to precede the events referring to them
+  for (const auto &E : Events) {
+    if (!E.MDToken || W.isMarkerLogged(*E.MDToken))
+      continue;
+    if (const auto *Marker = TypedMD.RegionMarkers.lookup(*E.MDToken))
+      W.addMarker(*E.MDToken, Marker->isBegin(), Marker->isEnd(),
+                  Marker->getDescription());
+  }
+  W.addEvents(Events);
+}
+
+namespace {
+// Read LEB128 integers and strings from a buffer. Once anything goes out
+// of bound, every subsequent read fails as well.
+class Cursor {
+  const uint8_t *Ptr, *End;
+  bool HasError;
+
+public:
+  explicit Cursor(StringRef Data)
+    : Ptr(Data.bytes_begin()), End(Data.bytes_end()), HasError(false) {}
+
+  bool empty() const { return Ptr == End; }
+  bool hasError() const { return HasError; }
+  const uint8_t *getPtr() const { return Ptr; }
+
+  uint8_t readByte() {
+    if (HasError || Ptr == End) {
+      HasError = true;
+      return 0U;
+    }
+    return *Ptr++;
+  }
+
+  uint64_t readULEB() {
+    if (HasError)
+      return 0U;
+    unsigned N;
+    const char *Err = nullptr;
+    uint64_t Val = decodeULEB128(Ptr, &N, End, &Err);
+    if (Err) {
+      HasError = true;
+      return 0U;
+    }
+    Ptr += N;
+    return Val;
+  }
+
+  int64_t readSLEB() {
+    if (HasError)
+      return 0;
+    unsigned N;
+    const char *Err = nullptr;
+    int64_t Val = decodeSLEB128(Ptr, &N, End, &Err);
+    if (Err) {
+      HasError = true;
+      return 0;
+    }
+    Ptr += N;
+    return Val;
+  }
+
+  StringRef readString() {
+    uint64_t Size = readULEB();
+    if (HasError || Size > uint64_t(End - Ptr)) {
+      HasError = true;
+      return "";
+    }
+    StringRef Str(reinterpret_cast<const char*>(Ptr), Size);
+    Ptr += Size;
+    return Str;
+  }
+};
+} // end anonymous namespace
+
+Reader::Reader(std::unique_ptr<MemoryBuffer> &&Buffer)
+  : Buffer(std::move(Buffer)), UseLoadLatency(false), RecordsOffset(0U) {}
+
+Reader::~Reader() {}
+
+Expected<std::unique_ptr<Reader>> Reader::create(StringRef Path) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!BufferOrErr)
+    return llvm::errorCodeToError(BufferOrErr.getError());
+
+  std::unique_ptr<Reader> R(new Reader(std::move(*BufferOrErr)));
+  if (auto E = R->readHeader())
+    return E;
+  return R;
+}
+
+Error Reader::readHeader() {
+  StringRef Data = Buffer->getBuffer();
+  if (!Data.startswith(Magic))
+    return makeFormatError("Bad magic");
+
+  Cursor C(Data.drop_front(Magic.size()));
+  LLVMVersion = C.readString();
+  Triple = C.readString();
+  CPU = C.readString();
+  Features = C.readString();
+  UseLoadLatency = C.readByte();
+  if (C.hasError())
+    return makeFormatError("Truncated header");
+
+  RecordsOffset = C.getPtr() - Data.bytes_begin();
+  return ErrorSuccess();
+}
+
+Error Reader::replay(mca::InstrBuilder &IB, TypedMetadata &TMD,
+                     ReplayTarget &Target) {
+  StringRef Data = Buffer->getBuffer();
+  Cursor C(Data.drop_front(RecordsOffset));
+  SmallVector<mca::HWInstructionEventRecord, 16> Events;
+  unsigned LastSourceIndex = 0U, LastMDToken = 0U;
+  size_t NumMissingDescs = 0U;
+  // Instructions seen in the current region
+  size_t NumRegionInsts = 0U;
+
+  while (!C.empty() && !C.hasError()) {
+    size_t RecordOffset = C.getPtr() - Data.bytes_begin();
+    switch (C.readByte()) {
+    case RK_Descriptor: {
+      uint64_t ID = C.readULEB();
+      MCInst MCI;
+      MCI.setOpcode(C.readULEB());
+      for (uint64_t i = 0U, E = C.readULEB(); i < E && !C.hasError(); ++i) {
+        switch (C.readByte()) {
+        case OK_Reg:
+          MCI.addOperand(MCOperand::createReg(C.readULEB()));
+          break;
+        case OK_Imm:
+          MCI.addOperand(MCOperand::createImm(C.readSLEB()));
+          break;
+        case OK_SFPImm:
+          MCI.addOperand(MCOperand::createSFPImm(C.readULEB()));
+          break;
+        case OK_DFPImm:
+          MCI.addOperand(MCOperand::createDFPImm(C.readULEB()));
+          break;
+        default:
+          return makeFormatError("Unknown operand kind at offset " +
+                                 Twine(RecordOffset));
+        }
+      }
+      if (C.hasError())
+        break;
+
+      // IDs are handed out one by one and every descriptor takes several
+      // bytes, so a valid ID never exceeds the log size. Reject the rest
+      // before `ID + 1U` wraps around or asks for a huge table.
+      if (!ID || ID > Data.size())
+        return makeFormatError("Bad descriptor ID at offset " +
+                               Twine(RecordOffset));
+      if (ID >= Descs.size())
+        Descs.resize(ID + 1U, nullptr);
+      // InstrBuilder might keep a reference to the MCInst, so
+      // use the copy that will stay alive.
+      Samples.push_back(MCI);
+      auto InstOrErr = IB.createInstruction(Samples.back());
+      if (!InstOrErr) {
+        llvm::consumeError(InstOrErr.takeError());
+        Descs[ID] = nullptr;
+        break;
+      }
+      // The descriptor is owned by IB
+      Descs[ID] = &(*InstOrErr)->getDesc();
+      break;
+    }
+    case RK_Marker: {
+      unsigned Token = C.readULEB();
+      uint8_t Kinds = C.readByte();
+      StringRef Description = C.readString();
+      RegionMarker Marker;
+      if (Kinds & 0b01)
+        Marker |= RegionMarker::getBegin(Description);
+      if (Kinds & 0b10)
+        Marker |= RegionMarker::getEnd(Description);
+      TMD.RegionMarkers[Token] = Marker;
+      break;
+    }
+    case RK_CycleBegin:
+      for (auto *V : Target.getViews())
+        V->onCycleBegin();
+      break;
+    case RK_CycleEnd:
+      for (auto *V : Target.getViews())
+        V->onCycleEnd();
+      break;
+    case RK_Events: {
+      Events.clear();
+      for (uint64_t i = 0U, E = C.readULEB(); i < E && !C.hasError(); ++i) {
+        uint64_t TypeAndFlag = C.readULEB();
+        LastSourceIndex += C.readSLEB();
+        uint64_t ID = C.readULEB();
+        Optional<unsigned> MDToken;
+        if (TypeAndFlag & 1U) {
+          LastMDToken += C.readSLEB();
+          MDToken = LastMDToken;
+        }
+
+        const mca::InstrDesc *Desc = ID < Descs.size()? Descs[ID] : nullptr;
+        if (!Desc) {
+          ++NumMissingDescs;
+          continue;
+        }
+        Events.push_back({unsigned(TypeAndFlag >> 1), LastSourceIndex, Desc,
+                          MDToken});
+        NumRegionInsts = std::max(NumRegionInsts,
+                                  size_t(LastSourceIndex) + 1U);
+      }
+      if (C.hasError() || Events.empty())
+        break;
+      // Views like SummaryView only take events of instructions they
+      // think have been fetched.
+      Target.onInstructionsSeen(NumRegionInsts);
+      for (auto *V : Target.getViews())
+        V->onEvents(Events);
+      break;
+    }
+    case RK_RegionEnd: {
+      size_t NumInsts = C.readULEB();
+      StringRef Description = C.readString();
+      if (C.hasError())
+        break;
+      Target.onRegionEnd(Description, NumInsts);
+      NumRegionInsts = 0U;
+      break;
+    }
+    default:
+      if (!C.hasError())
+        return makeFormatError("Unknown record at offset " +
+                               Twine(RecordOffset));
+    }
+  }
+
+  if (C.hasError())
+    return makeFormatError("Truncated record");
+  if (NumMissingDescs)
+    WithColor::warning() << NumMissingDescs
+                         << " events were dropped because their "
+                            "instructions could not be built\n";
+  return ErrorSuccess();
+}
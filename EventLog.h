@@ -0,0 +1,180 @@
+#ifndef MCAD_EVENTLOG_H
+#define MCAD_EVENTLOG_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/Error.h"
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AsyncWriter.h"
+#include "MCAViews/View.h"
+
+namespace llvm {
+class MemoryBuffer;
+class MCSubtargetInfo;
+namespace mca {
+class InstrBuilder;
+} // end namespace mca
+
+namespace mcad {
+struct TypedMetadata;
+
+/// A compact binary log of the instruction events delivered to batched
+/// views, which can be replayed into views later without re-running the
+/// pipeline.
+///
+/// The file starts with the magic "MCADEVT1" and a header identifying the
+/// target (LLVM version, triple, CPU, features, and whether load latency
+/// is used). It's followed by a stream of records, each starting with a
+/// one-byte RecordKind. All integers are LEB128 encoded and source
+/// indices as well as metadata tokens are stored as deltas to those of the
+/// previous event.
+///
+/// Since mca::InstrDesc can't be serialized, the first MCInst that is built
+/// into a descriptor is logged instead, such that the reader can build an
+/// equivalent descriptor with its own mca::InstrBuilder.
+namespace event_log {
+enum RecordKind : uint8_t {
+  // ID, opcode, number of operands, [kind, value]...
+  RK_Descriptor = 0,
+  // Token, marker kinds, description
+  RK_Marker,
+  RK_CycleBegin,
+  RK_CycleEnd,
+  // Number of events, [type << 1 | has token, source index delta,
+  //                    descriptor ID, (token delta)]...
+  RK_Events,
+  // Number of instructions, description
+  RK_RegionEnd
+};
+
+class Writer {
+  std::unique_ptr<AsyncWriter> Output;
+  // Records that haven't been handed to Output yet
+  std::string Buffer;
+
+  // IDs of descriptors that have been logged. Zero is reserved for
+  // unknown descriptors.
+  DenseMap<const mca::InstrDesc*, unsigned> DescIDs;
+  unsigned NextDescID;
+  // Tokens of markers that have been logged in the current region
+  DenseSet<unsigned> LoggedMarkers;
+
+  unsigned LastSourceIndex;
+  unsigned LastMDToken;
+
+  explicit Writer(std::unique_ptr<AsyncWriter> &&Output);
+
+  // Hand the buffered records to Output if there are enough of them
+  void flushBuffer(bool Force = false);
+
+public:
+  static Expected<std::unique_ptr<Writer>>
+  create(StringRef Path, const MCSubtargetInfo &STI, bool UseLoadLatency);
+
+  /// Close the file if it's not closed yet.
+  ~Writer();
+
+  /// Log MCI if it's the first instruction built into Desc.
+  void addInstruction(const mca::InstrDesc &Desc, const MCInst &MCI) {
+    if (!DescIDs.count(&Desc))
+      addDescriptor(Desc, MCI);
+  }
+  void addDescriptor(const mca::InstrDesc &Desc, const MCInst &MCI);
+  /// Descriptors are about to be freed, so their addresses might be
+  /// reused by new ones.
+  void forgetDescriptors() { DescIDs.clear(); }
+
+  void addMarker(unsigned MDToken, bool IsBegin, bool IsEnd,
+                 StringRef Description);
+  bool isMarkerLogged(unsigned MDToken) const {
+    return LoggedMarkers.count(MDToken);
+  }
+
+  void addCycleBegin();
+  void addCycleEnd();
+  void addEvents(ArrayRef<mca::HWInstructionEventRecord> Events);
+  void addRegionEnd(StringRef Description, size_t NumInstructions);
+
+  /// Write out all the records and close the file.
+  Error close();
+};
+
+/// Feeds batched events to a Writer. Its lifetime is bound to a
+/// PipelinePrinter while the Writer lives across pipelines.
+class LogView : public mca::View {
+  Writer &W;
+  const TypedMetadata &TypedMD;
+
+public:
+  LogView(Writer &W, const TypedMetadata &TMD) : W(W), TypedMD(TMD) {}
+
+  bool isBatched() const override { return true; }
+  void onCycleBegin() override { W.addCycleBegin(); }
+  void onCycleEnd() override { W.addCycleEnd(); }
+  void onEvents(ArrayRef<mca::HWInstructionEventRecord> Events) override;
+
+  // Nothing to print
+  void printView(raw_ostream &OS) const override {}
+  void printViewJSON(raw_ostream &OS) override {}
+  StringRef getNameAsString() const override { return "EventLog"; }
+};
+
+/// Receives the views to replay events into, as well as the end of
+/// every region.
+struct ReplayTarget {
+  virtual ~ReplayTarget() {}
+
+  virtual ArrayRef<mca::View*> getViews() = 0;
+  /// Called before delivering every batch of events with the number of
+  /// instructions the current region has so far, which is estimated
+  /// by the largest source index seen.
+  virtual void onInstructionsSeen(size_t NumInstructions) {}
+  virtual void onRegionEnd(StringRef Description,
+                           size_t NumInstructions) = 0;
+};
+
+class Reader {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  StringRef LLVMVersion, Triple, CPU, Features;
+  bool UseLoadLatency;
+  // Offset of the first record
+  size_t RecordsOffset;
+
+  // InstrBuilder might keep references to the MCInst, so they
+  // have to stay alive.
+  std::deque<MCInst> Samples;
+  // Indexed by descriptor ID. Null if the descriptor failed to build.
+  std::vector<const mca::InstrDesc*> Descs;
+
+  explicit Reader(std::unique_ptr<MemoryBuffer> &&Buffer);
+
+  Error readHeader();
+
+public:
+  static Expected<std::unique_ptr<Reader>> create(StringRef Path);
+
+  ~Reader();
+
+  StringRef getLLVMVersion() const { return LLVMVersion; }
+  StringRef getTriple() const { return Triple; }
+  StringRef getCPU() const { return CPU; }
+  StringRef getFeatures() const { return Features; }
+  bool useLoadLatency() const { return UseLoadLatency; }
+
+  /// Deliver every logged event to views provided by Target. Descriptors
+  /// are built with IB, which should be created for the logged target,
+  /// and region markers are put into TMD.
+  Error replay(mca::InstrBuilder &IB, TypedMetadata &TMD,
+               ReplayTarget &Target);
+};
+} // end namespace event_log
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,157 @@
+#include "llvm/Config/llvm-config.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCSchedule.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MCA/InstrBuilder.h"
+#include "llvm/MCA/Instruction.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <system_error>
+
+#include "InstrDescCache.h"
+
+using namespace llvm;
+using namespace mcad;
+
+#define DEBUG_TYPE "llvm-mcad"
+
+InstrDescCache::InstrDescCache(const MCSubtargetInfo &STI,
+                               const MCInstrInfo &MCII)
+  : STI(STI), MCII(MCII), SeenOpcodes(MCII.getNumOpcodes()) {
+  raw_string_ostream OS(TargetID);
+  OS << LLVM_VERSION_STRING << "/" << STI.getTargetTriple().str()
+     << "/" << STI.getCPU() << "/" << STI.getFeatureString();
+}
+
+bool InstrDescCache::isCacheable(const MCInst &MCI) const {
+  unsigned Opcode = MCI.getOpcode();
+  if (Opcode >= MCII.getNumOpcodes())
+    return false;
+
+  const MCSchedModel &SM = STI.getSchedModel();
+  if (SM.hasInstrSchedModel()) {
+    unsigned SchedClassID = MCII.get(Opcode).getSchedClass();
+    if (SM.getSchedClassDesc(SchedClassID)->isVariant())
+      return false;
+  }
+
+  for (const MCOperand &MO : MCI)
+    if (!MO.isReg() && !MO.isImm() && !MO.isSFPImm() && !MO.isDFPImm())
+      return false;
+  return true;
+}
+
+Expected<size_t> InstrDescCache::load(StringRef Path, mca::InstrBuilder &IB) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path, /*IsText=*/true);
+  if (!ErrOrBuffer)
+    return llvm::errorCodeToError(ErrOrBuffer.getError());
+
+  auto JsonOrErr = json::parse((*ErrOrBuffer)->getBuffer());
+  if (!JsonOrErr)
+    return JsonOrErr.takeError();
+
+  const json::Object *TopLevel = JsonOrErr->getAsObject();
+  if (!TopLevel)
+    return llvm::createStringError(std::errc::invalid_argument,
+                                   "Malformed InstrDesc cache");
+  // Samples from another target (or even another LLVM build) are useless
+  auto ID = TopLevel->getString("target");
+  if (!ID || *ID != TargetID) {
+    LLVM_DEBUG(dbgs() << "InstrDesc cache target mismatch\n");
+    return 0U;
+  }
+  const json::Array *RawInsts = TopLevel->getArray("insts");
+  if (!RawInsts)
+    return llvm::createStringError(std::errc::invalid_argument,
+                                   "Missing instructions in InstrDesc cache");
+
+  size_t NumBuilt = 0U;
+  for (const json::Value &RawInst : *RawInsts) {
+    // [opcode, [kind, value], ...]
+    // Where kind is either "r" (register), "i" (immediate), "s" (bits of
+    // single-precision FP immediate), or "d" (bits of double-precision FP
+    // immediate).
+    const json::Array *Fields = RawInst.getAsArray();
+    if (!Fields || Fields->empty())
+      continue;
+    auto Opcode = (*Fields)[0].getAsInteger();
+    if (!Opcode)
+      continue;
+
+    MCInst MCI;
+    MCI.setOpcode(unsigned(*Opcode));
+    bool Valid = true;
+    for (unsigned i = 1U, E = Fields->size(); Valid && i != E; ++i) {
+      const json::Array *RawOp = (*Fields)[i].getAsArray();
+      Valid = RawOp && RawOp->size() == 2U;
+      if (!Valid)
+        break;
+      auto Kind = (*RawOp)[0].getAsString();
+      if (Kind && *Kind == "r") {
+        auto Reg = (*RawOp)[1].getAsInteger();
+        if ((Valid = Reg.hasValue()))
+          MCI.addOperand(MCOperand::createReg(unsigned(*Reg)));
+      } else if (Kind && *Kind == "i") {
+        auto Imm = (*RawOp)[1].getAsInteger();
+        if ((Valid = Imm.hasValue()))
+          MCI.addOperand(MCOperand::createImm(*Imm));
+      } else if (Kind && *Kind == "s") {
+        auto Imm = (*RawOp)[1].getAsInteger();
+        if ((Valid = Imm.hasValue()))
+          MCI.addOperand(MCOperand::createSFPImm(uint32_t(*Imm)));
+      } else if (Kind && *Kind == "d") {
+        auto Imm = (*RawOp)[1].getAsInteger();
+        if ((Valid = Imm.hasValue()))
+          MCI.addOperand(MCOperand::createDFPImm(uint64_t(*Imm)));
+      } else
+        Valid = false;
+    }
+    if (!Valid || !isCacheable(MCI) || SeenOpcodes.test(MCI.getOpcode()))
+      continue;
+    SeenOpcodes.set(MCI.getOpcode());
+
+    // InstrBuilder might keep a reference to the MCInst, so
+    // use the copy that will stay alive.
+    Samples.push_back(MCI);
+    auto InstOrErr = IB.createInstruction(Samples.back());
+    if (!InstOrErr) {
+      llvm::consumeError(InstOrErr.takeError());
+      continue;
+    }
+    ++NumBuilt;
+  }
+
+  return NumBuilt;
+}
+
+Error InstrDescCache::save(StringRef Path) const {
+  json::Array RawInsts;
+  for (const MCInst &MCI : Samples) {
+    json::Array Fields;
+    Fields.push_back(int64_t(MCI.getOpcode()));
+    for (const MCOperand &MO : MCI) {
+      if (MO.isReg())
+        Fields.push_back(json::Array({"r", int64_t(MO.getReg())}));
+      else if (MO.isImm())
+        Fields.push_back(json::Array({"i", MO.getImm()}));
+      else if (MO.isSFPImm())
+        Fields.push_back(json::Array({"s", int64_t(MO.getSFPImm())}));
+      else
+        Fields.push_back(json::Array({"d", int64_t(MO.getDFPImm())}));
+    }
+    RawInsts.push_back(std::move(Fields));
+  }
+
+  std::error_code EC;
+  ToolOutputFile OF(Path, EC, sys::fs::OF_Text);
+  if (EC)
+    return llvm::errorCodeToError(EC);
+  OF.os() << json::Value(json::Object({{"target", TargetID},
+                                       {"insts", std::move(RawInsts)}}));
+  OF.keep();
+  return ErrorSuccess();
+}
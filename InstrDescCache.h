@@ -0,0 +1,62 @@
+#ifndef MCAD_INSTRDESCCACHE_H
+#define MCAD_INSTRDESCCACHE_H
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/Error.h"
+#include <deque>
+#include <string>
+
+namespace llvm {
+class MCInstrInfo;
+class MCSubtargetInfo;
+namespace mca {
+class InstrBuilder;
+} // end namespace mca
+
+namespace mcad {
+/// Persists one sample MCInst for every opcode we have seen s.t. the
+/// next run can build their mca::InstrDesc in InstrBuilder upfront
+/// (e.g. while waiting for the Broker), rather than building them lazily
+/// on the critical path.
+///
+/// Note that InstrBuilder doesn't provide a way to install externally
+/// built InstrDesc, so we store MCInst samples rather than the
+/// descriptors themselves. Opcodes with variant scheduling classes are
+/// ignored since their descriptors are bound to specific MCInst instances.
+class InstrDescCache {
+  const MCSubtargetInfo &STI;
+  const MCInstrInfo &MCII;
+
+  // Identify the (LLVM, triple, CPU, features) combination
+  std::string TargetID;
+
+  // Indexed by opcode
+  BitVector SeenOpcodes;
+  // Use deque s.t. samples never move
+  std::deque<MCInst> Samples;
+
+  bool isCacheable(const MCInst &MCI) const;
+
+public:
+  InstrDescCache(const MCSubtargetInfo &STI, const MCInstrInfo &MCII);
+
+  void record(const MCInst &MCI) {
+    // Only check the first instance of each opcode
+    unsigned Opcode = MCI.getOpcode();
+    if (Opcode >= SeenOpcodes.size() || SeenOpcodes.test(Opcode))
+      return;
+    SeenOpcodes.set(Opcode);
+    if (isCacheable(MCI))
+      Samples.push_back(MCI);
+  }
+
+  /// Load samples from Path and build their descriptors with IB.
+  /// Return the number of descriptors built.
+  Expected<size_t> load(StringRef Path, mca::InstrBuilder &IB);
+
+  Error save(StringRef Path) const;
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,125 @@
+//===--------------------- MarkerStatsView.cpp ------------------*- C++ -*-===//
+/// \file
+///
+/// This file implements the MarkerStatsView interface.
+///
+//===----------------------------------------------------------------------===//
+
+#include "MarkerStatsView.h"
+#include "llvm/MCA/Instruction.h"
+#include "llvm/Support/Format.h"
+#include "TypedMetadata.h"
+
+namespace llvm {
+namespace mca {
+
+MarkerStatsView::MarkerStatsView(const mcad::TypedMetadata &TMD)
+  : TypedMD(TMD), CurrentCycle(0U),
+    NumRetiredInsts(0U), NumRetiredUOps(0U),
+    NumUnpairedEnds(0U) {}
+
+void MarkerStatsView::onEvent(const HWInstructionEvent &Event) {
+  if (Event.Type != HWInstructionEvent::Retired)
+    return;
+
+  const Instruction &Inst = *Event.IR.getInstruction();
+  processRetired(Inst.getDesc(), Inst.getMetadataToken());
+}
+
+size_t MarkerStatsView::getMemoryUsage() const {
+  size_t Total = PairingStack.capacity_in_bytes() +
+                 Sites.capacity() * sizeof(SiteStats) +
+                 SiteIndices.getNumBuckets() * sizeof(void*);
+  for (const auto &Entry : SiteIndices)
+    Total += sizeof(Entry) + Entry.getKeyLength() + 1;
+  for (const auto &SS : Sites)
+    Total += SS.Site.capacity();
+  return Total;
+}
+
+void MarkerStatsView::onEvents(ArrayRef<HWInstructionEventRecord> Events) {
+  for (const auto &E : Events)
+    if (E.Type == HWInstructionEvent::Retired)
+      processRetired(*E.Desc, E.MDToken);
+}
+
+void MarkerStatsView::processRetired(const InstrDesc &Desc,
+                                     Optional<unsigned> MDToken) {
+  const mcad::RegionMarker *Marker = nullptr;
+  if (MDToken)
+    Marker = TypedMD.RegionMarkers.lookup(*MDToken);
+
+  // Take the snapshot before counting the begin-marked instruction
+  // s.t. both ends are included in the region.
+  if (Marker && Marker->isBegin())
+    PairingStack.push_back({Marker->getDescription(), CurrentCycle,
+                            NumRetiredInsts, NumRetiredUOps});
+
+  ++NumRetiredInsts;
+  NumRetiredUOps += Desc.NumMicroOps;
+
+  if (!Marker || !Marker->isEnd())
+    return;
+
+  if (PairingStack.empty()) {
+    ++NumUnpairedEnds;
+    return;
+  }
+  Snapshot Begin = PairingStack.pop_back_val();
+
+  StringRef Site = Begin.Site.empty()? "<anonymous>" : Begin.Site;
+  auto Res = SiteIndices.insert(std::make_pair(Site, Sites.size()));
+  if (Res.second)
+    Sites.emplace_back(Site);
+  auto &SS = Sites[Res.first->second];
+
+  ++SS.NumPairs;
+  // Count the cycle this end marker retires in
+  SS.Cycles.add(CurrentCycle - Begin.Cycle + 1);
+  SS.Instructions.add(NumRetiredInsts - Begin.NumInsts);
+  SS.UOps.add(NumRetiredUOps - Begin.NumUOps);
+}
+
+void MarkerStatsView::printTable(raw_ostream &OS, StringRef Title,
+                                 mcad::SampleStats SiteStats::*Stats) const {
+  OS << "\nMarker statistics (" << Title << "):\n";
+  OS << left_justify("Site", 20)
+     << right_justify("Pairs", 10);
+  mcad::printStatsHeader(OS, 14);
+  OS << "\n";
+  for (const auto &SS : Sites) {
+    OS << left_justify(SS.Site, 20)
+       << format("%10llu", (unsigned long long)SS.NumPairs);
+    mcad::printStatsColumns(OS, SS.*Stats, 14);
+    OS << "\n";
+  }
+}
+
+void MarkerStatsView::printView(raw_ostream &OS) const {
+  if (Sites.empty() && !NumUnpairedEnds)
+    return;
+
+  printTable(OS, "cycles", &SiteStats::Cycles);
+  printTable(OS, "instructions", &SiteStats::Instructions);
+  printTable(OS, "uOps", &SiteStats::UOps);
+  if (NumUnpairedEnds)
+    OS << "Unpaired end markers: " << NumUnpairedEnds << "\n";
+  if (PairingStack.size())
+    OS << "Unpaired begin markers: " << PairingStack.size() << "\n";
+}
+
+json::Value MarkerStatsView::toJSON() const {
+  using mcad::toJSON;
+  json::Array JA;
+  for (const auto &SS : Sites)
+    JA.push_back(json::Object({{"Site", SS.Site},
+                               {"Pairs", int64_t(SS.NumPairs)},
+                               {"Cycles", toJSON(SS.Cycles)},
+                               {"Instructions", toJSON(SS.Instructions)},
+                               {"uOps", toJSON(SS.UOps)}}));
+  return json::Object({{"Sites", std::move(JA)},
+                       {"UnpairedEnds", int64_t(NumUnpairedEnds)},
+                       {"UnpairedBegins", int64_t(PairingStack.size())}});
+}
+} // namespace mca
+} // namespace llvm
@@ -0,0 +1,88 @@
+//===--------------------- MarkerStatsView.h --------------------*- C++ -*-===//
+/// \file
+///
+/// This file implements the marker statistics view.
+///
+/// Instead of dumping a summary every time a region marker retires, this
+/// view only records the number of cycles, instructions, and uOps between
+/// each pair of begin / end markers. Results are aggregated by marker site
+/// (i.e. region description) and printed as compact tables. For example:
+///
+/// Marker statistics (cycles):
+/// Site                 Pairs      Total     Min      Mean     Max     P50 ...
+/// foo                  10000    1203344     110     120.3     731     118 ...
+/// bar                      2       2048    1020    1024.0    1028    1020 ...
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_MCAD_MARKERSTATSVIEW_H
+#define LLVM_MCAD_MARKERSTATSVIEW_H
+
+#include "View.h"
+#include "Statistics.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace mcad {
+struct TypedMetadata;
+} // end namespace mcad
+
+namespace mca {
+
+/// A view that aggregates cycle / instruction / uOp deltas between
+/// paired region markers.
+class MarkerStatsView : public View {
+  const mcad::TypedMetadata &TypedMD;
+
+  unsigned CurrentCycle;
+  uint64_t NumRetiredInsts;
+  uint64_t NumRetiredUOps;
+
+  // Snapshot taken when a begin marker retires
+  struct Snapshot {
+    StringRef Site;
+    unsigned Cycle;
+    uint64_t NumInsts;
+    uint64_t NumUOps;
+  };
+  llvm::SmallVector<Snapshot, 4> PairingStack;
+
+  struct SiteStats {
+    std::string Site;
+    size_t NumPairs;
+    mcad::SampleStats Cycles, Instructions, UOps;
+
+    explicit SiteStats(StringRef Site)
+      : Site(Site.str()), NumPairs(0U) {}
+  };
+  // Sorted by the order of first appearance
+  std::vector<SiteStats> Sites;
+  llvm::StringMap<unsigned> SiteIndices;
+  // Number of end markers that have no matching begin marker
+  size_t NumUnpairedEnds;
+
+  void printTable(llvm::raw_ostream &OS, StringRef Title,
+                  mcad::SampleStats SiteStats::*Stats) const;
+
+  void processRetired(const InstrDesc &Desc, Optional<unsigned> MDToken);
+
+public:
+  explicit MarkerStatsView(const mcad::TypedMetadata &TMD);
+
+  void onCycleEnd() override { ++CurrentCycle; }
+  void onEvent(const HWInstructionEvent &Event) override;
+  bool isBatched() const override { return true; }
+  void onEvents(ArrayRef<HWInstructionEventRecord> Events) override;
+  void printView(llvm::raw_ostream &OS) const override;
+  StringRef getNameAsString() const override { return "MarkerStatsView"; }
+  json::Value toJSON() const override;
+  size_t getMemoryUsage() const override;
+};
+} // namespace mca
+} // namespace llvm
+
+#endif
@@ -14,12 +14,10 @@
 
 #include "SummaryView.h"
 #include "llvm/ADT/SmallVector.h"
-#include "llvm/MCA/MetadataRegistry.h"
 #include "llvm/MCA/Support.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
-#include "MDCategories.h"
-#include "RegionMarker.h"
+#include "TypedMetadata.h"
 
 namespace llvm {
 namespace mca {
@@ -29,13 +27,13 @@ namespace mca {
 SummaryView::SummaryView(const MCSchedModel &Model,
                          function_ref<size_t(void)> GetSrcSize,
                          unsigned Width,
-                         mca::MetadataRegistry *MDRegistry,
+                         const mcad::TypedMetadata *TypedMD,
                          llvm::raw_ostream *OutStream)
     : SM(Model), GetSourceSize(GetSrcSize),
       DispatchWidth(Width?Width: Model.IssueWidth),
       LastInstructionIdx(0),
       TotalCycles(0), NumMicroOps(0),
-      MDRegistry(MDRegistry), OutStream(OutStream),
+      TypedMD(TypedMD), OutStream(OutStream),
       ProcResourceUsage(Model.getNumProcResourceKinds(), 0),
       ProcResourceMasks(Model.getNumProcResourceKinds()),
       ResIdx2ProcResID(Model.getNumProcResourceKinds(), 0) {
@@ -48,20 +46,29 @@ SummaryView::SummaryView(const MCSchedModel &Model,
 
 void SummaryView::onEvent(const HWInstructionEvent &Event) {
   const Instruction &Inst = *Event.IR.getInstruction();
-  if (Event.Type == HWInstructionEvent::Dispatched)
-    LastInstructionIdx = Event.IR.getSourceIndex();
+  processEvent(Event.Type, Event.IR.getSourceIndex(), Inst.getDesc(),
+               Inst.getMetadataToken());
+}
+
+void SummaryView::onEvents(ArrayRef<HWInstructionEventRecord> Events) {
+  for (const auto &E : Events)
+    processEvent(E.Type, E.SourceIndex, *E.Desc, E.MDToken);
+}
+
+void SummaryView::processEvent(unsigned Type, unsigned SourceIndex,
+                               const InstrDesc &Desc,
+                               Optional<unsigned> MDToken) {
+  if (Type == HWInstructionEvent::Dispatched)
+    LastInstructionIdx = SourceIndex;
 
   // Try to print region markers
-  if (MDRegistry && Inst.getMetadataToken().hasValue() && OutStream) {
-    auto &MDR = *MDRegistry;
-    unsigned MDTok = *Inst.getMetadataToken();
-    auto &MarkerCat = MDR[mcad::MD_BinaryRegionMarkers];
-    if (auto Marker = MarkerCat.get<mcad::RegionMarker>(MDTok)) {
-      unsigned InstIdx = Event.IR.getSourceIndex();
+  if (TypedMD && MDToken.hasValue() && OutStream) {
+    if (const auto *Marker = TypedMD->RegionMarkers.lookup(*MDToken)) {
+      unsigned InstIdx = SourceIndex;
       bool IsBegin = Marker->isBegin(),
            IsEnd = Marker->isEnd();
 
-      if (Event.Type == HWInstructionEvent::Retired) {
+      if (Type == HWInstructionEvent::Retired) {
         if (IsBegin && IsEnd) {
           (*OutStream) << "====Marker==== [" << InstIdx << "]\n";
           printView(*OutStream);
@@ -85,15 +92,14 @@ void SummaryView::onEvent(const HWInstructionEvent &Event) {
 
   // We are only interested in the "instruction retired" events generated by
   // the retire stage for instructions that are part of iteration #0.
-  if (Event.Type != HWInstructionEvent::Retired ||
-      Event.IR.getSourceIndex() >= GetSourceSize())
+  if (Type != HWInstructionEvent::Retired ||
+      SourceIndex >= GetSourceSize())
     return;
 
   // Update the cumulative number of resource cycles based on the processor
   // resource usage information available from the instruction descriptor. We
   // need to compute the cumulative number of resource cycles for every
   // processor resource which is consumed by an instruction of the block.
-  const InstrDesc &Desc = Inst.getDesc();
   NumMicroOps += Desc.NumMicroOps;
   for (const std::pair<uint64_t, ResourceUsage> &RU : Desc.Resources) {
     if (RU.second.size()) {
@@ -138,6 +144,13 @@ void SummaryView::collectData(DisplayValues &DV) const {
                                                 ProcResourceUsage);
 }
 
+void SummaryView::reset() {
+  LastInstructionIdx = 0U;
+  TotalCycles = 0U;
+  NumMicroOps = 0U;
+  std::fill(ProcResourceUsage.begin(), ProcResourceUsage.end(), 0U);
+}
+
 json::Value SummaryView::toJSON() const {
   DisplayValues DV;
   collectData(DV);
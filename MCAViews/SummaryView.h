@@ -37,9 +37,11 @@
 namespace llvm {
 class raw_ostream;
 
-namespace mca {
-class MetadataRegistry;
+namespace mcad {
+struct TypedMetadata;
+} // end namespace mcad
 
+namespace mca {
 /// A view that collects and prints a few performance numbers.
 class SummaryView : public View {
   const llvm::MCSchedModel &SM;
@@ -51,24 +53,12 @@ class SummaryView : public View {
   unsigned NumMicroOps;
 
   // Used for printing region markers (optional)
-  mca::MetadataRegistry *MDRegistry;
+  const mcad::TypedMetadata *TypedMD;
   llvm::raw_ostream *OutStream;
   // List of begin summary strings to be paired by end-marked
   // instruciton later
   llvm::SmallVector<std::string, 2> PairingStack;
 
-  struct DisplayValues {
-    unsigned Instructions;
-    unsigned Iterations;
-    unsigned TotalInstructions;
-    unsigned TotalCycles;
-    unsigned DispatchWidth;
-    unsigned TotalUOps;
-    double IPC;
-    double UOpsPerCycle;
-    double BlockRThroughput;
-  };
-
   // For each processor resource, this vector stores the cumulative number of
   // resource cycles consumed by the analyzed code block.
   llvm::SmallVector<unsigned, 8> ProcResourceUsage;
@@ -88,21 +78,54 @@ class SummaryView : public View {
   //   - Total Resource Cycles / #Units   (for every resource consumed).
   double getBlockRThroughput() const;
 
+  void processEvent(unsigned Type, unsigned SourceIndex,
+                    const InstrDesc &Desc, Optional<unsigned> MDToken);
+
+public:
+  struct DisplayValues {
+    unsigned Instructions;
+    unsigned Iterations;
+    unsigned TotalInstructions;
+    unsigned TotalCycles;
+    unsigned DispatchWidth;
+    unsigned TotalUOps;
+    double IPC;
+    double UOpsPerCycle;
+    double BlockRThroughput;
+  };
+
   /// Compute the data we want to print out in the object DV.
   void collectData(DisplayValues &DV) const;
 
-public:
+  /// Forget the numbers collected so far, e.g. before the same pipeline
+  /// simulates another region.
+  void reset();
+
+  /// Cumulative resource cycles consumed by the analyzed code block,
+  /// indexed by processor resource ID.
+  ArrayRef<unsigned> getProcResourceUsage() const {
+    return ProcResourceUsage;
+  }
+
   SummaryView(const llvm::MCSchedModel &Model,
               llvm::function_ref<size_t(void)> GetSrcSize,
               unsigned Width,
-              mca::MetadataRegistry *MDRegistry = nullptr,
+              const mcad::TypedMetadata *TypedMD = nullptr,
               llvm::raw_ostream *OutStream = nullptr);
 
   void onCycleEnd() override { ++TotalCycles; }
   void onEvent(const HWInstructionEvent &Event) override;
+  bool isBatched() const override { return true; }
+  void onEvents(ArrayRef<HWInstructionEventRecord> Events) override;
   void printView(llvm::raw_ostream &OS) const override;
   StringRef getNameAsString() const override { return "SummaryView"; }
   json::Value toJSON() const override;
+  size_t getMemoryUsage() const override {
+    size_t Total = PairingStack.capacity_in_bytes();
+    for (const auto &Summary : PairingStack)
+      Total += Summary.capacity();
+    return Total;
+  }
 };
 } // namespace mca
 } // namespace llvm
@@ -11,29 +11,37 @@
 ///
 //===----------------------------------------------------------------------===//
 
-#include "MDCategories.h"
-#include "RegionMarker.h"
 #include "TimelineView.h"
+#include "TypedMetadata.h"
 #include <numeric>
 
 namespace llvm {
 namespace mca {
 
 TimelineView::TimelineView(const MCSubtargetInfo &sti, MCInstPrinter &Printer,
-                           mca::MetadataRegistry &MDR,
+                           const mcad::TypedMetadata &TMD,
                            llvm::raw_ostream &OS,
                            llvm::function_ref<GetInstCallbackTy> CB)
-    : InstructionView(sti, Printer, CB), MDRegistry(MDR),
-      OutStream(OS), CurrentCycle(0) {}
+    : InstructionView(sti, Printer, CB), TypedMD(TMD),
+      OutStream(OS), CurrentCycle(0), IsCapturing(true) {}
+
+void TimelineView::stopCapturing() {
+  IsCapturing = false;
+  PairingStack.clear();
+  ActiveRegions.clear();
+  Timeline.shrink_and_clear();
+}
 
 void TimelineView::onEvent(const HWInstructionEvent &Event) {
+  if (!IsCapturing)
+    return;
+
   const unsigned Index = Event.IR.getSourceIndex();
   const Instruction &Inst = *Event.IR.getInstruction();
 
   bool ToBeTerminated = false;
   if (auto MDTok = Inst.getMetadataToken()) {
-    const auto &MarkerCat = MDRegistry[mcad::MD_BinaryRegionMarkers];
-    if (auto Marker = MarkerCat.get<mcad::RegionMarker>(*MDTok)) {
+    if (const auto *Marker = TypedMD.RegionMarkers.lookup(*MDTok)) {
       if (Marker->isBegin() && Event.Type == HWInstructionEvent::Dispatched) {
         // Starting a new region
         PairingStack.push_back(Index);
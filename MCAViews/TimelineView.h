@@ -107,13 +107,16 @@
 #include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCInstPrinter.h"
 #include "llvm/MC/MCSubtargetInfo.h"
-#include "llvm/MCA/MetadataRegistry.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/JSON.h"
 #include "llvm/Support/raw_ostream.h"
 #include <set>
 
 namespace llvm {
+namespace mcad {
+struct TypedMetadata;
+} // end namespace mcad
+
 namespace mca {
 /// This class listens to instruction state transition events
 /// in order to construct a timeline information.
@@ -123,12 +126,15 @@ namespace mca {
 /// to print the timeline information, as well as the "average wait times"
 /// for every instruction in the input assembly sequence.
 class TimelineView : public InstructionView {
-  mca::MetadataRegistry &MDRegistry;
+  const mcad::TypedMetadata &TypedMD;
 
   llvm::raw_ostream &OutStream;
 
   unsigned CurrentCycle;
 
+  // Whether we're still recording new events
+  bool IsCapturing;
+
   // [First, Last]
   struct RegionRange {
     unsigned First;
@@ -181,10 +187,14 @@ class TimelineView : public InstructionView {
 
 public:
   TimelineView(const llvm::MCSubtargetInfo &sti, llvm::MCInstPrinter &Printer,
-               mca::MetadataRegistry &MDR,
+               const mcad::TypedMetadata &TMD,
                llvm::raw_ostream &OS,
                llvm::function_ref<GetInstCallbackTy> CB = nullptr);
 
+  /// Drop all the captured timeline and ignore events from now on.
+  /// This is used to save memory.
+  void stopCapturing();
+
   // Event handlers.
   void onCycleEnd() override { ++CurrentCycle; }
   void onEvent(const HWInstructionEvent &Event) override;
@@ -194,6 +204,11 @@ public:
   }
   StringRef getNameAsString() const override { return "TimelineView"; }
   json::Value toJSON() const override { return json::Object(); }
+  size_t getMemoryUsage() const override {
+    // Each node in std::multiset has three pointers and a color
+    return Timeline.getMemorySize() + PairingStack.capacity_in_bytes() +
+           ActiveRegions.size() * (sizeof(RegionRange) + 4 * sizeof(void*));
+  }
 };
 } // namespace mca
 } // namespace llvm
@@ -15,6 +15,8 @@
 #ifndef LLVM_TOOLS_LLVM_MCA_VIEW_H
 #define LLVM_TOOLS_LLVM_MCA_VIEW_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/MC/MCInstPrinter.h"
 #include "llvm/MCA/HWEventListener.h"
 #include "llvm/Support/raw_ostream.h"
@@ -22,11 +24,34 @@
 
 namespace llvm {
 namespace mca {
+struct InstrDesc;
+
+/// A compact copy of HWInstructionEvent used by batched event delivery.
+/// Note that we don't keep the Instruction itself since it might be
+/// recycled before the batch is delivered. Payloads of specific event
+/// kinds, like the resources used by an issued instruction or the
+/// registers used by a dispatched one, are not kept either.
+struct HWInstructionEventRecord {
+  unsigned Type;
+  unsigned SourceIndex;
+  const InstrDesc *Desc;
+  Optional<unsigned> MDToken;
+};
 
 class View : public HWEventListener {
 public:
   enum OutputKind { OK_READABLE, OK_JSON };
 
+  /// If this returns true, instruction events will be delivered to this
+  /// view in batches -- once per cycle -- via `onEvents` rather than via
+  /// `onEvent(const HWInstructionEvent&)`. Besides those, the view only
+  /// receives `onCycleBegin` and `onCycleEnd`: stall, pressure, buffer,
+  /// and resource events are not delivered to batched views at all, so
+  /// only views that ignore them, as well as the payloads dropped by
+  /// HWInstructionEventRecord, should opt in.
+  virtual bool isBatched() const { return false; }
+  virtual void onEvents(ArrayRef<HWInstructionEventRecord> Events) {}
+
   void printView(OutputKind OutputKind, llvm::raw_ostream &OS) {
     if (OutputKind == OK_JSON)
       printViewJSON(OS);
@@ -43,6 +68,8 @@ public:
   virtual ~View() = default;
   virtual StringRef getNameAsString() const = 0;
   virtual json::Value toJSON() const { return "not implemented"; }
+  /// (Approximated) number of bytes used by this view's states
+  virtual size_t getMemoryUsage() const { return 0U; }
   void anchor() override;
 };
 } // namespace mca
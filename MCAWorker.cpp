@@ -26,14 +26,18 @@
 #include "llvm/Support/Error.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/WithColor.h"
+#include <algorithm>
 #include <string>
 #include <system_error>
 
 #include "MCAWorker.h"
+#include "MCAViews/MarkerStatsView.h"
 #include "MCAViews/SummaryView.h"
 #include "MCAViews/TimelineView.h"
 #include "PipelinePrinter.h"
@@ -87,11 +91,99 @@ static cl::opt<bool>
                           "model load instructions"),
                  cl::init(true));
 
+static cl::opt<bool>
+  AggregateRegions("aggregate-regions",
+                   cl::desc("Aggregate analysis results of regions with "
+                            "the same description instead of printing a "
+                            "report for every instance"),
+                   cl::init(false));
+static cl::opt<unsigned>
+  AggregateReportInterval("aggregate-report-interval",
+                          cl::desc("Print aggregated reports every N region "
+                                   "instances. Only print them at the end "
+                                   "if it's zero"),
+                          cl::init(0U));
+
+static cl::opt<std::string>
+  InstrDescCacheFile("mca-instr-desc-cache",
+                     cl::desc("Path to a file that stores instructions seen "
+                              "in previous runs. Their descriptors will be "
+                              "built upfront. The file is updated at exit"),
+                     cl::init(""));
+
 // TODO: Put this into a separate CL option group
 static cl::opt<bool>
   ShowTimelineView("mca-show-timeline-view",
                    cl::init(false));
 
+static cl::opt<unsigned>
+  MemoryBudget("memory-budget",
+               cl::desc("Memory budget of this process in MB. Memory "
+                        "usage will be reduced in several stages, with "
+                        "a growing impact on the results, when it's "
+                        "approached. No limit if it's zero"),
+               cl::init(0U));
+
+static cl::opt<std::string>
+  MetricsOutput("metrics-output",
+                cl::desc("Path to a file where runtime metrics are "
+                         "exported to in JSON format"),
+                cl::init(""));
+
+static cl::opt<bool>
+  ReportMemoryUsage("report-memory-usage",
+                    cl::desc("Print the estimated memory usage of each "
+                             "subsystem at exit"),
+                    cl::init(false));
+
+static cl::opt<unsigned>
+  IdleInterval("idle-interval",
+               cl::desc("Do housekeeping, like flushing outputs and "
+                        "exporting metrics, whenever the Broker has no "
+                        "instruction for this many milliseconds. Only "
+                        "supported by some Brokers. Disabled if it's zero"),
+               cl::init(0U));
+
+static cl::opt<std::string>
+  ResultsStorePath("results-store",
+                   cl::desc("Path to a columnar file where the results of "
+                            "every region are written to. It can be "
+                            "queried with mcad-results-query"),
+                   cl::init(""));
+
+static cl::opt<std::string>
+  EventLogPath("event-log",
+               cl::desc("Path to a file where instruction events are "
+                        "logged to. They can be replayed into views "
+                        "with mcad-replay"),
+               cl::init(""));
+
+static cl::opt<std::string>
+  LagReport("lag-report",
+            cl::desc("Path to a file where the lag of every instruction "
+                     "batch, from being executed to being simulated, "
+                     "is written to in NDJSON format"),
+            cl::init(""));
+
+// Only simulate one out of this many batches in sampled simulation
+static constexpr size_t SampledBatchInterval = 4U;
+// Minimal interval between two memory usage samples
+static constexpr std::chrono::milliseconds GovernorCheckInterval(200);
+
+// In nanoseconds, comparable with Broker::BatchTimestamps
+static inline uint64_t getMonotonicTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static cl::opt<bool>
+  ShowMarkerStats("mca-marker-stats",
+                  cl::desc("Only collect cycle, instruction, and uOp counts "
+                           "between paired region markers and print "
+                           "aggregated tables, instead of dumping a summary "
+                           "on every marker"),
+                  cl::init(false));
+
 void BrokerFacade::setBroker(std::unique_ptr<Broker> &&B) {
   Worker.TheBroker = std::move(B);
 }
@@ -116,6 +208,14 @@ const MCSubtargetInfo &BrokerFacade::getSTI() const {
   return Worker.STI;
 }
 
+Metrics &BrokerFacade::getMetrics() const {
+  return Worker.TheMetrics;
+}
+
+MemoryAccounting &BrokerFacade::getMemoryAccounting() const {
+  return Worker.MemAcct;
+}
+
 MCAWorker::MCAWorker(const Target &T,
                      const MCSubtargetInfo &TheSTI,
                      mca::Context &MCA,
@@ -129,6 +229,7 @@ MCAWorker::MCAWorker(const Target &T,
   : TheTarget(T), STI(TheSTI),
     MCAIB(IB), Ctx(C), MAI(AI), MCII(II), MIP(IP),
     TheMCA(MCA), MCAPO(PO), MCAOF(OF),
+    CurSummaryView(nullptr),
     NumTraceMIs(0U), GetTraceMISize([this]{ return NumTraceMIs; }),
     GetRecycledInst([this](const mca::InstrDesc &Desc) -> mca::Instruction* {
                       if (RecycledInsts.count(&Desc)) {
@@ -144,13 +245,79 @@ MCAWorker::MCAWorker(const Target &T,
     AddRecycledInst([this](mca::Instruction *I) {
                       const mca::InstrDesc &D = I->getDesc();
                       RecycledInsts[&D].insert(I);
+                      // Instructions are freed in program order
+                      if (auto MDTok = I->getMetadataToken())
+                        LastFreedMDToken = std::max(LastFreedMDToken,
+                                                    *MDTok);
                     }),
-    Timers("MCAWorker", "Time consumption in each MCA stages") {
+    LastFreedMDToken(0U), TrimMDToken(0U),
+    Timers("MCAWorker", "Time consumption in each MCA stages"),
+    HasVariantDescs(false),
+    NumAggregatedInstances(0U),
+    NumCreatedInsts(0U), NumSampledBatches(0U), NumSampledOutTraceMIs(0U),
+    CurTimelineView(nullptr),
+    NumIdleHeartbeats(0U), BatchBuildTime(0U), BatchSimulateTime(0U) {
   MCAIB.setInstRecycleCallback(GetRecycledInst);
   SrcMgr.setOnInstFreedCallback(AddRecycledInst);
 
   MCAIB.useLoadLatency(UseLoadLatency);
 
+  if (!InstrDescCacheFile.empty())
+    IDCache = std::make_unique<InstrDescCache>(STI, MCII);
+
+  const MCSchedModel &SM = STI.getSchedModel();
+  VariantOpcodes.resize(MCII.getNumOpcodes());
+  for (unsigned Op = 0U, E = MCII.getNumOpcodes(); Op < E; ++Op) {
+    const MCInstrDesc &MCID = MCII.get(Op);
+    if (MCID.isVariadic() ||
+        (SM.hasInstrSchedModel() &&
+         SM.getSchedClassDesc(MCID.getSchedClass())->isVariant()))
+      VariantOpcodes.set(Op);
+  }
+
+  if (!LagReport.empty()) {
+    std::error_code EC;
+    LagReportTOF
+      = std::make_unique<ToolOutputFile>(LagReport, EC, sys::fs::OF_Text);
+    if (EC) {
+      WithColor::error() << "Failed to open lag report: "
+                         << EC.message() << "\n";
+      LagReportTOF.reset();
+    } else
+      LagReportTOF->keep();
+  }
+
+  if (!ResultsStorePath.empty()) {
+    // Resource 0 is the invalid resource
+    SmallVector<std::string, 16> ResourceNames;
+    for (unsigned i = 1U, E = SM.getNumProcResourceKinds(); i < E; ++i)
+      ResourceNames.push_back(SM.getProcResource(i)->Name);
+    auto WriterOrErr
+      = results_store::Writer::create(ResultsStorePath, ResourceNames);
+    if (!WriterOrErr)
+      logAllUnhandledErrors(WriterOrErr.takeError(),
+                            WithColor::error() << "Results store: ");
+    else
+      ResultsWriter = std::move(*WriterOrErr);
+  }
+
+  if (!EventLogPath.empty()) {
+    auto WriterOrErr
+      = event_log::Writer::create(EventLogPath, STI, UseLoadLatency);
+    if (!WriterOrErr)
+      logAllUnhandledErrors(WriterOrErr.takeError(),
+                            WithColor::error() << "Event log: ");
+    else
+      EventLogWriter = std::move(*WriterOrErr);
+  }
+
+  if (MemoryBudget || !MetricsOutput.empty()) {
+    Governor = std::make_unique<MemoryGovernor>(uint64_t(MemoryBudget) << 20);
+    if (MemoryBudget && !MemoryGovernor::getCurrentRSS())
+      WithColor::warning() << "Memory usage is not available on this "
+                           << "platform, -memory-budget will be ignored\n";
+  }
+
   resetPipeline();
 }
 
@@ -200,10 +367,23 @@ std::unique_ptr<mca::Pipeline> MCAWorker::createPipeline() {
 }
 
 void MCAWorker::resetPipeline() {
+  // Instructions in the recycle list are owned by SrcMgr, so they
+  // have to go away with it.
   RecycledInsts.clear();
   NumTraceMIs = 0U;
+  NumCreatedInsts = 0U;
+  NumSampledOutTraceMIs = 0U;
 
-  MCAIB.clear();
+  // Descriptors bound to MCInst instances have to go, since those
+  // instances might be freed or reused. If there is none, keep the rest,
+  // including those warmed up by -mca-instr-desc-cache, rather than
+  // building them again in the next region.
+  if (HasVariantDescs) {
+    MCAIB.clear();
+    HasVariantDescs = false;
+    if (EventLogWriter)
+      EventLogWriter->forgetDescriptors();
+  }
   SrcMgr.clear();
 
   MCAPipeline = createPipeline();
@@ -214,15 +394,41 @@ void MCAWorker::resetPipeline() {
                                              PrintJson ? mca::View::OK_JSON
                                                        : mca::View::OK_READABLE);
   const MCSchedModel &SM = STI.getSchedModel();
-  MCAPipelinePrinter->addView(
-    std::make_unique<mca::SummaryView>(SM, GetTraceMISize, 0U,
-                                       TheMCA.getMetadataRegistry(),
-                                       &MCAOF.os()));
-  if (ShowTimelineView)
+  // SummaryView only dumps per-marker summaries if it has access
+  // to the typed metadata. Leave them to MarkerStatsView if it's shown.
+  auto SV = std::make_unique<mca::SummaryView>(
+    SM, GetTraceMISize, 0U,
+    ShowMarkerStats? nullptr : &TypedMD, &MCAOF.os());
+  CurSummaryView = SV.get();
+  MCAPipelinePrinter->addView(std::move(SV));
+  if (ShowMarkerStats)
+    MCAPipelinePrinter->addView(
+      std::make_unique<mca::MarkerStatsView>(TypedMD));
+  CurTimelineView = nullptr;
+  // Timelines are never printed for aggregated regions
+  if (ShowTimelineView && !AggregateRegions &&
+      (!Governor || Governor->getStage() < MemoryGovernor::S_DropTimeline)) {
+    auto TV = std::make_unique<mca::TimelineView>(STI, MIP, TypedMD,
+                                                  MCAOF.os());
+    CurTimelineView = TV.get();
+    MCAPipelinePrinter->addView(std::move(TV));
+  }
+  if (EventLogWriter)
     MCAPipelinePrinter->addView(
-      std::make_unique<mca::TimelineView>(STI, MIP,
-                                          *TheMCA.getMetadataRegistry(),
-                                          MCAOF.os()));
+      std::make_unique<event_log::LogView>(*EventLogWriter, TypedMD));
+}
+
+void MCAWorker::reusePipeline() {
+  assert(MCAPipeline && CurSummaryView);
+  NumTraceMIs = 0U;
+  NumCreatedInsts = 0U;
+  NumSampledOutTraceMIs = 0U;
+
+  // Every instruction has retired by now, so the pipeline and its
+  // hardware units are as good as new. Only the views need to forget
+  // the last instance.
+  SrcMgr.reopen();
+  CurSummaryView->reset();
 }
 
 Error MCAWorker::run() {
@@ -249,11 +455,35 @@ Error MCAWorker::run() {
       TraceTOF->keep();
   }
 
+  // Build instruction descriptors before the (potentially blocking)
+  // first fetch.
+  if (IDCache && sys::fs::exists(InstrDescCacheFile)) {
+    static Timer TheTimer("LoadInstrDescCache", "Loading InstrDesc cache",
+                          Timers);
+    TimeRegion TR(TheTimer);
+    auto NumOrErr = IDCache->load(InstrDescCacheFile, MCAIB);
+    if (!NumOrErr)
+      logAllUnhandledErrors(NumOrErr.takeError(),
+                            WithColor::warning() << "InstrDesc cache: ");
+    else
+      LLVM_DEBUG(dbgs() << "Built " << *NumOrErr
+                        << " InstrDesc from cache\n");
+  }
+
   SmallVector<const MCInst*, DEFAULT_MAX_NUM_PROCESSED>
     TraceBuffer(MaxNumProcessedInst);
 
   bool UseRegion = TheBroker->hasFeature<Broker::Feature_Region>();
   size_t RegionIdx = 0U;
+  SmallVector<Broker::RegionBoundary, 4> RegionBoundaries;
+  auto printRegion = [&,this](StringRef Description) {
+    if (!Description.empty())
+      printMCA(Description);
+    else
+      printMCA(std::string("Region [") +
+               std::to_string(RegionIdx++) +
+               std::string(1, ']'));
+  };
 
   mca::MetadataRegistry *MDRegistry = TheMCA.getMetadataRegistry();
   bool SupportMetadata = TheBroker->hasFeature<Broker::Feature_Metadata>();
@@ -261,147 +491,275 @@ Error MCAWorker::run() {
          "MetadataRegistry not created?");
   DenseMap<unsigned, unsigned> MDIndexMap;
 
+  if (IdleInterval && TheBroker->hasFeature<Broker::Feature_FetchTimeout>())
+    TheBroker->setFetchTimeout(std::chrono::milliseconds(IdleInterval));
+
   // The end of instruction streams in all regions
   bool EndOfStream = false;
-  while (true) {
-    bool Continue = true;
-    Broker::RegionDescriptor RD(/*IsEnd=*/false);
-    while (Continue) {
-      int Len = 0;
-      if (UseRegion) {
-        if (SupportMetadata) {
-          MDIndexMap.clear();
-          std::tie(Len, RD)
-            = TheBroker->fetchRegion(TraceBuffer, -1,
-                                     MDExchanger{*MDRegistry, MDIndexMap});
-        } else
-          std::tie(Len, RD) = TheBroker->fetchRegion(TraceBuffer);
-      } else {
-        if (SupportMetadata) {
-          MDIndexMap.clear();
-          Len = TheBroker->fetch(TraceBuffer, -1,
-                                 MDExchanger{*MDRegistry, MDIndexMap});
-        } else
-          Len = TheBroker->fetch(TraceBuffer);
-      }
+  while (!EndOfStream) {
+    int Len = 0;
+    RegionBoundaries.clear();
+    if (UseRegion) {
+      if (SupportMetadata) {
+        MDIndexMap.clear();
+        Len = TheBroker->fetchRegions(TraceBuffer, -1, RegionBoundaries,
+                                      MDExchanger{*MDRegistry, TypedMD,
+                                                  MDIndexMap});
+      } else
+        Len = TheBroker->fetchRegions(TraceBuffer, -1, RegionBoundaries);
+    } else {
+      if (SupportMetadata) {
+        MDIndexMap.clear();
+        Len = TheBroker->fetch(TraceBuffer, -1,
+                               MDExchanger{*MDRegistry, TypedMD,
+                                           MDIndexMap});
+      } else
+        Len = TheBroker->fetch(TraceBuffer);
+    }
 
-      if (Len < 0 || RD) {
-        SrcMgr.endOfStream();
-        Continue = false;
-        if (Len < 0) {
-          Len = 0;
-          EndOfStream = true;
-        }
-      }
+    if (Len == Broker::FetchTimedOut) {
+      doIdleWork(TraceOS);
+      continue;
+    }
 
-      ArrayRef<const MCInst*> TraceBufferSlice(TraceBuffer);
-      TraceBufferSlice = TraceBufferSlice.take_front(Len);
-
-      static Timer TheTimer("MCAInstrBuild", "MCA Build Instruction", Timers);
-      {
-        TimeRegion TR(TheTimer);
-
-        // Convert MCInst to mca::Instruction
-        for (unsigned i = 0U, S = TraceBufferSlice.size();
-             i < S; ++i) {
-          const MCInst &MCI = *TraceBufferSlice[i];
-          ++NumTraceMIs;
-          const auto &MCID = MCII.get(MCI.getOpcode());
-          // Always ignore return instruction since it's
-          // not really meaningful
-          if (MCID.isReturn()) continue;
-          if (!PreserveCallInst)
-            if (MCID.isCall())
-              continue;
-
-          if (TraceOS) {
-            MIP.printInst(&MCI, 0, "", STI, *TraceOS);
-            (*TraceOS) << "\n";
-          }
-
-          mca::Instruction *RecycledInst = nullptr;
-          Expected<std::unique_ptr<mca::Instruction>> InstOrErr
-            = MCAIB.createInstruction(MCI);
-          if (!InstOrErr) {
-            if (auto RemainingE = handleErrors(
-                     InstOrErr.takeError(),
-                     [&](const mca::RecycledInstErr &RC) {
-                       RecycledInst = RC.getInst();
-                     })) {
-#if 0
-              llvm::logAllUnhandledErrors(std::move(RemainingE),
-                                          WithColor::error());
-              MIP.printInst(&MCI, 0, "", STI,
-                            WithColor::note() << "Current MCInst: ");
-              errs() << "\n";
-#endif
-              // FIXME: Ideally we should print out the error in this
-              // stage before carrying on, just like the commented code above.
-              // But we are seeing tremendous number of errors caused by the
-              // lack of MCSched info for 'hint X' instructions in AArch64.
-              // And these error messages will actually overflow our python
-              // harness used in the experiments :-P Thus we're temporarily
-              // disabling the error message here.
-              llvm::consumeError(std::move(RemainingE));
-              continue;
-            }
-          }
-          if (RecycledInst) {
-            if (SupportMetadata && MDIndexMap.count(i)) {
-              auto MDTok = MDIndexMap.lookup(i);
-              LLVM_DEBUG(dbgs() << "MCI " << NumTraceMIs
-                                << " has Token " << MDTok << "\n");
-              RecycledInst->setMetadataToken(MDTok);
-            }
-            SrcMgr.addRecycledInst(RecycledInst);
-          } else {
-            auto &NewInst = InstOrErr.get();
-            if (SupportMetadata && MDIndexMap.count(i)) {
-              auto MDTok = MDIndexMap.lookup(i);
-              LLVM_DEBUG(dbgs() << "MCI " << NumTraceMIs
-                                << " has Token " << MDTok << "\n");
-              NewInst->setMetadataToken(MDTok);
-            }
-            SrcMgr.addInst(std::move(NewInst));
-          }
-        }
-      }
+    if (Len < 0) {
+      Len = 0;
+      EndOfStream = true;
+    }
+    if (Len > 0)
+      TheMetrics.add("simulation.instructions", Len);
+
+    Optional<Broker::BatchTimestamps> Timestamps;
+    uint64_t FetchedTime = 0U;
+    if (Len > 0 && (Timestamps = TheBroker->getLastBatchTimestamps()))
+      FetchedTime = getMonotonicTime();
+    BatchBuildTime = BatchSimulateTime = 0U;
 
+    if (Governor)
+      checkMemoryUsage();
+    // In sampled simulation we still go through every region boundary,
+    // but instructions in the skipped batches are not simulated.
+    bool SkipBatch = false;
+    if (Governor && Governor->getStage() >= MemoryGovernor::S_Sampling) {
+      SkipBatch = NumSampledBatches++ % SampledBatchInterval;
+      if (SkipBatch)
+        TheMetrics.add("simulation.sampled_out_instructions", Len);
+    }
+
+    ArrayRef<const MCInst*> TraceBufferSlice(TraceBuffer);
+    TraceBufferSlice = TraceBufferSlice.take_front(Len);
+    const auto *MDIndexMapPtr = SupportMetadata? &MDIndexMap : nullptr;
+
+    // A single batch might carry several complete regions, analyze
+    // each of them with a fresh pipeline.
+    unsigned BeginIdx = 0U;
+    for (const auto &Boundary : RegionBoundaries) {
+      assert(Boundary.EndIdx >= BeginIdx &&
+             Boundary.EndIdx <= TraceBufferSlice.size());
+      if (!SkipBatch)
+        buildInstructions(
+          TraceBufferSlice.slice(BeginIdx, Boundary.EndIdx - BeginIdx),
+          BeginIdx, MDIndexMapPtr, TraceOS);
+      else
+        NumSampledOutTraceMIs += Boundary.EndIdx - BeginIdx;
+      BeginIdx = Boundary.EndIdx;
+
+      SrcMgr.endOfStream();
       if (NumTraceMIs) {
         if (auto E = runPipeline())
           return E;
       }
-    }
-    if (UseRegion) {
-      if (!RD.Description.empty())
-        printMCA(RD.Description);
+      if (AggregateRegions)
+        aggregateRegion(Boundary.Description);
       else
-        printMCA(std::string("Region [") +
-                 std::to_string(RegionIdx++) +
-                 std::string(1, ']'));
-    } else
-      printMCA();
+        printRegion(Boundary.Description);
+      sendRegionResult(Boundary.Description);
+      storeRegionResult(Boundary.Description);
+      logRegionEnd(Boundary.Description);
 
-    if (EndOfStream)
-      break;
-    if (UseRegion) {
-      resetPipeline();
+      // Instances of the same region usually share most of their
+      // instructions, so keep the descriptors and recycled instructions
+      // warm if we're aggregating them.
+      if (AggregateRegions)
+        reusePipeline();
+      else
+        resetPipeline();
       if (TraceOS) {
         (*TraceOS) << MAI.getCommentString()
                    << " === End Of Region ===\n";
       }
     }
+
+    // Instructions that belong to a region that hasn't ended yet
+    if (!SkipBatch)
+      buildInstructions(TraceBufferSlice.drop_front(BeginIdx), BeginIdx,
+                        MDIndexMapPtr, TraceOS);
+    else
+      NumSampledOutTraceMIs += TraceBufferSlice.size() - BeginIdx;
+    if (EndOfStream)
+      SrcMgr.endOfStream();
+
+    if (NumTraceMIs) {
+      if (auto E = runPipeline())
+        return E;
+    }
+
+    if (Timestamps)
+      recordLags(*Timestamps, FetchedTime, Len);
+  }
+
+  if (UseRegion) {
+    // The last region might not have an explicit end
+    if (AggregateRegions)
+      aggregateRegion("");
+    else
+      printRegion("");
+    sendRegionResult("");
+    storeRegionResult("");
+    logRegionEnd("");
+    if (AggregateRegions)
+      printAggregatedRegions();
+  } else {
+    printMCA();
+    storeRegionResult("");
+    logRegionEnd("");
+  }
+
+  if (ResultsWriter) {
+    if (auto E = ResultsWriter->finalize())
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << "Results store: ");
+    ResultsWriter.reset();
+  }
+
+  if (EventLogWriter) {
+    if (auto E = EventLogWriter->close())
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << "Event log: ");
+    EventLogWriter.reset();
+  }
+
+  if (IDCache)
+    if (auto E = IDCache->save(InstrDescCacheFile))
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::warning() << "InstrDesc cache: ");
+
+  if (Governor) {
+    Governor->update();
+    exportMetrics();
+  }
+
+  if (ReportMemoryUsage) {
+    updateMemoryAccounting();
+    MemAcct.print(errs());
   }
 
   return ErrorSuccess();
 }
 
+void MCAWorker::buildInstructions(ArrayRef<const MCInst*> MCIs,
+                                  unsigned BatchOffset,
+                                  const DenseMap<unsigned, unsigned> *MDIndexMap,
+                                  raw_ostream *TraceOS) {
+  static Timer TheTimer("MCAInstrBuild", "MCA Build Instruction", Timers);
+  TimeRegion TR(TheTimer);
+  uint64_t StartTime = getMonotonicTime();
+
+  // Convert MCInst to mca::Instruction
+  for (unsigned i = 0U, S = MCIs.size(); i < S; ++i) {
+    const MCInst &MCI = *MCIs[i];
+    ++NumTraceMIs;
+    const auto &MCID = MCII.get(MCI.getOpcode());
+    // Always ignore return instruction since it's
+    // not really meaningful
+    if (MCID.isReturn()) continue;
+    if (!PreserveCallInst)
+      if (MCID.isCall())
+        continue;
+
+    if (IDCache)
+      IDCache->record(MCI);
+    if (VariantOpcodes.test(MCI.getOpcode()))
+      HasVariantDescs = true;
+
+    if (TraceOS) {
+      MIP.printInst(&MCI, 0, "", STI, *TraceOS);
+      // Annotate the guest address if the Broker provides one
+      if (MDIndexMap && MDIndexMap->count(BatchOffset + i)) {
+        unsigned MDTok = MDIndexMap->lookup(BatchOffset + i);
+        if (const auto *Addr = TypedMD.InstrAddrs.lookup(MDTok))
+          (*TraceOS) << " " << MAI.getCommentString() << " "
+                     << format_hex(*Addr, 16);
+      }
+      (*TraceOS) << "\n";
+    }
+
+    mca::Instruction *RecycledInst = nullptr;
+    Expected<std::unique_ptr<mca::Instruction>> InstOrErr
+      = MCAIB.createInstruction(MCI);
+    if (!InstOrErr) {
+      if (auto RemainingE = handleErrors(
+               InstOrErr.takeError(),
+               [&](const mca::RecycledInstErr &RC) {
+                 RecycledInst = RC.getInst();
+               })) {
+#if 0
+        llvm::logAllUnhandledErrors(std::move(RemainingE),
+                                    WithColor::error());
+        MIP.printInst(&MCI, 0, "", STI,
+                      WithColor::note() << "Current MCInst: ");
+        errs() << "\n";
+#endif
+        // FIXME: Ideally we should print out the error in this
+        // stage before carrying on, just like the commented code above.
+        // But we are seeing tremendous number of errors caused by the
+        // lack of MCSched info for 'hint X' instructions in AArch64.
+        // And these error messages will actually overflow our python
+        // harness used in the experiments :-P Thus we're temporarily
+        // disabling the error message here.
+        llvm::consumeError(std::move(RemainingE));
+        continue;
+      }
+    }
+
+    // Index of this MCInst in the fetched batch
+    unsigned BatchIdx = BatchOffset + i;
+    if (RecycledInst) {
+      if (MDIndexMap && MDIndexMap->count(BatchIdx)) {
+        auto MDTok = MDIndexMap->lookup(BatchIdx);
+        LLVM_DEBUG(dbgs() << "MCI " << NumTraceMIs
+                          << " has Token " << MDTok << "\n");
+        RecycledInst->setMetadataToken(MDTok);
+      }
+      if (EventLogWriter)
+        EventLogWriter->addInstruction(RecycledInst->getDesc(), MCI);
+      SrcMgr.addRecycledInst(RecycledInst);
+    } else {
+      auto &NewInst = InstOrErr.get();
+      if (MDIndexMap && MDIndexMap->count(BatchIdx)) {
+        auto MDTok = MDIndexMap->lookup(BatchIdx);
+        LLVM_DEBUG(dbgs() << "MCI " << NumTraceMIs
+                          << " has Token " << MDTok << "\n");
+        NewInst->setMetadataToken(MDTok);
+      }
+      if (EventLogWriter)
+        EventLogWriter->addInstruction(NewInst->getDesc(), MCI);
+      SrcMgr.addInst(std::move(NewInst));
+      ++NumCreatedInsts;
+    }
+  }
+
+  BatchBuildTime += getMonotonicTime() - StartTime;
+}
+
 Error MCAWorker::runPipeline() {
   assert(MCAPipeline);
   static Timer TheTimer("RunMCAPipeline", "MCA Pipeline", Timers);
   TimeRegion TR(TheTimer);
 
+  uint64_t StartTime = getMonotonicTime();
   Expected<unsigned> Cycles = MCAPipeline->run();
+  BatchSimulateTime += getMonotonicTime() - StartTime;
   if (!Cycles) {
     if (!Cycles.errorIsA<mca::InstStreamPause>()) {
       return Cycles.takeError();
@@ -412,11 +770,16 @@ Error MCAWorker::runPipeline() {
     }
   }
 
+  // Views might still hold events of a paused cycle, so only drop
+  // metadata of instructions freed before the previous run.
+  TypedMD.trim(TrimMDToken);
+  TrimMDToken = LastFreedMDToken;
+
   return ErrorSuccess();
 }
 
 void MCAWorker::printMCA(StringRef RegionDescription) {
-  if (!NumTraceMIs) return;
+  if (!NumTraceMIs && !NumSampledOutTraceMIs) return;
 
   raw_ostream &OS = MCAOF.os();
   // Print region description text if feasible
@@ -424,9 +787,320 @@ void MCAWorker::printMCA(StringRef RegionDescription) {
     OS << "\n=== Printing report for "
        << RegionDescription << " ===\n";
 
+  // Results of sampled simulation are not complete
+  if (!NumTraceMIs) {
+    OS << "Sampled out: none of its " << NumSampledOutTraceMIs
+       << " instructions were simulated\n";
+    return;
+  }
+  if (NumSampledOutTraceMIs)
+    OS << "Sampled: only " << NumTraceMIs << " of its "
+       << NumTraceMIs + NumSampledOutTraceMIs
+       << " instructions were simulated\n";
+
   MCAPipelinePrinter->printReport(OS);
 }
 
+void MCAWorker::sendRegionResult(StringRef RegionDescription) {
+  if (!NumTraceMIs && !NumSampledOutTraceMIs) return;
+  assert(CurSummaryView);
+
+  mca::SummaryView::DisplayValues DV = {};
+  if (NumTraceMIs)
+    CurSummaryView->collectData(DV);
+  Broker::RegionResult Result;
+  Result.Description = RegionDescription;
+  Result.NumInstructions = DV.TotalInstructions;
+  Result.NumCycles = DV.TotalCycles;
+  Result.NumMicroOps = DV.TotalUOps;
+  Result.NumSampledOutInstructions = NumSampledOutTraceMIs;
+  TheBroker->onRegionResult(Result);
+}
+
+void MCAWorker::storeRegionResult(StringRef RegionDescription) {
+  if ((!NumTraceMIs && !NumSampledOutTraceMIs) || !ResultsWriter) return;
+  assert(CurSummaryView);
+
+  mca::SummaryView::DisplayValues DV = {};
+  if (NumTraceMIs)
+    CurSummaryView->collectData(DV);
+  auto Usage = CurSummaryView->getProcResourceUsage();
+  // Skip the invalid resource
+  if (!Usage.empty())
+    Usage = Usage.drop_front();
+  SmallVector<uint64_t, 16> ResourceCycles(Usage.begin(), Usage.end());
+
+  results_store::Record R;
+  R.Description = RegionDescription.empty()? "<anonymous>"
+                                           : RegionDescription;
+  R.NumInstructions = DV.TotalInstructions;
+  R.NumCycles = DV.TotalCycles;
+  R.NumMicroOps = DV.TotalUOps;
+  R.NumSampledOutInstructions = NumSampledOutTraceMIs;
+  R.ResourceCycles = ResourceCycles;
+  ResultsWriter->append(R);
+}
+
+void MCAWorker::logRegionEnd(StringRef RegionDescription) {
+  if (!NumTraceMIs || !EventLogWriter) return;
+
+  // Events of the last cycle might still be held by the batcher
+  MCAPipelinePrinter->flush();
+  EventLogWriter->addRegionEnd(RegionDescription, NumTraceMIs);
+}
+
+void MCAWorker::aggregateRegion(StringRef RegionDescription) {
+  if (!NumTraceMIs && !NumSampledOutTraceMIs) return;
+  assert(CurSummaryView);
+
+  static Timer TheTimer("AggregateRegion", "Aggregating region results",
+                        Timers);
+  TimeRegion TR(TheTimer);
+
+  if (RegionDescription.empty())
+    RegionDescription = "<anonymous>";
+  auto Res = AggregatedRegionIndices.insert(
+    std::make_pair(RegionDescription, AggregatedRegions.size()));
+  if (Res.second)
+    AggregatedRegions.emplace_back(RegionDescription);
+  auto &RA = AggregatedRegions[Res.first->second];
+
+  if (NumTraceMIs) {
+    mca::SummaryView::DisplayValues DV;
+    CurSummaryView->collectData(DV);
+    ++RA.NumInstances;
+    RA.Cycles.add(DV.TotalCycles);
+    RA.Instructions.add(DV.TotalInstructions);
+    RA.UOps.add(DV.TotalUOps);
+    if (NumSampledOutTraceMIs)
+      ++RA.NumSampledInstances;
+  } else
+    ++RA.NumSampledOutInstances;
+  RA.Updated = true;
+
+  ++NumAggregatedInstances;
+  if (AggregateReportInterval &&
+      NumAggregatedInstances % AggregateReportInterval == 0)
+    printAggregatedRegions(/*OnlyUpdated=*/true);
+}
+
+void MCAWorker::checkMemoryUsage() {
+  assert(Governor);
+  auto Now = std::chrono::steady_clock::now();
+  if (Now - LastGovernorCheck < GovernorCheckInterval)
+    return;
+  LastGovernorCheck = Now;
+
+  MemoryGovernor::Stage OldStage = Governor->getStage();
+  MemoryGovernor::Stage NewStage = Governor->update();
+  for (unsigned S = OldStage + 1U; S <= NewStage; ++S)
+    applyMemoryStage(MemoryGovernor::Stage(S));
+
+  // Cold instructions keep accumulating, so keep evicting them
+  if (NewStage >= MemoryGovernor::S_EvictCaches &&
+      OldStage >= MemoryGovernor::S_EvictCaches)
+    TheBroker->onMemoryPressure(Broker::MPR_EvictCaches);
+
+  exportMetrics();
+}
+
+StringRef MCAWorker::getLagStageName(LagStage S) {
+  switch (S) {
+  case LS_Relay:
+    return "relay";
+  case LS_Queue:
+    return "queue";
+  case LS_Build:
+    return "build";
+  case LS_Simulate:
+    return "simulate";
+  case LS_EndToEnd:
+    return "end_to_end";
+  default:
+    llvm_unreachable("Invalid lag stage");
+  }
+}
+
+void MCAWorker::recordLags(const Broker::BatchTimestamps &TS,
+                           uint64_t FetchedTime, size_t NumInsts) {
+  uint64_t Now = getMonotonicTime();
+  // Timestamps from a Broker might come from another host, whose
+  // monotonic clock is not comparable with ours.
+  Optional<uint64_t> Durations[LS_NUM_STAGES];
+  if (TS.Executed && TS.Received >= TS.Executed)
+    Durations[LS_Relay] = TS.Received - TS.Executed;
+  if (TS.Received && FetchedTime >= TS.Received)
+    Durations[LS_Queue] = FetchedTime - TS.Received;
+  Durations[LS_Build] = BatchBuildTime;
+  Durations[LS_Simulate] = BatchSimulateTime;
+  if (TS.Executed && Now >= TS.Executed)
+    Durations[LS_EndToEnd] = Now - TS.Executed;
+
+  json::Object JO;
+  JO["insts"] = int64_t(NumInsts);
+  for (unsigned S = 0U; S < LS_NUM_STAGES; ++S) {
+    if (!Durations[S])
+      continue;
+    uint64_t Micros = *Durations[S] / 1000U;
+    Lags[S].add(Micros);
+    if (LagReportTOF)
+      JO[(getLagStageName(LagStage(S)) + "_us").str()] = int64_t(Micros);
+  }
+
+  if (LagReportTOF)
+    LagReportTOF->os() << formatv("{0}", json::Value(std::move(JO))) << "\n";
+}
+
+void MCAWorker::doIdleWork(raw_ostream *TraceOS) {
+  ++NumIdleHeartbeats;
+  LLVM_DEBUG(dbgs() << "Broker has been idle for " << IdleInterval
+                    << " ms, heartbeat #" << NumIdleHeartbeats << "\n");
+  TheMetrics.set("worker.idle_heartbeats", NumIdleHeartbeats);
+
+  // Make sure whatever we have so far is visible to the outside
+  MCAOF.os().flush();
+  if (TraceOS)
+    TraceOS->flush();
+  if (LagReportTOF)
+    LagReportTOF->os().flush();
+
+  if (Governor)
+    checkMemoryUsage();
+}
+
+void MCAWorker::applyMemoryStage(MemoryGovernor::Stage S) {
+  StringRef Action;
+  switch (S) {
+  case MemoryGovernor::S_Normal:
+    return;
+  case MemoryGovernor::S_EvictCaches:
+    Action = "evicting cold instructions in the Broker";
+    if (!TheBroker->onMemoryPressure(Broker::MPR_EvictCaches))
+      Action = "but the Broker can't evict instructions";
+    break;
+  case MemoryGovernor::S_DropTimeline:
+    Action = "dropping timeline capture";
+    if (CurTimelineView)
+      CurTimelineView->stopCapturing();
+    break;
+  case MemoryGovernor::S_ReduceMetadata:
+    Action = "reducing instruction metadata";
+    if (!TheBroker->onMemoryPressure(Broker::MPR_ReduceMetadata))
+      Action = "but the Broker can't reduce instruction metadata";
+    TypedMD.InstrAddrs.clear();
+    break;
+  case MemoryGovernor::S_Sampling:
+    Action = "switching to sampled simulation";
+    NumSampledBatches = 0U;
+    break;
+  }
+
+  WithColor::warning() << "Memory usage "
+                       << (Governor->getLastRSS() >> 20) << " MB reached "
+                       << MemoryGovernor::getThreshold(S) << "% of the "
+                       << (Governor->getBudget() >> 20) << " MB budget, "
+                       << Action << "\n";
+  TheMetrics.add("memory.governor.steps");
+  TheMetrics.set(std::string("memory.governor.") +
+                 MemoryGovernor::getStageName(S).str() + "_rss_bytes",
+                 Governor->getLastRSS());
+}
+
+void MCAWorker::updateMemoryAccounting() {
+  MemAcct.set(MemoryAccounting::T_Metadata, TypedMD.getMemorySize());
+  MemAcct.set(MemoryAccounting::T_InstructionPool,
+              NumCreatedInsts * sizeof(mca::Instruction));
+  if (MCAPipelinePrinter)
+    MemAcct.set(MemoryAccounting::T_Views,
+                MCAPipelinePrinter->getMemoryUsage());
+  MemAcct.set(MemoryAccounting::T_OutputBuffers,
+              MCAOF.os().GetBufferSize());
+}
+
+void MCAWorker::exportMetrics() {
+  assert(Governor);
+  updateMemoryAccounting();
+  MemAcct.exportTo(TheMetrics);
+  TheMetrics.set("memory.budget_bytes", Governor->getBudget());
+  TheMetrics.set("memory.rss_bytes", Governor->getLastRSS());
+  TheMetrics.set("memory.peak_rss_bytes", Governor->getPeakRSS());
+  TheMetrics.set("memory.governor.stage", Governor->getStage());
+
+  for (unsigned S = 0U; S < LS_NUM_STAGES; ++S) {
+    const SampleStats &Lag = Lags[S];
+    if (!Lag.count())
+      continue;
+    std::string Prefix = ("lag." + getLagStageName(LagStage(S)) + ".").str();
+    TheMetrics.set(Prefix + "count", Lag.count());
+    TheMetrics.set(Prefix + "p50_us", Lag.percentile(50.0));
+    TheMetrics.set(Prefix + "p90_us", Lag.percentile(90.0));
+    TheMetrics.set(Prefix + "p99_us", Lag.percentile(99.0));
+    TheMetrics.set(Prefix + "max_us", Lag.max());
+  }
+
+  if (MetricsOutput.empty())
+    return;
+  if (auto E = TheMetrics.writeTo(MetricsOutput))
+    logAllUnhandledErrors(std::move(E),
+                          WithColor::warning() << "Metrics output: ");
+}
+
+void MCAWorker::printAggregatedRegions(bool OnlyUpdated) {
+  raw_ostream &OS = MCAOF.os();
+
+  SmallVector<const RegionAggregate*, 8> Regions;
+  for (auto &RA : AggregatedRegions) {
+    if (!OnlyUpdated || RA.Updated)
+      Regions.push_back(&RA);
+    RA.Updated = false;
+  }
+
+  if (PrintJson) {
+    json::Array JA;
+    for (const auto *RA : Regions)
+      JA.push_back(json::Object({{"Description", RA->Description},
+                                 {"Instances", int64_t(RA->NumInstances)},
+                                 {"SampledInstances",
+                                  int64_t(RA->NumSampledInstances)},
+                                 {"SampledOutInstances",
+                                  int64_t(RA->NumSampledOutInstances)},
+                                 {"Cycles", toJSON(RA->Cycles)},
+                                 {"Instructions", toJSON(RA->Instructions)},
+                                 {"uOps", toJSON(RA->UOps)}}));
+    json::Object JO;
+    JO.try_emplace("AggregatedRegions", std::move(JA));
+    OS << formatv("{0:2}", json::Value(std::move(JO))) << "\n";
+    return;
+  }
+
+  auto printRow = [&OS](StringRef Name, const SampleStats &S) {
+    OS << left_justify(Name, 14);
+    printStatsColumns(OS, S, 12);
+    OS << "\n";
+  };
+
+  for (const auto *RA : Regions) {
+    OS << "\n=== Printing aggregated report for "
+       << RA->Description << " ===\n";
+    OS << "Instances:         " << RA->NumInstances << "\n";
+    // Left by sampled simulation
+    if (RA->NumSampledInstances)
+      OS << "Partially sampled: " << RA->NumSampledInstances << "\n";
+    if (RA->NumSampledOutInstances)
+      OS << "Sampled out:       " << RA->NumSampledOutInstances << "\n";
+    OS << left_justify("", 14);
+    printStatsHeader(OS, 12);
+    OS << "\n";
+    printRow("Cycles:", RA->Cycles);
+    printRow("Instructions:", RA->Instructions);
+    printRow("uOps:", RA->UOps);
+
+    double IPC = RA->Cycles.sum()?
+                 double(RA->Instructions.sum()) / RA->Cycles.sum() : 0.0;
+    OS << "IPC:               " << format("%.2f", IPC) << "\n";
+  }
+}
+
 MCAWorker::~MCAWorker() {
 #ifndef NDEBUG
   if (DumpSourceMgrStats)
@@ -1,17 +1,32 @@
 #ifndef MCAD_MCAWORKER_H
 #define MCAD_MCAWORKER_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/MCA/SourceMgr.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/Timer.h"
+#include <chrono>
 #include <functional>
 #include <utility>
 #include <list>
 #include <unordered_map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "BrokerFacade.h"
 #include "Brokers/Broker.h"
+#include "EventLog.h"
+#include "InstrDescCache.h"
+#include "MemoryAccounting.h"
+#include "MemoryGovernor.h"
+#include "Metrics.h"
+#include "ResultsStore.h"
+#include "Statistics.h"
+#include "TypedMetadata.h"
 
 namespace llvm {
 class Target;
@@ -22,17 +37,57 @@ class MCSubtargetInfo;
 class MCInst;
 class MCInstPrinter;
 class MCInstrInfo;
+class raw_ostream;
 namespace mca {
 class Context;
 class InstrBuilder;
 class Pipeline;
 class PipelineOptions;
 class PipelinePrinter;
+class SummaryView;
+class TimelineView;
 class InstrDesc;
 class Instruction;
 } // end namespace mca
 
 namespace mcad {
+/// IncrementalSourceMgr that takes instructions again after the end of
+/// stream, once the pipeline has drained, s.t. the same pipeline can
+/// simulate more than one region. Source indices restart from zero every
+/// time it's reopened, as if it was a new SourceMgr, but the instructions
+/// it owns, including those waiting to be recycled, are kept.
+class ReopenableSourceMgr : public mca::IncrementalSourceMgr {
+  bool EndOfStream = false;
+  // Number of instructions taken in total and before the last reopen
+  unsigned NumTaken = 0U, IndexBase = 0U;
+
+public:
+  bool isEnd() const override { return EndOfStream; }
+
+  mca::SourceRef peekNext() const override {
+    mca::SourceRef SR = mca::IncrementalSourceMgr::peekNext();
+    return mca::SourceRef(SR.first - IndexBase, SR.second);
+  }
+
+  void updateNext() override {
+    ++NumTaken;
+    mca::IncrementalSourceMgr::updateNext();
+  }
+
+  void endOfStream() { EndOfStream = true; }
+
+  void reopen() {
+    EndOfStream = false;
+    IndexBase = NumTaken;
+  }
+
+  void clear() {
+    mca::IncrementalSourceMgr::clear();
+    EndOfStream = false;
+    NumTaken = IndexBase = 0U;
+  }
+};
+
 class MCAWorker {
   friend class BrokerFacade;
   const Target &TheTarget;
@@ -47,13 +102,15 @@ class MCAWorker {
   ToolOutputFile &MCAOF;
   std::unique_ptr<mca::Pipeline> MCAPipeline;
   std::unique_ptr<mca::PipelinePrinter> MCAPipelinePrinter;
+  // Owned by MCAPipelinePrinter
+  mca::SummaryView *CurSummaryView;
 
   size_t NumTraceMIs;
   // MCAWorker is the owner of this callback. Note that
   // SummaryView will only take reference of it.
   std::function<size_t(void)> GetTraceMISize;
 
-  mca::IncrementalSourceMgr SrcMgr;
+  ReopenableSourceMgr SrcMgr;
 
   std::unordered_map<const mca::InstrDesc*,
                      std::set<mca::Instruction*>> RecycledInsts;
@@ -61,17 +118,145 @@ class MCAWorker {
     GetRecycledInst;
   std::function<void(mca::Instruction*)> AddRecycledInst;
 
+  // Metadata that is not exchanged through mca::MetadataRegistry
+  TypedMetadata TypedMD;
+  // Metadata token of the last instruction freed by SrcMgr
+  unsigned LastFreedMDToken;
+  // Metadata older than this token will be dropped after the next
+  // pipeline run
+  unsigned TrimMDToken;
+
   TimerGroup Timers;
 
   std::unique_ptr<Broker> TheBroker;
 
+  // Only available if an InstrDesc cache file is given
+  std::unique_ptr<InstrDescCache> IDCache;
+
+  // Opcodes whose descriptors are bound to a specific MCInst in
+  // InstrBuilder, namely those that are variadic or have a variant
+  // scheduling class. Indexed by opcode.
+  BitVector VariantOpcodes;
+  // Whether any of them was built since InstrBuilder was last cleared
+  bool HasVariantDescs;
+
+  // Statistics of all region instances sharing the same description.
+  // Only used when region aggregation is enabled.
+  struct RegionAggregate {
+    std::string Description;
+    size_t NumInstances;
+    SampleStats Cycles, Instructions, UOps;
+    // Instances that are only partially simulated, which are included
+    // in NumInstances, and those that are not simulated at all, which
+    // are not.
+    size_t NumSampledInstances, NumSampledOutInstances;
+    // Whether there are new instances since the last interval report
+    bool Updated;
+
+    explicit RegionAggregate(StringRef Desc)
+      : Description(Desc.str()), NumInstances(0U),
+        NumSampledInstances(0U), NumSampledOutInstances(0U),
+        Updated(false) {}
+  };
+  // Sorted by the order of first appearance
+  std::vector<RegionAggregate> AggregatedRegions;
+  StringMap<unsigned> AggregatedRegionIndices;
+  size_t NumAggregatedInstances;
+
+  Metrics TheMetrics;
+  MemoryAccounting MemAcct;
+  // Number of mca::Instruction created (rather than recycled) since the
+  // last pipeline reset
+  size_t NumCreatedInsts;
+
+  // Only available if a memory budget or a metrics output is given
+  std::unique_ptr<MemoryGovernor> Governor;
+  std::chrono::steady_clock::time_point LastGovernorCheck;
+  // Number of batches fetched since we switched to sampled simulation
+  size_t NumSampledBatches;
+  // Number of MCInst in the current region that were sampled out,
+  // i.e. fetched but not simulated.
+  size_t NumSampledOutTraceMIs;
+  // Owned by MCAPipelinePrinter. Null if timeline is not enabled.
+  mca::TimelineView *CurTimelineView;
+  // Number of fetches that timed out because the Broker was idle
+  size_t NumIdleHeartbeats;
+
+  // Stages a batch goes through, from being executed (by a guest, for
+  // instance) to being simulated.
+  enum LagStage {
+    // From being executed to being received by the Broker
+    LS_Relay = 0,
+    // From being received by the Broker to being fetched by us
+    LS_Queue,
+    LS_Build,
+    LS_Simulate,
+    // From being executed to being simulated
+    LS_EndToEnd,
+    LS_NUM_STAGES
+  };
+  static StringRef getLagStageName(LagStage S);
+  // Distributions of the time, in microseconds, batches spent in
+  // each stage.
+  SampleStats Lags[LS_NUM_STAGES];
+  // Time spent on building and simulating the current batch, in
+  // nanoseconds.
+  uint64_t BatchBuildTime, BatchSimulateTime;
+  // Lags of every batch in NDJSON format
+  std::unique_ptr<ToolOutputFile> LagReportTOF;
+
+  // Only available if a results store is given
+  std::unique_ptr<results_store::Writer> ResultsWriter;
+  // Only available if an event log is given
+  std::unique_ptr<event_log::Writer> EventLogWriter;
+
   std::unique_ptr<mca::Pipeline> createPipeline();
+  // Instruction descriptors cached in InstrBuilder are only cleared
+  // if some of them are bound to specific MCInst.
   void resetPipeline();
+  // Let the drained pipeline, along with its hardware units and recycled
+  // instructions, simulate the next region instance.
+  void reusePipeline();
 
   Error runPipeline();
 
+  // Convert a slice of the fetched batch into mca::Instruction and
+  // put them into SrcMgr. BatchOffset is the index of the first element
+  // of MCIs in the batch, which is used to look up MDIndexMap.
+  void buildInstructions(ArrayRef<const MCInst*> MCIs, unsigned BatchOffset,
+                         const DenseMap<unsigned, unsigned> *MDIndexMap,
+                         raw_ostream *TraceOS);
+
   void printMCA(StringRef RegionDescription = "");
 
+  // Fold results of the region instance that just finished into
+  // AggregatedRegions instead of printing them.
+  void aggregateRegion(StringRef RegionDescription);
+  // Only print regions with new instances since the last call if
+  // OnlyUpdated is true.
+  void printAggregatedRegions(bool OnlyUpdated = false);
+  // Hand a summary of the region that just finished to the Broker
+  void sendRegionResult(StringRef RegionDescription);
+  // Append results of the region that just finished to the results store
+  void storeRegionResult(StringRef RegionDescription);
+  // Mark the end of the region that just finished in the event log
+  void logRegionEnd(StringRef RegionDescription);
+
+  // Sample the memory usage and respond to it if it's time to do so.
+  void checkMemoryUsage();
+  // Account the lag of a batch with NumInsts instructions, which was
+  // fetched at FetchedTime, after it has been simulated.
+  void recordLags(const Broker::BatchTimestamps &TS, uint64_t FetchedTime,
+                  size_t NumInsts);
+
+  // Housekeeping while the Broker has no instruction for us
+  void doIdleWork(raw_ostream *TraceOS);
+  // Apply the response associated with stage S of the memory governor
+  void applyMemoryStage(MemoryGovernor::Stage S);
+  void exportMetrics();
+  // Estimate memory usages of subsystems owned by MCAWorker
+  void updateMemoryAccounting();
+
 public:
   MCAWorker() = delete;
 
@@ -1,11 +0,0 @@
-#ifndef MCAD_MDCATEGORIES_H
-#define MCAD_MDCATEGORIES_H
-#include "llvm/MCA/MetadataCategories.h"
-
-namespace llvm {
-namespace mcad {
-// Metadata categories (custom)
-static constexpr unsigned MD_BinaryRegionMarkers = mca::MD_LAST + 1;
-} // end namespace mcad
-} // end namespace llvm
-#endif
@@ -0,0 +1,48 @@
+#include "MemoryAccounting.h"
+#include "Metrics.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+using namespace llvm;
+using namespace mcad;
+
+StringRef MemoryAccounting::getTagName(Tag T) {
+  switch (T) {
+  case T_BrokerStore:
+    return "broker_store";
+  case T_BrokerQueue:
+    return "broker_queue";
+  case T_Metadata:
+    return "metadata";
+  case T_InstructionPool:
+    return "instruction_pool";
+  case T_Views:
+    return "views";
+  case T_OutputBuffers:
+    return "output_buffers";
+  default:
+    llvm_unreachable("Unrecognized tag");
+  }
+}
+
+void MemoryAccounting::exportTo(Metrics &M) const {
+  for (unsigned i = 0U; i != T_NUM_TAGS; ++i) {
+    Tag T = Tag(i);
+    M.set("memory.accounting." + getTagName(T).str() + "_bytes", get(T));
+  }
+}
+
+void MemoryAccounting::print(raw_ostream &OS) const {
+  OS << "\nMemory usage by subsystem (estimated):\n";
+  int64_t Total = 0;
+  for (unsigned i = 0U; i != T_NUM_TAGS; ++i) {
+    Tag T = Tag(i);
+    OS << left_justify(getTagName(T), 20)
+       << format("%12.1f KB", double(get(T)) / 1024.0) << "\n";
+    Total += get(T);
+  }
+  OS << left_justify("total", 20)
+     << format("%12.1f KB", double(Total) / 1024.0) << "\n";
+}
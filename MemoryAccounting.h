@@ -0,0 +1,69 @@
+#ifndef MCAD_MEMORYACCOUNTING_H
+#define MCAD_MEMORYACCOUNTING_H
+#include "llvm/ADT/StringRef.h"
+#include <atomic>
+#include <cstdint>
+
+namespace llvm {
+class raw_ostream;
+
+namespace mcad {
+class Metrics;
+
+/// Lightweight, approximated accounting of memory used by each subsystem.
+///
+/// Rather than hooking into the allocator, subsystems either report deltas
+/// as they grow or shrink (`add`), or have their current usage estimated
+/// right before a report (`set`). Numbers are estimations based on the
+/// sizes and capacities of containers, so they're meant for spotting
+/// which subsystem is growing, not for exact bookkeeping.
+class MemoryAccounting {
+public:
+  enum Tag : unsigned {
+    // Instructions stored by the Broker (e.g. TBs in QemuBroker)
+    T_BrokerStore = 0,
+    // Instructions queued by the Broker that haven't been fetched yet
+    T_BrokerQueue,
+    // Instruction metadata
+    T_Metadata,
+    // mca::Instruction owned by the source manager, including those
+    // waiting to be recycled
+    T_InstructionPool,
+    // States kept by the views
+    T_Views,
+    // Buffers of the output streams
+    T_OutputBuffers,
+    T_NUM_TAGS
+  };
+
+private:
+  std::atomic<int64_t> Usage[T_NUM_TAGS];
+
+public:
+  MemoryAccounting() {
+    for (auto &U : Usage)
+      U = 0;
+  }
+
+  static StringRef getTagName(Tag T);
+
+  void add(Tag T, int64_t Delta) {
+    Usage[T].fetch_add(Delta, std::memory_order_relaxed);
+  }
+
+  void set(Tag T, int64_t Val) {
+    Usage[T].store(Val, std::memory_order_relaxed);
+  }
+
+  int64_t get(Tag T) const {
+    return Usage[T].load(std::memory_order_relaxed);
+  }
+
+  /// Export usages as `memory.accounting.<tag>_bytes` metrics
+  void exportTo(Metrics &M) const;
+
+  void print(raw_ostream &OS) const;
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,73 @@
+#include "MemoryGovernor.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Process.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace llvm;
+using namespace mcad;
+
+unsigned MemoryGovernor::getThreshold(Stage S) {
+  switch (S) {
+  case S_Normal:
+    return 0U;
+  case S_EvictCaches:
+    return 70U;
+  case S_DropTimeline:
+    return 80U;
+  case S_ReduceMetadata:
+    return 90U;
+  case S_Sampling:
+    return 95U;
+  }
+  llvm_unreachable("Unrecognized stage");
+}
+
+StringRef MemoryGovernor::getStageName(Stage S) {
+  switch (S) {
+  case S_Normal:
+    return "normal";
+  case S_EvictCaches:
+    return "evict-caches";
+  case S_DropTimeline:
+    return "drop-timeline";
+  case S_ReduceMetadata:
+    return "reduce-metadata";
+  case S_Sampling:
+    return "sampling";
+  }
+  llvm_unreachable("Unrecognized stage");
+}
+
+Optional<uint64_t> MemoryGovernor::getCurrentRSS() {
+#ifdef __linux__
+  FILE *F = ::fopen("/proc/self/statm", "r");
+  if (!F)
+    return llvm::None;
+  unsigned long long NumPages, NumResidentPages;
+  int NumRead = ::fscanf(F, "%llu %llu", &NumPages, &NumResidentPages);
+  ::fclose(F);
+  if (NumRead != 2)
+    return llvm::None;
+  return uint64_t(NumResidentPages) * sys::Process::getPageSizeEstimate();
+#else
+  return llvm::None;
+#endif
+}
+
+MemoryGovernor::Stage MemoryGovernor::update() {
+  auto MaybeRSS = getCurrentRSS();
+  if (!MaybeRSS)
+    return CurStage;
+  CurrentRSS = *MaybeRSS;
+  PeakRSS = std::max(PeakRSS, CurrentRSS);
+  if (!Budget)
+    return CurStage;
+
+  unsigned Percent = unsigned(std::min(CurrentRSS * 100U / Budget,
+                                       uint64_t(100U)));
+  while (CurStage < S_LAST &&
+         Percent >= getThreshold(Stage(CurStage + 1)))
+    CurStage = Stage(CurStage + 1);
+  return CurStage;
+}
@@ -0,0 +1,61 @@
+#ifndef MCAD_MEMORYGOVERNOR_H
+#define MCAD_MEMORYGOVERNOR_H
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+
+namespace llvm {
+namespace mcad {
+/// Keeps track of the resident set size (RSS) of this process and decides
+/// how aggressively we should shed memory as it approaches the budget.
+///
+/// Responses are staged: each stage is entered once RSS reaches a certain
+/// fraction of the budget and, since most of the responses can't be undone
+/// (e.g. dropping the timeline), we never go back to an earlier stage.
+class MemoryGovernor {
+public:
+  enum Stage : unsigned {
+    S_Normal = 0,
+    // Ask the Broker to evict cached instructions
+    S_EvictCaches,
+    // Stop capturing timeline
+    S_DropTimeline,
+    // Ask the Broker to attach less metadata
+    S_ReduceMetadata,
+    // Only simulate a fraction of the instruction batches
+    S_Sampling,
+    S_LAST = S_Sampling
+  };
+
+private:
+  uint64_t Budget;
+  uint64_t CurrentRSS, PeakRSS;
+  Stage CurStage;
+
+public:
+  explicit MemoryGovernor(uint64_t BudgetInBytes)
+    : Budget(BudgetInBytes), CurrentRSS(0U), PeakRSS(0U),
+      CurStage(S_Normal) {}
+
+  /// Return the RSS of this process in bytes, or None if it's not
+  /// available on this platform.
+  static Optional<uint64_t> getCurrentRSS();
+
+  static StringRef getStageName(Stage S);
+
+  /// Return the fraction of budget, in percentage, that triggers stage S
+  static unsigned getThreshold(Stage S);
+
+  /// Sample the current RSS and return the stage we should be in. Note that
+  /// the returned stage might be several stages ahead of the previous one.
+  /// We always stay in S_Normal if there is no budget.
+  Stage update();
+
+  Stage getStage() const { return CurStage; }
+  uint64_t getBudget() const { return Budget; }
+  uint64_t getLastRSS() const { return CurrentRSS; }
+  uint64_t getPeakRSS() const { return PeakRSS; }
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,34 @@
+#include "Metrics.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace mcad;
+
+json::Object Metrics::toJSON() const {
+  std::lock_guard<std::mutex> LG(Lock);
+  json::Object JO;
+  for (const auto &Entry : Values)
+    JO[Entry.getKey()] = Entry.getValue();
+  return JO;
+}
+
+Error Metrics::writeTo(StringRef Path) const {
+  json::Value JV(toJSON());
+
+  SmallString<128> TempPath(Path);
+  TempPath += ".tmp";
+  {
+    std::error_code EC;
+    raw_fd_ostream OS(TempPath, EC, sys::fs::OF_Text);
+    if (EC)
+      return llvm::errorCodeToError(EC);
+    OS << formatv("{0:2}", JV) << "\n";
+  }
+  if (auto EC = sys::fs::rename(TempPath, Path))
+    return llvm::errorCodeToError(EC);
+  return ErrorSuccess();
+}
@@ -0,0 +1,57 @@
+#ifndef MCAD_METRICS_H
+#define MCAD_METRICS_H
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <mutex>
+
+namespace llvm {
+namespace json {
+class Object;
+} // end namespace json
+
+namespace mcad {
+/// A flat registry of named integer metrics (counters and gauges), which
+/// can be exported as a JSON object. Metric names are dot-separated,
+/// for example `memory.rss_bytes`.
+///
+/// All methods are thread-safe so Brokers can update metrics from their
+/// own threads.
+class Metrics {
+  mutable std::mutex Lock;
+  StringMap<int64_t> Values;
+
+public:
+  void set(StringRef Name, int64_t Val) {
+    std::lock_guard<std::mutex> LG(Lock);
+    Values[Name] = Val;
+  }
+
+  void add(StringRef Name, int64_t Delta = 1) {
+    std::lock_guard<std::mutex> LG(Lock);
+    Values[Name] += Delta;
+  }
+
+  /// Only update the metric if Val is larger than the current value
+  void setMax(StringRef Name, int64_t Val) {
+    std::lock_guard<std::mutex> LG(Lock);
+    auto Res = Values.insert(std::make_pair(Name, Val));
+    if (!Res.second && Res.first->second < Val)
+      Res.first->second = Val;
+  }
+
+  int64_t get(StringRef Name) const {
+    std::lock_guard<std::mutex> LG(Lock);
+    return Values.lookup(Name);
+  }
+
+  json::Object toJSON() const;
+
+  /// Write all metrics as a JSON object into Path. The file is replaced
+  /// atomically so readers never see a partially-written one.
+  Error writeTo(StringRef Path) const;
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -13,11 +13,40 @@
 
 #include "PipelinePrinter.h"
 #include "MCAViews/View.h"
+#include "llvm/MCA/Instruction.h"
 
 namespace llvm {
 namespace mca {
 
+void PipelinePrinter::EventBatcher::flush() {
+  if (Events.empty())
+    return;
+  for (auto *V : Views)
+    V->onEvents(Events);
+  Events.clear();
+}
+
+void PipelinePrinter::EventBatcher::onCycleBegin() {
+  for (auto *V : Views)
+    V->onCycleBegin();
+}
+
+void PipelinePrinter::EventBatcher::onCycleEnd() {
+  // Deliver events of this cycle first
+  flush();
+  for (auto *V : Views)
+    V->onCycleEnd();
+}
+
+void PipelinePrinter::EventBatcher::onEvent(const HWInstructionEvent &Event) {
+  const Instruction &Inst = *Event.IR.getInstruction();
+  Events.push_back({Event.Type, Event.IR.getSourceIndex(), &Inst.getDesc(),
+                    Inst.getMetadataToken()});
+}
+
 void PipelinePrinter::printReport(llvm::raw_ostream &OS) const {
+  flush();
+
   for (const auto &V : Views)
     V->printView(OutputKind, OS);
 }
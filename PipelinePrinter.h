@@ -32,8 +32,27 @@ namespace mca {
 /// classes the task of printing out timeline information as well as
 /// resource pressure.
 class PipelinePrinter {
+  /// Collects instruction events of a cycle and delivers them to
+  /// batched views at the end of that cycle. Only cycle boundaries are
+  /// forwarded besides them, so batched views always see events in the
+  /// order they happened.
+  class EventBatcher : public HWEventListener {
+    llvm::SmallVector<View*, 4> Views;
+    llvm::SmallVector<HWInstructionEventRecord, 16> Events;
+
+  public:
+    void addView(View *V) { Views.push_back(V); }
+
+    void flush();
+
+    void onCycleBegin() override;
+    void onCycleEnd() override;
+    void onEvent(const HWInstructionEvent &Event) override;
+  };
+
   Pipeline &P;
   llvm::SmallVector<std::unique_ptr<View>, 8> Views;
+  std::unique_ptr<EventBatcher> Batcher;
   View::OutputKind OutputKind;
 
 public:
@@ -41,11 +60,32 @@ public:
       : P(pipeline), OutputKind(OutputKind) {}
 
   void addView(std::unique_ptr<View> V) {
-    P.addEventListener(V.get());
+    if (V->isBatched()) {
+      if (!Batcher) {
+        Batcher = std::make_unique<EventBatcher>();
+        P.addEventListener(Batcher.get());
+      }
+      Batcher->addView(V.get());
+    } else
+      P.addEventListener(V.get());
     Views.emplace_back(std::move(V));
   }
 
+  /// Deliver events that are still held by the batcher, like those in
+  /// a cycle that hasn't ended (e.g. the pipeline is paused).
+  void flush() const {
+    if (Batcher)
+      Batcher->flush();
+  }
+
   void printReport(llvm::raw_ostream &OS) const;
+
+  size_t getMemoryUsage() const {
+    size_t Total = 0U;
+    for (const auto &V : Views)
+      Total += V->getMemoryUsage();
+    return Total;
+  }
 };
 } // namespace mca
 } // namespace llvm
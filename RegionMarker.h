@@ -1,5 +1,7 @@
 #ifndef MCAD_REGIONMARKER_H
 #define MCAD_REGIONMARKER_H
+#include "llvm/ADT/StringRef.h"
+
 namespace llvm {
 namespace mcad {
 class RegionMarker {
@@ -8,29 +10,40 @@ class RegionMarker {
 
   unsigned Storage : 2;
 
-  explicit RegionMarker(unsigned Storage) : Storage(Storage) {}
+  // Identifies the marker site (i.e. the region). The underlying
+  // string is owned by whoever creates this marker.
+  StringRef Description;
+
+  RegionMarker(unsigned Storage, StringRef Desc)
+    : Storage(Storage), Description(Desc) {}
 
 public:
   RegionMarker() : Storage(0) {}
 
-  static RegionMarker getBegin() {
-    return RegionMarker(BeginMark);
+  static RegionMarker getBegin(StringRef Desc = "") {
+    return RegionMarker(BeginMark, Desc);
   }
 
-  static RegionMarker getEnd() {
-    return RegionMarker(EndMark);
+  static RegionMarker getEnd(StringRef Desc = "") {
+    return RegionMarker(EndMark, Desc);
   }
 
   inline bool isBegin() const { return Storage & BeginMark; }
 
   inline bool isEnd() const { return Storage & EndMark; }
 
+  StringRef getDescription() const { return Description; }
+
+  // Note that if both sides have a description, the one on the LHS wins.
   RegionMarker operator|(const RegionMarker &RHS) const {
-    return RegionMarker(Storage | RHS.Storage);
+    return RegionMarker(Storage | RHS.Storage,
+                        Description.empty()? RHS.Description : Description);
   }
 
   RegionMarker &operator|=(const RegionMarker &RHS) {
     Storage |= RHS.Storage;
+    if (Description.empty())
+      Description = RHS.Description;
     return *this;
   }
 };
@@ -0,0 +1,262 @@
+#include "ResultsStore.h"
+#include "AsyncWriter.h"
+#include "llvm/ADT/bit.h"
+#include "llvm/Support/BinaryByteStream.h"
+#include "llvm/Support/BinaryStreamReader.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <system_error>
+
+using namespace llvm;
+using namespace mcad;
+using namespace results_store;
+
+static constexpr StringLiteral Magic("MCADRES1");
+
+static Error makeFormatError(const Twine &Msg) {
+  return llvm::createStringError(
+    std::make_error_code(std::errc::illegal_byte_sequence),
+    "Invalid results store: " + Msg);
+}
+
+static ColumnType getFixedColumnType(unsigned Col) {
+  switch (Col) {
+  case FC_Description:
+    return CT_String;
+  case FC_IPC:
+    return CT_Double;
+  default:
+    return CT_UInt;
+  }
+}
+
+Writer::Writer(std::unique_ptr<AsyncWriter> &&Out)
+  : Out(std::move(Out)), FileOffset(0U) {}
+
+Writer::~Writer() {
+  if (Out)
+    if (auto E = finalize())
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << "Results store: ");
+}
+
+Expected<std::unique_ptr<Writer>>
+Writer::create(StringRef Path, ArrayRef<std::string> ResourceNames) {
+  auto OutOrErr = AsyncWriter::create(Path);
+  if (!OutOrErr)
+    return OutOrErr.takeError();
+
+  std::unique_ptr<Writer> W(new Writer(std::move(*OutOrErr)));
+  W->ColumnNames = {"description", "instructions", "cycles", "uops", "ipc",
+                    "sampled_out"};
+  assert(W->ColumnNames.size() == FC_NUM_FIXED_COLUMNS);
+  for (const auto &Name : ResourceNames)
+    W->ColumnNames.push_back("res." + Name);
+  W->Columns.resize(W->ColumnNames.size());
+  for (auto &Column : W->Columns)
+    Column.reserve(RowGroupSize);
+
+  W->Out->write(Magic.str());
+  W->FileOffset = Magic.size();
+  return W;
+}
+
+void Writer::append(const Record &R) {
+  assert(Out && "Appending to a finalized results store");
+  assert(R.ResourceCycles.size() == Columns.size() - FC_NUM_FIXED_COLUMNS);
+
+  auto Res = StringIndices.insert(
+    std::make_pair(R.Description, uint64_t(Strings.size())));
+  if (Res.second)
+    Strings.push_back(Res.first->getKey());
+
+  Columns[FC_Description].push_back(Res.first->second);
+  Columns[FC_Instructions].push_back(R.NumInstructions);
+  Columns[FC_Cycles].push_back(R.NumCycles);
+  Columns[FC_MicroOps].push_back(R.NumMicroOps);
+  double IPC = R.NumCycles? double(R.NumInstructions) / R.NumCycles : 0.0;
+  Columns[FC_IPC].push_back(llvm::bit_cast<uint64_t>(IPC));
+  Columns[FC_SampledOut].push_back(R.NumSampledOutInstructions);
+  for (unsigned i = 0U; i < R.ResourceCycles.size(); ++i)
+    Columns[FC_NUM_FIXED_COLUMNS + i].push_back(R.ResourceCycles[i]);
+
+  if (Columns.front().size() >= RowGroupSize)
+    flushRowGroup();
+}
+
+void Writer::flushRowGroup() {
+  size_t NumRows = Columns.front().size();
+  if (!NumRows)
+    return;
+
+  std::string Buffer;
+  Buffer.reserve(NumRows * Columns.size() * sizeof(uint64_t));
+  raw_string_ostream OS(Buffer);
+  support::endian::Writer EW(OS, support::little);
+  for (auto &Column : Columns) {
+    for (uint64_t Val : Column)
+      EW.write(Val);
+    Column.clear();
+  }
+  OS.flush();
+
+  RowGroups.push_back({NumRows, FileOffset});
+  FileOffset += Buffer.size();
+  Out->write(std::move(Buffer));
+}
+
+Error Writer::finalize() {
+  flushRowGroup();
+
+  std::string Buffer;
+  raw_string_ostream OS(Buffer);
+  support::endian::Writer EW(OS, support::little);
+  EW.write(uint32_t(ColumnNames.size()));
+  for (unsigned i = 0U; i < ColumnNames.size(); ++i) {
+    ColumnType Type = i < FC_NUM_FIXED_COLUMNS? getFixedColumnType(i)
+                                              : CT_UInt;
+    EW.write(uint8_t(Type));
+    EW.write(uint32_t(ColumnNames[i].size()));
+    OS << ColumnNames[i];
+  }
+  EW.write(uint32_t(Strings.size()));
+  for (StringRef Str : Strings) {
+    EW.write(uint32_t(Str.size()));
+    OS << Str;
+  }
+  EW.write(uint32_t(RowGroups.size()));
+  for (const auto &RG : RowGroups) {
+    EW.write(RG.NumRows);
+    EW.write(RG.Offset);
+  }
+  EW.write(FileOffset);
+  OS << Magic;
+  OS.flush();
+
+  Out->write(std::move(Buffer));
+  Error E = Out->close();
+  Out.reset();
+  return E;
+}
+
+Reader::Reader(std::unique_ptr<MemoryBuffer> &&Buffer)
+  : Buffer(std::move(Buffer)) {}
+
+Reader::~Reader() {}
+
+Expected<std::unique_ptr<Reader>> Reader::create(StringRef Path) {
+  // Let it be memory-mapped regardless of the size
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!ErrOrBuffer)
+    return llvm::errorCodeToError(ErrOrBuffer.getError());
+
+  std::unique_ptr<Reader> R(new Reader(std::move(*ErrOrBuffer)));
+  if (auto E = R->parse())
+    return E;
+  return R;
+}
+
+Error Reader::parse() {
+  StringRef Data = Buffer->getBuffer();
+  size_t TrailerSize = sizeof(uint64_t) + Magic.size();
+  if (Data.size() < Magic.size() + TrailerSize ||
+      !Data.startswith(Magic) || !Data.endswith(Magic))
+    return makeFormatError("bad magic");
+
+  uint64_t FooterOffset = support::endian::read64le(
+    Data.data() + Data.size() - TrailerSize);
+  if (FooterOffset < Magic.size() ||
+      FooterOffset > Data.size() - TrailerSize)
+    return makeFormatError("bad footer offset");
+
+  BinaryByteStream Stream(
+    arrayRefFromStringRef(Data.slice(FooterOffset,
+                                     Data.size() - TrailerSize)),
+    support::little);
+  BinaryStreamReader BSR(Stream);
+
+  uint32_t NumColumns;
+  if (auto E = BSR.readInteger(NumColumns))
+    return E;
+  for (uint32_t i = 0U; i < NumColumns; ++i) {
+    uint8_t Type;
+    uint32_t Size;
+    StringRef Name;
+    if (auto E = BSR.readInteger(Type))
+      return E;
+    if (Type > CT_String)
+      return makeFormatError("unknown column type");
+    if (auto E = BSR.readInteger(Size))
+      return E;
+    if (auto E = BSR.readFixedString(Name, Size))
+      return E;
+    Columns.push_back({ColumnType(Type), Name});
+  }
+  if (Columns.size() < FC_NUM_FIXED_COLUMNS)
+    return makeFormatError("missing columns");
+
+  uint32_t NumStrings;
+  if (auto E = BSR.readInteger(NumStrings))
+    return E;
+  // Every string takes at least its 4-byte size
+  if (NumStrings > BSR.bytesRemaining() / sizeof(uint32_t))
+    return makeFormatError("too many strings");
+  Strings.reserve(NumStrings);
+  for (uint32_t i = 0U; i < NumStrings; ++i) {
+    uint32_t Size;
+    StringRef Str;
+    if (auto E = BSR.readInteger(Size))
+      return E;
+    if (auto E = BSR.readFixedString(Str, Size))
+      return E;
+    Strings.push_back(Str);
+  }
+
+  uint32_t NumRowGroups;
+  if (auto E = BSR.readInteger(NumRowGroups))
+    return E;
+  if (NumRowGroups > BSR.bytesRemaining() / (2 * sizeof(uint64_t)))
+    return makeFormatError("too many row groups");
+  RowGroups.reserve(NumRowGroups);
+  for (uint32_t i = 0U; i < NumRowGroups; ++i) {
+    uint64_t NumRows, Offset;
+    if (auto E = BSR.readInteger(NumRows))
+      return E;
+    if (auto E = BSR.readInteger(Offset))
+      return E;
+    // Check the row count before multiplying it, so a corrupt one can't
+    // wrap the size around and pass the bounds check.
+    if (Offset < Magic.size() || Offset > FooterOffset ||
+        NumRows > (FooterOffset - Offset) /
+                  (Columns.size() * sizeof(uint64_t)))
+      return makeFormatError("row group out of bounds");
+    RowGroups.push_back(
+      {NumRows,
+       reinterpret_cast<const support::ulittle64_t*>(Data.data() + Offset)});
+  }
+  return ErrorSuccess();
+}
+
+Optional<unsigned> Reader::lookupColumn(StringRef Name) const {
+  for (unsigned i = 0U; i < Columns.size(); ++i)
+    if (Columns[i].Name == Name)
+      return i;
+  return llvm::None;
+}
+
+uint64_t Reader::getNumRows() const {
+  uint64_t Total = 0U;
+  for (const auto &RG : RowGroups)
+    Total += RG.NumRows;
+  return Total;
+}
+
+double Reader::getNumber(unsigned Group, unsigned Col, size_t Row) const {
+  uint64_t Raw = getColumn(Group, Col)[Row];
+  if (getColumnType(Col) == CT_Double)
+    return llvm::bit_cast<double>(Raw);
+  return double(Raw);
+}
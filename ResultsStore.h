@@ -0,0 +1,159 @@
+#ifndef MCAD_RESULTSSTORE_H
+#define MCAD_RESULTSSTORE_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class MemoryBuffer;
+
+namespace mcad {
+class AsyncWriter;
+
+/// A columnar file of per-region results, which is meant to be scanned
+/// by offline analysis.
+///
+/// Layout (all integers are little-endian):
+///   "MCADRES1"
+///   Row group 0: column 0 [NumRows x 8 bytes], column 1, ...
+///   Row group 1: ...
+///   Footer:
+///     u32 NumColumns, then for each column: u8 Type, u32 NameSize, Name
+///     u32 NumStrings, then for each string: u32 Size, Bytes
+///     u32 NumRowGroups, then for each row group: u64 NumRows, u64 Offset
+///   u64 FooterOffset
+///   "MCADRES1"
+///
+/// Every column is fixed-width, so a column in a row group can be used
+/// in place once the file is memory-mapped. Region descriptions are
+/// stored as indices into the string dictionary in the footer.
+namespace results_store {
+enum ColumnType : uint8_t {
+  CT_UInt = 0,
+  CT_Double,
+  // Index into the string dictionary
+  CT_String
+};
+
+// Columns every file has, in this order. They're followed by the cycles
+// spent on each processor resource, named `res.<resource name>`.
+enum FixedColumn : unsigned {
+  FC_Description = 0,
+  FC_Instructions,
+  FC_Cycles,
+  FC_MicroOps,
+  FC_IPC,
+  // Instructions that were not simulated because of sampled simulation
+  FC_SampledOut,
+  FC_NUM_FIXED_COLUMNS
+};
+
+struct Record {
+  StringRef Description;
+  uint64_t NumInstructions, NumCycles, NumMicroOps;
+  uint64_t NumSampledOutInstructions = 0U;
+  // Cycles spent on each processor resource, in the same order as the
+  // resource names given to the Writer.
+  ArrayRef<uint64_t> ResourceCycles;
+};
+
+class Writer {
+  std::unique_ptr<AsyncWriter> Out;
+
+  std::vector<std::string> ColumnNames;
+  // Description -> index in the string dictionary
+  StringMap<uint64_t> StringIndices;
+  // Keys of StringIndices sorted by their indices
+  std::vector<StringRef> Strings;
+
+  // Columns of the row group that is being filled
+  std::vector<std::vector<uint64_t>> Columns;
+  struct RowGroup {
+    uint64_t NumRows, Offset;
+  };
+  std::vector<RowGroup> RowGroups;
+  uint64_t FileOffset;
+
+  // Hand the current row group to the writer thread
+  void flushRowGroup();
+
+  explicit Writer(std::unique_ptr<AsyncWriter> &&Out);
+
+public:
+  static constexpr size_t RowGroupSize = 4096U;
+
+  static Expected<std::unique_ptr<Writer>>
+  create(StringRef Path, ArrayRef<std::string> ResourceNames);
+
+  ~Writer();
+
+  void append(const Record &R);
+
+  /// Write the footer and close the file. Nothing can be appended after
+  /// this.
+  Error finalize();
+};
+
+class Reader {
+  std::unique_ptr<MemoryBuffer> Buffer;
+
+  struct Column {
+    ColumnType Type;
+    StringRef Name;
+  };
+  SmallVector<Column, 16> Columns;
+  std::vector<StringRef> Strings;
+  struct RowGroup {
+    uint64_t NumRows;
+    const support::ulittle64_t *Data;
+  };
+  std::vector<RowGroup> RowGroups;
+
+  explicit Reader(std::unique_ptr<MemoryBuffer> &&Buffer);
+
+  Error parse();
+
+public:
+  static Expected<std::unique_ptr<Reader>> create(StringRef Path);
+
+  ~Reader();
+
+  size_t getNumColumns() const { return Columns.size(); }
+  StringRef getColumnName(unsigned Col) const { return Columns[Col].Name; }
+  ColumnType getColumnType(unsigned Col) const { return Columns[Col].Type; }
+  Optional<unsigned> lookupColumn(StringRef Name) const;
+
+  size_t getNumRowGroups() const { return RowGroups.size(); }
+  size_t getNumRows(unsigned Group) const {
+    return RowGroups[Group].NumRows;
+  }
+  uint64_t getNumRows() const;
+
+  /// Raw values of a column in a row group, which point right into the
+  /// mapped file.
+  ArrayRef<support::ulittle64_t> getColumn(unsigned Group,
+                                           unsigned Col) const {
+    const auto &RG = RowGroups[Group];
+    return makeArrayRef(RG.Data + Col * RG.NumRows, RG.NumRows);
+  }
+
+  /// Value of a column in numeric form, or the string index for
+  /// CT_String columns.
+  double getNumber(unsigned Group, unsigned Col, size_t Row) const;
+
+  StringRef getString(uint64_t Idx) const {
+    return Idx < Strings.size()? Strings[Idx] : StringRef();
+  }
+};
+} // end namespace results_store
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,141 @@
+#ifndef MCAD_STATISTICS_H
+#define MCAD_STATISTICS_H
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace llvm {
+namespace mcad {
+/// Accumulates samples of a non-negative quantity (e.g. cycles) and
+/// provides min / max / mean as well as approximated percentiles.
+///
+/// Percentiles are computed from a log-linear histogram: values smaller
+/// than 2^SubBucketBits are counted exactly, larger values are put into
+/// one of the 2^SubBucketBits linear sub-buckets of their power-of-two
+/// group. So the relative error is bounded by 1/2^SubBucketBits while
+/// the whole histogram never exceeds a few hundred counters.
+class SampleStats {
+  static constexpr unsigned SubBucketBits = 3;
+  static constexpr unsigned NumSubBuckets = 1U << SubBucketBits;
+
+  uint64_t Count, Sum, Min, Max;
+  SmallVector<uint64_t, 32> Buckets;
+
+  static unsigned getBucketIndex(uint64_t Val) {
+    if (Val < NumSubBuckets)
+      return Val;
+    unsigned Exp = Log2_64(Val);
+    unsigned Shift = Exp - SubBucketBits;
+    unsigned Sub = (Val >> Shift) - NumSubBuckets;
+    return NumSubBuckets + (Exp - SubBucketBits) * NumSubBuckets + Sub;
+  }
+
+  // Return the smallest value that falls into bucket Idx
+  static uint64_t getBucketLowerBound(unsigned Idx) {
+    if (Idx < NumSubBuckets)
+      return Idx;
+    unsigned Shift = (Idx - NumSubBuckets) / NumSubBuckets;
+    unsigned Sub = (Idx - NumSubBuckets) % NumSubBuckets;
+    return uint64_t(NumSubBuckets + Sub) << Shift;
+  }
+
+public:
+  SampleStats() { clear(); }
+
+  void clear() {
+    Count = Sum = Max = 0U;
+    Min = std::numeric_limits<uint64_t>::max();
+    Buckets.clear();
+  }
+
+  void add(uint64_t Val, uint64_t Num = 1U) {
+    if (!Num)
+      return;
+    Count += Num;
+    Sum += Val * Num;
+    Min = std::min(Min, Val);
+    Max = std::max(Max, Val);
+
+    unsigned Idx = getBucketIndex(Val);
+    if (Idx >= Buckets.size())
+      Buckets.resize(Idx + 1, 0U);
+    Buckets[Idx] += Num;
+  }
+
+  void merge(const SampleStats &RHS) {
+    if (!RHS.Count)
+      return;
+    Count += RHS.Count;
+    Sum += RHS.Sum;
+    Min = std::min(Min, RHS.Min);
+    Max = std::max(Max, RHS.Max);
+    if (RHS.Buckets.size() > Buckets.size())
+      Buckets.resize(RHS.Buckets.size(), 0U);
+    for (unsigned i = 0U, E = RHS.Buckets.size(); i != E; ++i)
+      Buckets[i] += RHS.Buckets[i];
+  }
+
+  uint64_t count() const { return Count; }
+  uint64_t sum() const { return Sum; }
+  uint64_t min() const { return Count? Min : 0U; }
+  uint64_t max() const { return Max; }
+  double mean() const { return Count? double(Sum) / double(Count) : 0.0; }
+
+  /// Approximated value of the P-th percentile, where P is in [0, 100].
+  uint64_t percentile(double P) const {
+    if (!Count)
+      return 0U;
+    uint64_t Rank = uint64_t((P / 100.0) * double(Count) + 0.5);
+    Rank = std::max(std::min(Rank, Count), uint64_t(1U));
+
+    uint64_t Accum = 0U;
+    for (unsigned i = 0U, E = Buckets.size(); i != E; ++i) {
+      Accum += Buckets[i];
+      if (Accum >= Rank)
+        return std::max(std::min(getBucketLowerBound(i), Max), min());
+    }
+    return Max;
+  }
+};
+
+/// Print the headers of the columns printed by `printStatsColumns`.
+/// TotalWidth is the width of the "Total" column.
+inline void printStatsHeader(raw_ostream &OS, unsigned TotalWidth) {
+  OS << right_justify("Total", TotalWidth)
+     << right_justify("Min", 10)
+     << right_justify("Mean", 10)
+     << right_justify("Max", 10)
+     << right_justify("P50", 10)
+     << right_justify("P90", 10)
+     << right_justify("P99", 10);
+}
+
+/// Print total, min, mean, max, and percentiles of S as table columns.
+inline void printStatsColumns(raw_ostream &OS, const SampleStats &S,
+                              unsigned TotalWidth) {
+  OS << format("%*llu", int(TotalWidth), (unsigned long long)S.sum())
+     << format("%10llu", (unsigned long long)S.min())
+     << format("%10.1f", S.mean())
+     << format("%10llu", (unsigned long long)S.max())
+     << format("%10llu", (unsigned long long)S.percentile(50.0))
+     << format("%10llu", (unsigned long long)S.percentile(90.0))
+     << format("%10llu", (unsigned long long)S.percentile(99.0));
+}
+
+inline json::Value toJSON(const SampleStats &S) {
+  return json::Object({{"Total", int64_t(S.sum())},
+                       {"Min", int64_t(S.min())},
+                       {"Mean", S.mean()},
+                       {"Max", int64_t(S.max())},
+                       {"P50", int64_t(S.percentile(50.0))},
+                       {"P90", int64_t(S.percentile(90.0))},
+                       {"P99", int64_t(S.percentile(99.0))}});
+}
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,97 @@
+#ifndef MCAD_TYPEDMETADATA_H
+#define MCAD_TYPEDMETADATA_H
+#include "RegionMarker.h"
+#include "llvm/ADT/STLExtras.h"
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace llvm {
+namespace mcad {
+/// A flat column of plain T keyed by metadata token.
+///
+/// Unlike categories in mca::MetadataRegistry, values are stored unboxed
+/// (i.e. no llvm::Any) so there is neither an allocation per entry nor
+/// type erasure on the consumer side.
+/// Brokers usually hand out tokens in increasing order, so entries are
+/// appended at the back and looked up with binary search. Entries of
+/// instructions that are gone can be dropped from the front with `trim`.
+template <class T> class MetadataColumn {
+  using EntryTy = std::pair<unsigned, T>;
+  std::deque<EntryTy> Entries;
+
+  static bool compareToken(const EntryTy &E, unsigned Token) {
+    return E.first < Token;
+  }
+
+  typename std::deque<EntryTy>::iterator find(unsigned Token) {
+    auto It = llvm::lower_bound(Entries, Token, compareToken);
+    return It != Entries.end() && It->first == Token? It : Entries.end();
+  }
+
+public:
+  /// Return the value of Token, or insert a default-constructed one
+  /// if there is none.
+  T &operator[](unsigned Token) {
+    if (Entries.empty() || Entries.back().first < Token) {
+      Entries.emplace_back(Token, T());
+      return Entries.back().second;
+    }
+    auto It = llvm::lower_bound(Entries, Token, compareToken);
+    if (It == Entries.end() || It->first != Token)
+      It = Entries.emplace(It, Token, T());
+    return It->second;
+  }
+
+  /// Return nullptr if there is no value for Token.
+  const T *lookup(unsigned Token) const {
+    return const_cast<MetadataColumn*>(this)->lookup(Token);
+  }
+  T *lookup(unsigned Token) {
+    auto It = find(Token);
+    return It != Entries.end()? &It->second : nullptr;
+  }
+
+  bool count(unsigned Token) const { return lookup(Token) != nullptr; }
+
+  /// Drop all entries whose token is smaller than Token.
+  void trim(unsigned Token) {
+    while (!Entries.empty() && Entries.front().first < Token)
+      Entries.pop_front();
+  }
+
+  size_t size() const { return Entries.size(); }
+  bool empty() const { return Entries.empty(); }
+  void clear() { Entries.clear(); }
+
+  size_t getMemorySize() const { return Entries.size() * sizeof(EntryTy); }
+};
+
+/// All the metadata categories known by MCAD.
+///
+/// Note that memory access metadata (mca::MDMemoryAccess) is still
+/// exchanged through mca::MetadataRegistry, because that's where the LSUnit
+/// and CacheManager look for it.
+struct TypedMetadata {
+  MetadataColumn<RegionMarker> RegionMarkers;
+  /// Guest address of an instruction.
+  MetadataColumn<uint64_t> InstrAddrs;
+
+  /// Drop metadata of instructions whose token is smaller than Token.
+  void trim(unsigned Token) {
+    RegionMarkers.trim(Token);
+    InstrAddrs.trim(Token);
+  }
+
+  void clear() {
+    RegionMarkers.clear();
+    InstrAddrs.clear();
+  }
+
+  size_t getMemorySize() const {
+    return RegionMarkers.getMemorySize() + InstrAddrs.getMemorySize();
+  }
+};
+} // end namespace mcad
+} // end namespace llvm
+#endif
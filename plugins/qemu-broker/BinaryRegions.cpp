@@ -1,10 +1,18 @@
 #include "BinaryRegions.h"
+#include "GuestBinary.h"
 #include "llvm/DebugInfo/DIContext.h"
 #include "llvm/DebugInfo/DWARF/DWARFContext.h"
 #include "llvm/Object/Binary.h"
 #include "llvm/Object/ELFObjectFile.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/WithColor.h"
 #include <system_error>
 
@@ -15,7 +23,7 @@ using namespace qemu_broker;
 #define DEBUG_TYPE "mcad-qemu-broker"
 
 Expected<std::unique_ptr<BinaryRegions>>
-BinaryRegions::Create(StringRef ManifestPath) {
+BinaryRegions::Create(StringRef ManifestPath, StringRef SymbolCacheDir) {
   auto ErrOrBuffer = MemoryBuffer::getFileOrSTDIN(ManifestPath,
                                                   /*IsText=*/true);
   if (!ErrOrBuffer)
@@ -36,7 +44,7 @@ BinaryRegions::Create(StringRef ManifestPath) {
   // Pick the correct kind of manifest
   if (const json::Object *Obj = TopLevel.getAsObject()) {
     if (Obj->getString("file") && Obj->getArray("regions")) {
-      if (auto E = This->parseSymbolBasedRegions(*Obj))
+      if (auto E = This->parseSymbolBasedRegions(*Obj, SymbolCacheDir))
         return std::move(E);
 
       return std::move(This);
@@ -57,55 +65,157 @@ struct BRSymbol {
   size_t Size;
 };
 
+// Whether all the wanted symbols are found
+static bool isComplete(const StringSet<> &Wanted,
+                       const StringMap<BRSymbol> &Symbols) {
+  return llvm::all_of(Wanted, [&](const StringMapEntry<NoneType> &Entry) {
+                        return Symbols.count(Entry.getKey());
+                      });
+}
+
+// Only read subprograms whose linkage names are in Wanted.
 static Error readDWARF(const object::ELFObjectFileBase &ELFObj,
+                       const StringSet<> &Wanted,
                        StringMap<BRSymbol> &Symbols) {
   std::unique_ptr<DWARFContext> DICtx = DWARFContext::create(ELFObj);
+
+  auto addSubprogram = [&](const DWARFDie &Die) -> bool {
+    if (!Die.isSubprogramDIE())
+      return false;
+    const char *SymName = Die.getLinkageName();
+    if (!SymName || !Wanted.count(SymName))
+      return false;
+
+    uint64_t LowPC, HighPC, SectionIdx;
+    if (!Die.getLowAndHighPC(LowPC, HighPC, SectionIdx))
+      return false;
+    assert(HighPC >= LowPC);
+    Symbols[StringRef(SymName)] = {LowPC, HighPC - LowPC};
+    return true;
+  };
+
+  // Use the accelerator table if there is one, which saves us
+  // from parsing every compile unit.
+  if (!DICtx->getDWARFObj().getNamesSection().Data.empty()) {
+    const DWARFDebugNames &Names = DICtx->getDebugNames();
+    for (const auto &Entry : Wanted) {
+      StringRef Name = Entry.getKey();
+      if (Symbols.count(Name))
+        continue;
+      for (const DWARFDebugNames::Entry &NE : Names.equal_range(Name)) {
+        auto CUOffset = NE.getCUOffset();
+        auto DIEOffset = NE.getDIEUnitOffset();
+        if (!CUOffset || !DIEOffset)
+          continue;
+        if (addSubprogram(DICtx->getDIEForOffset(*CUOffset + *DIEOffset)))
+          break;
+      }
+    }
+    LLVM_DEBUG(dbgs() << "Looked up symbols via .debug_names\n");
+    return llvm::ErrorSuccess();
+  }
+
   for (const std::unique_ptr<DWARFUnit> &CU : DICtx->compile_units()) {
     if (!CU)
       continue;
     DWARFDie CUDie = CU->getUnitDIE(false);
-    for (const DWARFDie &ChildDie : CUDie.children()) {
-      if (!ChildDie.isSubprogramDIE())
-        continue;
-      const char *SymName = ChildDie.getLinkageName();
-      if (!SymName)
-        continue;
-
-      uint64_t LowPC, HighPC, SectionIdx;
-      if (!ChildDie.getLowAndHighPC(LowPC, HighPC, SectionIdx))
-        continue;
-      assert(HighPC >= LowPC);
-      Symbols[StringRef(SymName)] = {LowPC, HighPC - LowPC};
-    }
+    bool Found = false;
+    for (const DWARFDie &ChildDie : CUDie.children())
+      Found |= addSubprogram(ChildDie);
+    // Stop as soon as all the symbols we need are found
+    if (Found && isComplete(Wanted, Symbols))
+      break;
   }
   return llvm::ErrorSuccess();
 }
 
+// Only read symbols that are in Wanted and not found yet.
 static Error readSymTable(const object::ELFObjectFileBase &ELFObj,
+                          const StringSet<> &Wanted,
                           StringMap<BRSymbol> &Symbols) {
   using namespace object;
+  if (isComplete(Wanted, Symbols))
+    return llvm::ErrorSuccess();
+
   for (const ELFSymbolRef &Sym : ELFObj.symbols()) {
-    auto Size = Sym.getSize();
     // We really don't care the error message if any of the
     // following fail, so just convert it to Optional to drop
     // the attached Error.
     auto MaybeName = llvm::expectedToOptional(Sym.getName());
+    if (!MaybeName || !Wanted.count(*MaybeName) || Symbols.count(*MaybeName))
+      continue;
     auto MaybeAddr = llvm::expectedToOptional(Sym.getAddress());
-    if (MaybeName && MaybeAddr) {
-      if (!Symbols.count(*MaybeName))
-        Symbols[*MaybeName] = {*MaybeAddr, Size};
+    if (MaybeAddr) {
+      Symbols[*MaybeName] = {*MaybeAddr, Sym.getSize()};
+      if (isComplete(Wanted, Symbols))
+        break;
     }
   }
 
   return llvm::ErrorSuccess();
 }
 
-Error BinaryRegions::parseSymbolBasedRegions(const json::Object &RawManifest) {
+// Symbol cache file: {"<symbol name>": [<start address>, <size>], ...}
+static void readSymbolCache(StringRef CachePath,
+                            StringMap<BRSymbol> &Symbols) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(CachePath, /*IsText=*/true);
+  if (!ErrOrBuffer)
+    return;
+  auto JsonOrErr = json::parse((*ErrOrBuffer)->getBuffer());
+  if (!JsonOrErr) {
+    llvm::consumeError(JsonOrErr.takeError());
+    return;
+  }
+  const json::Object *Cache = JsonOrErr->getAsObject();
+  if (!Cache)
+    return;
+  for (const auto &Entry : *Cache) {
+    const json::Array *Val = Entry.second.getAsArray();
+    if (!Val || Val->size() != 2)
+      continue;
+    auto StartAddr = (*Val)[0].getAsInteger();
+    auto Size = (*Val)[1].getAsInteger();
+    if (StartAddr && Size)
+      Symbols[StringRef(Entry.first)] = {uint64_t(*StartAddr), size_t(*Size)};
+  }
+}
+
+static void writeSymbolCache(StringRef CachePath,
+                             const StringMap<BRSymbol> &Symbols) {
+  json::Object Cache;
+  for (const auto &Entry : Symbols)
+    Cache[Entry.getKey()] = json::Array({int64_t(Entry.second.StartAddr),
+                                         int64_t(Entry.second.Size)});
+
+  // Write to a temporary file first s.t. concurrent readers
+  // never see a partial cache.
+  SmallString<128> TempPath(CachePath);
+  TempPath += ".tmp%%%%%%";
+  int FD;
+  if (sys::fs::createUniqueFile(TempPath, FD, TempPath))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << json::Value(std::move(Cache));
+  }
+  if (sys::fs::rename(TempPath, CachePath))
+    sys::fs::remove(TempPath);
+}
+
+Error BinaryRegions::parseSymbolBasedRegions(const json::Object &RawManifest,
+                                             StringRef SymbolCacheDir) {
   auto BinFilePath = RawManifest.getString("file");
   assert(BinFilePath && "Expecting a 'file' field");
   const json::Array *RawRegions = RawManifest.getArray("regions");
   assert(RawRegions && "Expecting a 'regions' field");
 
+  // Only resolve symbols that are actually used
+  StringSet<> WantedSymbols;
+  for (const json::Value &RawRegion : *RawRegions)
+    if (const auto *Region = RawRegion.getAsObject())
+      if (auto MaybeSymName = Region->getString("symbol"))
+        WantedSymbols.insert(*MaybeSymName);
+
   auto ErrOrObjectBuffer = MemoryBuffer::getFile(*BinFilePath);
   if (!ErrOrObjectBuffer)
     return llvm::errorCodeToError(ErrOrObjectBuffer.getError());
@@ -121,14 +231,34 @@ Error BinaryRegions::parseSymbolBasedRegions(const json::Object &RawManifest) {
                                    "Only ELF is supported right now");
 
   StringMap<BRSymbol> Symbols;
-  // Try to read DWARF first
-  auto E = readDWARF(*ELFObj, Symbols);
-  if (E)
-    return std::move(E);
-  // Then pick up symbols that are not available in DWARF
-  E = readSymTable(*ELFObj, Symbols);
-  if (E)
-    return std::move(E);
+  // Try the symbol cache first
+  SmallString<128> CachePath;
+  if (!SymbolCacheDir.empty()) {
+    std::string BuildID = GuestBinary::getBuildID(*ELFObj);
+    if (!BuildID.empty()) {
+      CachePath = SymbolCacheDir;
+      sys::path::append(CachePath, BuildID + ".json");
+      readSymbolCache(CachePath, Symbols);
+    }
+  }
+  size_t NumCachedSymbols = Symbols.size();
+
+  if (!isComplete(WantedSymbols, Symbols)) {
+    // Try to read DWARF first
+    auto E = readDWARF(*ELFObj, WantedSymbols, Symbols);
+    if (E)
+      return std::move(E);
+    // Then pick up symbols that are not available in DWARF
+    E = readSymTable(*ELFObj, WantedSymbols, Symbols);
+    if (E)
+      return std::move(E);
+
+    if (!CachePath.empty() && Symbols.size() > NumCachedSymbols) {
+      if (!sys::fs::create_directories(SymbolCacheDir))
+        writeSymbolCache(CachePath, Symbols);
+    }
+  } else
+    LLVM_DEBUG(dbgs() << "All symbols are found in " << CachePath << "\n");
 
   for (const json::Value &RawRegion : *RawRegions) {
     if (const auto *Region = RawRegion.getAsObject()) {
@@ -41,7 +41,10 @@ struct BinaryRegions {
 private:
   Error parseAddressBasedRegions(const json::Array &RawRegions);
 
-  Error parseSymbolBasedRegions(const json::Object &RawManifest);
+  // Symbols are cached in SymbolCacheDir, keyed by the build ID of the
+  // binary, if it's not empty.
+  Error parseSymbolBasedRegions(const json::Object &RawManifest,
+                                StringRef SymbolCacheDir);
 
   // {start address -> BinaryRegion}
   std::unordered_map<uint64_t, BinaryRegion> Regions;
@@ -51,8 +54,8 @@ private:
   BinaryRegions() : OperationMode(M_Trim) {}
 
 public:
-  static
-  Expected<std::unique_ptr<BinaryRegions>> Create(StringRef ManifestPath);
+  static Expected<std::unique_ptr<BinaryRegions>>
+  Create(StringRef ManifestPath, StringRef SymbolCacheDir = "");
 
   size_t size() const { return Regions.size(); }
 
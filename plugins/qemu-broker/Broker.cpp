@@ -1,5 +1,6 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/StringSwitch.h"
@@ -9,17 +10,20 @@
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
 #include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/MC/SubtargetFeature.h"
 #include "llvm/MCA/MetadataCategories.h"
 #include "llvm/MCA/MetadataRegistry.h"
 #include "llvm/MCA/HardwareUnits/LSUnit.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/WithColor.h"
+#include <atomic>
 #include <condition_variable>
 #include <list>
 #include <memory>
@@ -30,6 +34,7 @@
 #include <vector>
 
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
 #include <netdb.h>
@@ -40,10 +45,17 @@
 
 #include "BinaryRegions.h"
 #include "BrokerFacade.h"
+#include "CompactMCInst.h"
+#include "DecodeCache.h"
+#include "GuestBinary.h"
+#include "MemoryAccounting.h"
+#include "MessageFramer.h"
+#include "Metrics.h"
 #include "Brokers/Broker.h"
 #include "Brokers/BrokerPlugin.h"
-#include "MDCategories.h"
 #include "RegionMarker.h"
+#include "TypedMetadata.h"
+#include "UringReceiver.h"
 
 #include "Serialization/mcad_generated.h"
 
@@ -53,7 +65,7 @@ using namespace mcad;
 #define DEBUG_TYPE "mcad-qemu-broker"
 
 namespace {
-using RawInstTy = SmallVector<uint8_t, 4>;
+using RawInstTy = qemu_broker::RawInstTy;
 raw_ostream &operator<<(raw_ostream &OS, const RawInstTy &RawInst) {
   OS << "[ ";
   for (const auto Byte : RawInst) {
@@ -65,29 +77,56 @@ raw_ostream &operator<<(raw_ostream &OS, const RawInstTy &RawInst) {
 
 struct TranslationBlock {
   SmallVector<RawInstTy, 8> RawInsts;
-  // Owner of all MCInst instances
-  // Note that we caonnt use SmallVector<MCInst,...> here because
-  // when SmallVector resize all MCInst* retrieved previously will be invalid
-  SmallVector<std::unique_ptr<MCInst>, 8> MCInsts;
-  // If the size of RawInsts and MCInsts don't match (e.g. A single raw
-  // instruction is disassembled into multiple MCInst), this maps from the
-  // RawInsts index to MCInsts index.
-  DenseMap<unsigned, unsigned> SkewIndicies;
+  // Disassembled instructions, which might be shared with other TBs.
+  // Its memory is accounted by the DecodeCache.
+  std::shared_ptr<const qemu_broker::DecodedBlock> Decoded;
 
   // The start address of this TB
   uint64_t VAddr;
-  // Address offsets to each MCInst in this TB
-  SmallVector<uint8_t, 8> VAddrOffsets;
 
   // Whether a MCInst has a begin mark
   BitVector BeginMarks;
   BitVector EndMarks;
+  // MCInst index -> the region it marks
+  DenseMap<unsigned, const qemu_broker::BinaryRegion*> MarkedRegions;
+
+  // Value of QemuBroker::NumExecutedTBs last time this TB was executed
+  uint64_t LastExec;
 
   explicit TranslationBlock(size_t Size)
-    : RawInsts(Size), VAddr(0U) {}
+    : RawInsts(Size), VAddr(0U), LastExec(0U) {}
 
   // Is translated
-  operator bool() const { return !MCInsts.empty(); }
+  operator bool() const { return bool(Decoded); }
+
+  size_t getNumMCInsts() const {
+    return Decoded? Decoded->MCInsts.size() : 0U;
+  }
+
+  // Region marks are only computed upon the first disassembly.
+  bool isEvictable() const {
+    return MarkedRegions.empty() && Decoded;
+  }
+
+  size_t getMemorySize() const {
+    size_t Total = RawInsts.capacity_in_bytes() +
+                   BeginMarks.getMemorySize() + EndMarks.getMemorySize() +
+                   MarkedRegions.getMemorySize();
+    // Raw instructions that don't fit in the inline storage
+    for (const auto &RawInst : RawInsts)
+      if (RawInst.capacity() > 4)
+        Total += RawInst.capacity_in_bytes();
+    return Total;
+  }
+
+  // Drop everything derived from RawInsts s.t. this TB will be
+  // disassembled again (or picked from the DecodeCache) the next time
+  // it's executed.
+  void evict() {
+    Decoded.reset();
+    BeginMarks = BitVector();
+    EndMarks = BitVector();
+  }
 };
 
 // instruction index (in the TB) -> Memory access descriptor
@@ -110,9 +149,14 @@ class QemuBroker : public Broker {
 
   uint64_t CodeStartAddress;
 
+  // Main executable of the guest, which instructions in file-backed
+  // TBs are read from.
+  std::unique_ptr<qemu_broker::GuestBinary> TheGuestBinary;
+
   const Target &TheTarget;
   MCContext &Ctx;
   const MCSubtargetInfo &STI;
+  const MCInstrInfo &MCII;
   std::unique_ptr<MCDisassembler> DisAsm;
   // Workaround for archtectures that might switch
   // sub-target features half-way (e.g. ARM)
@@ -126,6 +170,43 @@ class QemuBroker : public Broker {
 
   std::mutex TBsMutex;
   SmallVector<Optional<TranslationBlock>, 8> TBs;
+  // TBs of the slices that have been taken off TBQueue but whose
+  // instructions haven't been fetched yet. Guarded by TBsMutex.
+  DenseSet<size_t> InFlightTBs;
+  // Disassembled instructions shared by TBs of all the clients
+  qemu_broker::DecodeCache DecodedBlocks;
+  // Blocks of the last fetched slices, which are kept alive until the
+  // next fetch since the caller is still using their MCInsts. Only
+  // accessed by the fetching thread.
+  SmallVector<std::shared_ptr<const qemu_broker::DecodedBlock>, 4>
+    InFlightBlocks;
+  // Drop Block from DecodedBlocks if no TB is using it anymore
+  void releaseDecodedBlock(std::shared_ptr<const qemu_broker::DecodedBlock>
+                           Block);
+  // Drop all the decoded blocks that are not used by any TB
+  void pruneDecodedBlocks();
+  uint64_t NumExecutedTBs;
+
+  // Set by the main thread. TBs are evicted by the receiver thread
+  // since that's where TBs are (re)disassembled.
+  std::atomic<bool> EvictionRequested;
+  // TBs that haven't been executed in the last this many TB executions
+  // are considered cold.
+  static constexpr uint64_t ColdTBDistance = 1U << 16;
+  void evictColdTBs();
+
+  Metrics &TheMetrics;
+  MemoryAccounting &MemAcct;
+
+  bool EnableCompactMCInst;
+  // Compactly encoded MCInsts are expanded into here when being fetched.
+  // Its content is only valid until the next fetch.
+  std::vector<MCInst> ScratchMCInsts;
+  // Whether we can store MCI in the compact encoding
+  bool isCompactable(const MCInst &MCI) const;
+  // Whether InstrBuilder caches the descriptor of MCI using its address
+  // rather than its opcode.
+  bool hasVariantDesc(const MCInst &MCI) const;
 
   struct TBSlice {
     // TB index
@@ -147,8 +228,19 @@ class QemuBroker : public Broker {
     // memory at the right time point is actually the best solution
     MemoryAccessChain *MemoryAccesses;
 
+    BatchTimestamps Timestamps;
+
     size_t size() const { return EndIdx - BeginIdx; }
 
+    size_t getMemorySize() const {
+      // Plus two pointers in the std::list node
+      size_t Total = sizeof(TBSlice) + 2 * sizeof(void*);
+      if (MemoryAccesses)
+        Total += sizeof(MemoryAccessChain) +
+                 MemoryAccesses->capacity_in_bytes();
+      return Total;
+    }
+
     TBSlice()
       : Index(0U),
         BeginIdx(0u), EndIdx(0u),
@@ -157,10 +249,12 @@ class QemuBroker : public Broker {
     TBSlice(size_t Index,
             uint16_t BeginIdx, uint16_t EndIdx,
             const qemu_broker::BinaryRegion *Region,
-            MemoryAccessChain *MemAccesses)
+            MemoryAccessChain *MemAccesses,
+            BatchTimestamps Timestamps)
       : Index(Index),
         BeginIdx(BeginIdx), EndIdx(EndIdx),
-        Region(Region), MemoryAccesses(MemAccesses) {}
+        Region(Region), MemoryAccesses(MemAccesses),
+        Timestamps(Timestamps) {}
 
     // Return another slice whose EndIdx is SplitPoint
     TBSlice split(uint16_t SplitPoint) {
@@ -172,6 +266,7 @@ class QemuBroker : public Broker {
       NewSlice.BeginIdx = BeginIdx;
       NewSlice.EndIdx = SplitPoint;
       NewSlice.Region = Region;
+      NewSlice.Timestamps = Timestamps;
       // spliting the memory access chain
       if (MemoryAccesses) {
         auto Compare = [](const MemoryAccessEntry &MAE, unsigned Idx) {
@@ -203,8 +298,34 @@ class QemuBroker : public Broker {
   bool IsEndOfStream;
   std::mutex QueueMutex;
   std::condition_variable QueueCV;
-
-  bool EnableMemAccessMD;
+  // The client currently connected, which might want to receive
+  // region results.
+  std::mutex ClientMutex;
+  int ClientSocktFD;
+  bool ClientWantsRegionResults;
+  // Messages to the client that haven't been (fully) sent, starting
+  // with the unsent tail of a partially sent one. They have to go out
+  // before any other message. Guarded by ClientMutex.
+  std::vector<uint8_t> PendingOutput;
+  // Whether PendingOutput is non-empty, which can be checked
+  // without the lock.
+  std::atomic<bool> HasPendingOutput;
+  // Send as much of PendingOutput as possible without blocking.
+  // Return true if nothing is pending afterward. ClientMutex has to be
+  // held.
+  bool flushPendingOutput();
+  // Queue a message that must not be dropped and send as much of it as
+  // possible without blocking.
+  void sendToClient(const flatbuffers::FlatBufferBuilder &Builder);
+
+  // Zero if fetches should wait indefinitely
+  std::chrono::milliseconds FetchTimeout;
+  // Timestamps of the first slice in the last fetched batch
+  Optional<BatchTimestamps> LastBatchTimestamps;
+
+  // Accessed by both the receiver and the main thread
+  std::atomic<bool> EnableMemAccessMD;
+  bool EnableInstrAddrMD;
 
   uint32_t TotalNumTraces;
 
@@ -216,6 +337,29 @@ class QemuBroker : public Broker {
 
   std::unique_ptr<std::thread> ReceiverThread;
   void recvWorker();
+  // Receive from the client with one read syscall per chunk
+  void recvBlocking(int SocktFD);
+  // Receive from the client with io_uring if it's available
+  bool UseIoUring;
+  // Return false if Buffer doesn't contain a valid message, or
+  // the connection should be closed.
+  bool handleMessage(ArrayRef<uint8_t> Buffer);
+  bool dispatchMessage(const fbs::Message &Msg);
+
+  // Whether to accept compression requested by the client
+  bool EnableCompression;
+  // Address spaces of interest when the client emulates a full system.
+  // Everything is analyzed if none of them is selected.
+  SmallVector<uint64_t, 4> SelectedAddrSpaces;
+  bool SelectKernelCode, SelectUserCode;
+  // Number of connections accepted so far, used for naming metrics
+  unsigned NumConnections;
+  uint64_t ConnCompressedBytes, ConnUncompressedBytes;
+  std::chrono::microseconds ConnDecompressionTime;
+  SmallVector<char, 0> DecompressBuffer;
+
+  bool handleHello(const fbs::Hello &Hello);
+  bool handleCompressedBatch(const fbs::CompressedBatch &Batch);
 
   void addTB(const fbs::TranslatedBlock &TB) {
     static Timer TheTimer("addTB", "Adding new TB", Timers);
@@ -223,29 +367,116 @@ class QemuBroker : public Broker {
 
     if (TB.Index() >= TBs.size()) {
       std::lock_guard<std::mutex> LK(TBsMutex);
+      size_t OldCapacity = TBs.capacity_in_bytes();
       TBs.resize(TB.Index() + 1);
+      MemAcct.add(MemoryAccounting::T_BrokerStore,
+                  int64_t(TBs.capacity_in_bytes()) - int64_t(OldCapacity));
+    }
+
+    TranslationBlock NewTB(0U);
+    if (const auto *Insts = TB.Instructions()) {
+      NewTB.RawInsts.resize(Insts->size());
+      unsigned Idx = 0;
+      auto &TBRawInsts = NewTB.RawInsts;
+      for (const auto &Inst : *Insts) {
+        const auto &InstBytes = *Inst->Data();
+        TBRawInsts[Idx++] = RawInstTy(InstBytes.begin(),
+                                      InstBytes.end());
+      }
+      UnreadableTBs.erase(TB.Index());
+    } else if (!readFileBackedTB(TB, NewTB)) {
+      requestFullTB(TB);
+      return;
+    }
+
+    std::shared_ptr<const qemu_broker::DecodedBlock> OldBlock;
+    {
+      std::lock_guard<std::mutex> LK(TBsMutex);
+      auto &Slot = TBs[TB.Index()];
+      int64_t Delta = NewTB.getMemorySize();
+      if (Slot) {
+        // Retranslated
+        Delta -= Slot->getMemorySize();
+        OldBlock = std::move(Slot->Decoded);
+      }
+      Slot = std::move(NewTB);
+      MemAcct.add(MemoryAccounting::T_BrokerStore, Delta);
     }
+    releaseDecodedBlock(std::move(OldBlock));
+  }
 
-    const auto &Insts = *TB.Instructions();
-    TranslationBlock NewTB(Insts.size());
+  // Read instructions of a TB sent without them from the main
+  // executable. Return false if any of them can't be found.
+  bool readFileBackedTB(const fbs::TranslatedBlock &TB,
+                        TranslationBlock &NewTB) {
+    const auto *InstSizes = TB.InstSizes();
+    if (!TheGuestBinary || !InstSizes || TB.PC() < CodeStartAddress) {
+      WithColor::error() << "Can't read instructions of TB "
+                         << TB.Index() << " from the guest binary\n";
+      return false;
+    }
+
+    NewTB.RawInsts.resize(InstSizes->size());
+    uint64_t Addr = TB.PC() - CodeStartAddress;
     unsigned Idx = 0;
-    auto &TBRawInsts = NewTB.RawInsts;
-    for (const auto &Inst : Insts) {
-      const auto &InstBytes = *Inst->Data();
-      TBRawInsts[Idx++] = RawInstTy(InstBytes.begin(),
-                                    InstBytes.end());
+    for (uint8_t Size : *InstSizes) {
+      auto InstBytes = TheGuestBinary->getCode(Addr, Size);
+      if (InstBytes.size() != Size) {
+        WithColor::error() << "Address " << format_hex(Addr, 16)
+                           << " is not in the code of the guest binary\n";
+        return false;
+      }
+      NewTB.RawInsts[Idx++] = RawInstTy(InstBytes.begin(), InstBytes.end());
+      Addr += Size;
     }
+    TheMetrics.add("qemu_broker.file_backed_tbs");
+    return true;
+  }
 
-    std::lock_guard<std::mutex> LK(TBsMutex);
-    TBs[TB.Index()] = std::move(NewTB);
+  // TBs we failed to read from the guest binary, which the client has
+  // been asked to resend with instruction bytes. Only accessed by the
+  // receiving thread.
+  DenseSet<uint32_t> UnreadableTBs;
+
+  // Send a file-backed TB we can't read back to the client, which then
+  // resends it in full and stops sending file-backed TBs, since its
+  // file evidently differs from ours.
+  void requestFullTB(const fbs::TranslatedBlock &TB) {
+    UnreadableTBs.insert(TB.Index());
+
+    flatbuffers::FlatBufferBuilder Builder(64);
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> FbInstSizes;
+    if (const auto *InstSizes = TB.InstSizes())
+      FbInstSizes = Builder.CreateVector(InstSizes->data(),
+                                         InstSizes->size());
+    auto FbTB = fbs::CreateTranslatedBlock(Builder, TB.Index(),
+                                           /*Instructions=*/0, TB.PC(),
+                                           FbInstSizes);
+    auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_TranslatedBlock,
+                                        FbTB.Union());
+    fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+    sendToClient(Builder);
+    TheMetrics.add("qemu_broker.requested_full_tbs");
   }
 
   void initializeDisassembler();
 
   void disassemble(TranslationBlock &TB);
 
+  // Fetch MCInsts in queued TB slices into MCIS. If Boundaries is null,
+  // stop right after the first slice that ends a region. Otherwise, keep
+  // going and record every region boundary we cross into Boundaries.
+  // Return the number of MCInsts fetched and the region (if any) ended
+  // by the last fetched slice, or -1 if the stream has ended.
+  std::pair<int, const qemu_broker::BinaryRegion*>
+  fetchSlices(MutableArrayRef<const MCInst*> MCIS, int Size,
+              Optional<MDExchanger> MDE,
+              SmallVectorImpl<RegionBoundary> *Boundaries);
+
   void handleMetadata(const fbs::Metadata &MD) {
     CodeStartAddress = MD.LoadAddr();
+    std::lock_guard<std::mutex> LK(ClientMutex);
+    ClientWantsRegionResults = MD.WantsRegionResults();
   }
 
   void tbExec(const fbs::ExecTB &OrigTB) {
@@ -274,18 +505,30 @@ class QemuBroker : public Broker {
     }
 
     if (Idx >= TBs.size() || !TBs[Idx]) {
+      // Still waiting for the client to resend it
+      if (UnreadableTBs.count(Idx)) {
+        TheMetrics.add("qemu_broker.dropped_unreadable_tb_execs");
+        return;
+      }
       WithColor::error() << "Invalid TranslationBlock index\n";
       return;
     }
 
+    BatchTimestamps Timestamps;
+    Timestamps.Executed = OrigTB.Timestamp();
+    Timestamps.Received =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
     auto &TB = *TBs[Idx];
+    TB.LastExec = ++NumExecutedTBs;
 
     // Binary regions handler
     uint16_t BeginIdx = 0u, EndIdx = ~uint16_t(0u);
     const BinaryRegion *Region = nullptr;
     auto handleBinaryRegions
       = [&,this](llvm::function_ref<void(size_t,bool)> Handler) {
-      size_t i = 0U, S = TB.VAddrOffsets.size();
+      size_t i = 0U, S = TB.Decoded->VAddrOffsets.size();
       if (!CurBinRegion) {
         // Only reset Begin / End index if we're in trimming mode
         if (BinRegions->getOperationMode() == BinaryRegions::M_Trim)
@@ -294,7 +537,7 @@ class QemuBroker : public Broker {
           // Watch if there is any match on starting address
           uint64_t VA = TB.VAddr - CodeStartAddress;
           for (; i != S; ++i) {
-            uint8_t Offset = TB.VAddrOffsets[i];
+            uint8_t Offset = TB.Decoded->VAddrOffsets[i];
             CurBinRegion = BinRegions->lookup(VA + uint64_t(Offset));
             if (CurBinRegion)
               break;
@@ -313,7 +556,7 @@ class QemuBroker : public Broker {
         // Watch if any instruction hit the ending address
         uint64_t VA = TB.VAddr - CodeStartAddress;
         for (; i != S; ++i) {
-          uint8_t Offset = TB.VAddrOffsets[i];
+          uint8_t Offset = TB.Decoded->VAddrOffsets[i];
           if (CurBinRegion->EndAddr == VA + uint64_t(Offset))
             break;
         }
@@ -328,6 +571,7 @@ class QemuBroker : public Broker {
     };
 
     if (!TB) {
+      size_t OldSize = TB.getMemorySize();
       TB.VAddr = PC;
       // Disassemble
       disassemble(TB);
@@ -343,7 +587,11 @@ class QemuBroker : public Broker {
               TB.BeginMarks.set(MCInstIdx);
             else
               TB.EndMarks.set(MCInstIdx);
+            TB.MarkedRegions[MCInstIdx] = CurBinRegion;
           });
+
+      MemAcct.add(MemoryAccounting::T_BrokerStore,
+                  int64_t(TB.getMemorySize()) - int64_t(OldSize));
     }
 
     if (BinRegions && BinRegions->size() &&
@@ -374,8 +622,8 @@ class QemuBroker : public Broker {
         uint64_t Addr = FbMA->VAddr();
         unsigned Size = FbMA->Size();
 
-        if (TB.SkewIndicies.count(InstIdx))
-          InstIdx = TB.SkewIndicies.lookup(InstIdx);
+        if (TB.Decoded->SkewIndicies.count(InstIdx))
+          InstIdx = TB.Decoded->SkewIndicies.lookup(InstIdx);
 
         // Honoring the index range
         if (InstIdx < BeginIdx || InstIdx >= EndIdx)
@@ -399,7 +647,10 @@ class QemuBroker : public Broker {
     // Put into the queue
     {
       std::lock_guard<std::mutex> Lock(QueueMutex);
-      TBQueue.emplace_back(Idx, BeginIdx, EndIdx, Region, MemAccesses);
+      TBQueue.emplace_back(Idx, BeginIdx, EndIdx, Region, MemAccesses,
+                           Timestamps);
+      MemAcct.add(MemoryAccounting::T_BrokerQueue,
+                  TBQueue.back().getMemorySize());
     }
     QueueCV.notify_one();
   }
@@ -413,11 +664,29 @@ public:
 
     StringRef BinaryRegionsManifestFile;
     qemu_broker::BinaryRegions::Mode BinaryRegionsOpMode;
+    // Directory to cache symbols used by binary regions
+    StringRef SymbolCacheDir;
+
+    // Main executable of the guest
+    StringRef GuestBinaryPath;
 
     bool EnableMemoryAccessMD;
 
+    bool EnableInstrAddrMD;
+
+    bool EnableCompactMCInst;
+
+    bool UseIoUring;
+
+    bool EnableCompression;
+
     bool EnableTimer;
 
+    // Filter of address spaces (e.g. page table bases) for clients
+    // emulating a full system
+    SmallVector<uint64_t, 4> AddressSpaces;
+    bool KernelAddressSpace, UserAddressSpaces;
+
     // Initialize the default values
     Options();
 
@@ -426,11 +695,13 @@ public:
   };
 
   QemuBroker(const Options &Opts,
-             const MCSubtargetInfo &STI,
-             MCContext &Ctx, const Target &T);
+             const MCSubtargetInfo &STI, const MCInstrInfo &MCII,
+             MCContext &Ctx, const Target &T,
+             Metrics &M, MemoryAccounting &MA);
 
   unsigned getFeatures() const override {
-    unsigned Features = Broker::Feature_Metadata;
+    unsigned Features = Broker::Feature_Metadata |
+                        Broker::Feature_FetchTimeout;
     if (BinRegions && BinRegions->size())
       Features |= Broker::Feature_Region;
     return Features;
@@ -443,6 +714,22 @@ public:
   fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size = -1,
               Optional<MDExchanger> MDE = llvm::None) override;
 
+  int fetchRegions(MutableArrayRef<const MCInst*> MCIS, int Size,
+                   SmallVectorImpl<RegionBoundary> &Boundaries,
+                   Optional<MDExchanger> MDE = llvm::None) override;
+
+  Optional<BatchTimestamps> getLastBatchTimestamps() const override {
+    return LastBatchTimestamps;
+  }
+
+  void setFetchTimeout(std::chrono::milliseconds Timeout) override {
+    FetchTimeout = Timeout;
+  }
+
+  void onRegionResult(const RegionResult &Result) override;
+
+  bool onMemoryPressure(MemoryPressureResponse Response) override;
+
   ~QemuBroker() {
     if(ReceiverThread) {
       ReceiverThread->join();
@@ -461,24 +748,41 @@ public:
 } // end anonymous namespace
 
 QemuBroker::QemuBroker(const QemuBroker::Options &Opts,
-                       const MCSubtargetInfo &MSTI,
-                       MCContext &C, const Target &T)
+                       const MCSubtargetInfo &MSTI, const MCInstrInfo &MII,
+                       MCContext &C, const Target &T,
+                       Metrics &M, MemoryAccounting &MA)
   : ListenAddr(Opts.ListenAddress.str()), ListenPort(Opts.ListenPort.str()),
     ServSocktFD(-1), AI(nullptr),
     MaxNumAcceptedConnection(Opts.MaxNumConnections),
     CurBinRegion(nullptr),
     CodeStartAddress(0U),
-    TheTarget(T), Ctx(C), STI(MSTI),
+    TheTarget(T), Ctx(C), STI(MSTI), MCII(MII),
     CurDisAsm(nullptr),
+    NumExecutedTBs(0U), EvictionRequested(false), TheMetrics(M), MemAcct(MA),
+    EnableCompactMCInst(Opts.EnableCompactMCInst),
     IsEndOfStream(false),
+    ClientSocktFD(-1), ClientWantsRegionResults(false),
+    HasPendingOutput(false),
+    FetchTimeout(0),
     EnableMemAccessMD(Opts.EnableMemoryAccessMD),
+    EnableInstrAddrMD(Opts.EnableInstrAddrMD),
     TotalNumTraces(0U),
     EnableTimer(Opts.EnableTimer),
-    Timers("QemuBroker", "Time spending on qemu-broker") {
+    Timers("QemuBroker", "Time spending on qemu-broker"),
+    UseIoUring(Opts.UseIoUring),
+    EnableCompression(Opts.EnableCompression),
+    SelectedAddrSpaces(Opts.AddressSpaces.begin(), Opts.AddressSpaces.end()),
+    SelectKernelCode(Opts.KernelAddressSpace),
+    SelectUserCode(Opts.UserAddressSpaces),
+    NumConnections(0U),
+    ConnCompressedBytes(0U), ConnUncompressedBytes(0U),
+    ConnDecompressionTime(0) {
 
   const auto &BinRegionsManifest = Opts.BinaryRegionsManifestFile;
   if (BinRegionsManifest.size()) {
-    auto RegionsOrErr = qemu_broker::BinaryRegions::Create(BinRegionsManifest);
+    auto RegionsOrErr
+      = qemu_broker::BinaryRegions::Create(BinRegionsManifest,
+                                           Opts.SymbolCacheDir);
     if (!RegionsOrErr)
       handleAllErrors(RegionsOrErr.takeError(),
                       [](const ErrorInfoBase &E) {
@@ -491,6 +795,18 @@ QemuBroker::QemuBroker(const QemuBroker::Options &Opts,
     }
   }
 
+  if (Opts.GuestBinaryPath.size()) {
+    auto GBOrErr = qemu_broker::GuestBinary::create(Opts.GuestBinaryPath);
+    if (!GBOrErr)
+      logAllUnhandledErrors(GBOrErr.takeError(),
+                            WithColor::warning()
+                              << "Failed to load " << Opts.GuestBinaryPath
+                              << ", instructions will always be sent by "
+                              << "the client: ");
+    else
+      TheGuestBinary = std::move(*GBOrErr);
+  }
+
   initializeDisassembler();
 
   initializeServer();
@@ -568,97 +884,382 @@ void QemuBroker::recvWorker() {
     outs() << ":" << ListenPort;
   outs() << "...\n";
 
-  int ClientSocktFD;
-  uint8_t RecvBuffer[RECV_BUFFER_SIZE];
-  static_assert(sizeof(RecvBuffer) > sizeof(flatbuffers::uoffset_t),
-                "RecvBuffer is not larger than uoffset_t");
-  SmallVector<uint8_t, RECV_BUFFER_SIZE> MsgBuffer;
-  while ((ClientSocktFD = accept(ServSocktFD, nullptr, nullptr))) {
-    if (ClientSocktFD < 0) {
+  std::unique_ptr<qemu_broker::UringReceiver> Uring;
+  if (UseIoUring) {
+    auto UringOrErr = qemu_broker::UringReceiver::create();
+    if (!UringOrErr)
+      logAllUnhandledErrors(UringOrErr.takeError(),
+                            WithColor::warning() << "Falling back to "
+                                                 << "blocking receive: ");
+    else
+      Uring = std::move(*UringOrErr);
+  }
+
+  int SocktFD;
+  while ((SocktFD = accept(ServSocktFD, nullptr, nullptr))) {
+    if (SocktFD < 0) {
       ::perror("Failed to accept client");
       continue;
     }
     LLVM_DEBUG(dbgs() << "Get a new client\n");
+    {
+      std::lock_guard<std::mutex> LK(ClientMutex);
+      ClientSocktFD = SocktFD;
+      ClientWantsRegionResults = false;
+      PendingOutput.clear();
+      HasPendingOutput = false;
+    }
+    UnreadableTBs.clear();
+    ++NumConnections;
+    ConnCompressedBytes = ConnUncompressedBytes = 0U;
+    ConnDecompressionTime = std::chrono::microseconds(0);
+
+    bool IsReceived = false;
+    if (Uring) {
+      qemu_broker::MessageFramer Framer;
+      auto handleData = [&,this](ArrayRef<uint8_t> Data) {
+        return Framer.feed(Data, [this](ArrayRef<uint8_t> Msg) {
+                                   return handleMessage(Msg);
+                                 });
+      };
+      auto ResOrErr = Uring->receive(SocktFD, handleData);
+      if (!ResOrErr) {
+        logAllUnhandledErrors(ResOrErr.takeError(), WithColor::error());
+        IsReceived = true;
+      } else if (!*ResOrErr) {
+        WithColor::warning() << "Multishot receive is not supported, "
+                             << "falling back to blocking receive\n";
+        Uring.reset();
+      } else
+        IsReceived = true;
+    }
+    if (!IsReceived)
+      recvBlocking(SocktFD);
 
-    while (true) {
-      MsgBuffer.clear();
-
-      bool MsgValid = false;
-      flatbuffers::uoffset_t TotalMsgSize = 0U;
-      do {
-        ssize_t ReadLen, Offset = 0;
-        if (!TotalMsgSize) {
-          // Read the prefix first
-          ReadLen = read(ClientSocktFD, RecvBuffer, sizeof(TotalMsgSize));
-          // Reach EOF, exit normally
-          if (!ReadLen)
-            break;
-          if (ReadLen < sizeof(TotalMsgSize)) {
-            if (ReadLen < 0)
-              ::perror("Failed to read prefixed size");
-            else
-              // Don't try to print errno after a successful
-              // read, since errno is undefined in such case
-              errs() << "Failed to read prefixed size";
-            errs() << "\n";
-            break;
-          }
+    LLVM_DEBUG(dbgs() << "Closing current client...\n");
+    {
+      std::lock_guard<std::mutex> LK(ClientMutex);
+      ClientSocktFD = -1;
+      close(SocktFD);
+    }
+    // Blocks whose last user was retranslated while being fetched
+    pruneDecodedBlocks();
 
-          TotalMsgSize =
-            flatbuffers::ReadScalar<flatbuffers::uoffset_t>(RecvBuffer);
-          assert(TotalMsgSize);
-          LLVM_DEBUG(dbgs() << "Total message size: " << TotalMsgSize << "\n");
-          Offset = sizeof(TotalMsgSize);
-        }
+    if (MaxNumAcceptedConnection > 0 &&
+        --MaxNumAcceptedConnection == 0)
+      break;
+  }
+}
 
-        ReadLen = std::min(size_t(TotalMsgSize),
-                           sizeof(RecvBuffer) - Offset);
-        ReadLen = read(ClientSocktFD, &RecvBuffer[Offset], ReadLen);
-        if (ReadLen < 0) {
-          ::perror("Failed to read from client");
-          errs() << "\n";
-          break;
-        }
+void QemuBroker::recvBlocking(int SocktFD) {
+  uint8_t RecvBuffer[RECV_BUFFER_SIZE];
+  static_assert(sizeof(RecvBuffer) > sizeof(flatbuffers::uoffset_t),
+                "RecvBuffer is not larger than uoffset_t");
+  SmallVector<uint8_t, RECV_BUFFER_SIZE> MsgBuffer;
+  while (true) {
+    MsgBuffer.clear();
+
+    bool MsgValid = false;
+    flatbuffers::uoffset_t TotalMsgSize = 0U;
+    do {
+      ssize_t ReadLen, Offset = 0;
+      if (!TotalMsgSize) {
+        // Read the prefix first
+        ReadLen = read(SocktFD, RecvBuffer, sizeof(TotalMsgSize));
         // Reach EOF, exit normally
         if (!ReadLen)
           break;
+        if (ReadLen < sizeof(TotalMsgSize)) {
+          if (ReadLen < 0)
+            ::perror("Failed to read prefixed size");
+          else
+            // Don't try to print errno after a successful
+            // read, since errno is undefined in such case
+            errs() << "Failed to read prefixed size";
+          errs() << "\n";
+          break;
+        }
 
-        assert(TotalMsgSize >= ReadLen);
-        TotalMsgSize -= ReadLen;
+        TotalMsgSize =
+          flatbuffers::ReadScalar<flatbuffers::uoffset_t>(RecvBuffer);
+        assert(TotalMsgSize);
+        LLVM_DEBUG(dbgs() << "Total message size: " << TotalMsgSize << "\n");
+        Offset = sizeof(TotalMsgSize);
+      }
 
-        MsgBuffer.append(RecvBuffer, &RecvBuffer[ReadLen + Offset]);
+      ReadLen = std::min(size_t(TotalMsgSize),
+                         sizeof(RecvBuffer) - Offset);
+      ReadLen = read(SocktFD, &RecvBuffer[Offset], ReadLen);
+      if (ReadLen < 0) {
+        ::perror("Failed to read from client");
+        errs() << "\n";
+        break;
+      }
+      // Reach EOF, exit normally
+      if (!ReadLen)
+        break;
 
-        flatbuffers::Verifier V(ArrayRef<uint8_t>(MsgBuffer).data(),
-                                MsgBuffer.size());
-        MsgValid = fbs::VerifySizePrefixedMessageBuffer(V);
-      } while (!MsgValid);
+      assert(TotalMsgSize >= ReadLen);
+      TotalMsgSize -= ReadLen;
 
-      if (!MsgValid)
-        break;
+      MsgBuffer.append(RecvBuffer, &RecvBuffer[ReadLen + Offset]);
 
-      const fbs::Message *Msg = fbs::GetSizePrefixedMessage(MsgBuffer.data());
-      switch (Msg->Content_type()) {
-      case fbs::Msg_Metadata:
-        handleMetadata(*Msg->Content_as_Metadata());
-        break;
-      case fbs::Msg_TranslatedBlock:
-        addTB(*Msg->Content_as_TranslatedBlock());
-        break;
-      case fbs::Msg_ExecTB:
-        tbExec(*Msg->Content_as_ExecTB());
-        break;
-      default:
-        llvm_unreachable("Unrecoginized message type");
-      }
+      flatbuffers::Verifier V(ArrayRef<uint8_t>(MsgBuffer).data(),
+                              MsgBuffer.size());
+      MsgValid = fbs::VerifySizePrefixedMessageBuffer(V);
+    } while (!MsgValid);
+
+    if (!MsgValid)
+      break;
+
+    if (!dispatchMessage(*fbs::GetSizePrefixedMessage(MsgBuffer.data())))
+      break;
+  }
+}
+
+bool QemuBroker::handleMessage(ArrayRef<uint8_t> Buffer) {
+  flatbuffers::Verifier V(Buffer.data(), Buffer.size());
+  if (!fbs::VerifySizePrefixedMessageBuffer(V)) {
+    WithColor::error() << "Invalid message from client\n";
+    return false;
+  }
+  return dispatchMessage(*fbs::GetSizePrefixedMessage(Buffer.data()));
+}
+
+bool QemuBroker::dispatchMessage(const fbs::Message &Msg) {
+  // Don't let pending messages wait for the next region result
+  if (HasPendingOutput) {
+    std::lock_guard<std::mutex> LK(ClientMutex);
+    flushPendingOutput();
+  }
+
+  bool Continue = true;
+  switch (Msg.Content_type()) {
+  case fbs::Msg_Metadata:
+    handleMetadata(*Msg.Content_as_Metadata());
+    break;
+  case fbs::Msg_TranslatedBlock:
+    addTB(*Msg.Content_as_TranslatedBlock());
+    break;
+  case fbs::Msg_ExecTB:
+    tbExec(*Msg.Content_as_ExecTB());
+    break;
+  case fbs::Msg_Hello:
+    Continue = handleHello(*Msg.Content_as_Hello());
+    break;
+  case fbs::Msg_CompressedBatch:
+    Continue = handleCompressedBatch(*Msg.Content_as_CompressedBatch());
+    break;
+  default:
+    llvm_unreachable("Unrecoginized message type");
+  }
+
+  if (EvictionRequested.exchange(false))
+    evictColdTBs();
+  return Continue;
+}
+
+// Send the entire Buffer even if it takes multiple calls
+static bool sendFully(int SocktFD, const uint8_t *Buffer, size_t Size) {
+  while (Size) {
+    ssize_t Len = send(SocktFD, Buffer, Size, MSG_NOSIGNAL);
+    if (Len < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
     }
+    Buffer += Len;
+    Size -= Len;
+  }
+  return true;
+}
 
-    LLVM_DEBUG(dbgs() << "Closing current client...\n");
-    close(ClientSocktFD);
+bool QemuBroker::handleHello(const fbs::Hello &Hello) {
+  auto Codec = fbs::Codec_None;
+  if (Hello.Compression() == fbs::Codec_Zlib && EnableCompression &&
+      zlib::isAvailable())
+    Codec = fbs::Codec_Zlib;
+  LLVM_DEBUG(dbgs() << "Client requests codec "
+                    << fbs::EnumNameCodec(Hello.Compression())
+                    << ", accepting " << fbs::EnumNameCodec(Codec) << "\n");
+
+  // Only accept file-backed TBs if we're reading the same file
+  bool FileBackedTBs = false;
+  if (Hello.FileBackedTBs() && TheGuestBinary) {
+    StringRef ClientBuildID =
+      Hello.BuildID()? StringRef(Hello.BuildID()->c_str(),
+                                 Hello.BuildID()->size()) : "";
+    StringRef BuildID = TheGuestBinary->getBuildID();
+    if (!ClientBuildID.empty() && !BuildID.empty()) {
+      FileBackedTBs = ClientBuildID == BuildID;
+      if (!FileBackedTBs)
+        WithColor::warning() << "Build ID of the guest binary ("
+                             << BuildID << ") doesn't match the client's ("
+                             << ClientBuildID << ")\n";
+    } else {
+      // Without build IDs, only the code itself can tell
+      uint64_t CodeHash = TheGuestBinary->getCodeHash();
+      FileBackedTBs = Hello.CodeHash() == CodeHash;
+      if (!FileBackedTBs)
+        WithColor::warning() << "Code hash of the guest binary ("
+                             << format_hex(CodeHash, 18)
+                             << ") doesn't match the client's ("
+                             << format_hex(Hello.CodeHash(), 18) << ")\n";
+    }
+  }
 
-    if (MaxNumAcceptedConnection > 0 &&
-        --MaxNumAcceptedConnection == 0)
+  // Only clients emulating a full system can tell address spaces apart
+  bool HasAddrSpaceFilter = SelectKernelCode || SelectUserCode ||
+                            SelectedAddrSpaces.size();
+  if (HasAddrSpaceFilter && !Hello.SystemMode())
+    WithColor::warning() << "Address space filter is ignored since the "
+                         << "client is not in system mode\n";
+
+  flatbuffers::FlatBufferBuilder Builder(32);
+  flatbuffers::Offset<flatbuffers::Vector<uint64_t>> FbAddrSpaces;
+  if (Hello.SystemMode() && SelectedAddrSpaces.size())
+    FbAddrSpaces = Builder.CreateVector(SelectedAddrSpaces.data(),
+                                        SelectedAddrSpaces.size());
+  auto FbHello = fbs::CreateHello(Builder, Codec, FileBackedTBs,
+                                  /*BuildID=*/0, Hello.SystemMode(),
+                                  FbAddrSpaces,
+                                  Hello.SystemMode() && SelectKernelCode,
+                                  Hello.SystemMode() && SelectUserCode);
+  auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_Hello,
+                                      FbHello.Union());
+  fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+
+  std::lock_guard<std::mutex> LK(ClientMutex);
+  if (!sendFully(ClientSocktFD, Builder.GetBufferPointer(),
+                 Builder.GetSize())) {
+    ::perror("Failed to reply handshake");
+    return false;
+  }
+  return true;
+}
+
+bool QemuBroker::handleCompressedBatch(const fbs::CompressedBatch &Batch) {
+  const auto *Data = Batch.Data();
+  if (!Data) {
+    WithColor::error() << "Empty compressed batch\n";
+    return false;
+  }
+
+  // Take the buffer for ourselves, in case a message inside
+  // is yet another compressed batch.
+  SmallVector<char, 0> Buffer(std::move(DecompressBuffer));
+  Buffer.clear();
+  auto StartTime = std::chrono::steady_clock::now();
+  if (auto E = zlib::uncompress(
+                 StringRef(reinterpret_cast<const char*>(Data->data()),
+                           Data->size()),
+                 Buffer, Batch.UncompressedSize())) {
+    logAllUnhandledErrors(std::move(E), WithColor::error()
+                                        << "Failed to decompress batch: ");
+    return false;
+  }
+  ConnDecompressionTime +=
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - StartTime);
+  ConnCompressedBytes += Data->size();
+  ConnUncompressedBytes += Buffer.size();
+
+  std::string Prefix =
+    "qemu_broker.connections." + std::to_string(NumConnections);
+  TheMetrics.set(Prefix + ".compressed_bytes", ConnCompressedBytes);
+  TheMetrics.set(Prefix + ".uncompressed_bytes", ConnUncompressedBytes);
+  TheMetrics.set(Prefix + ".decompression_us",
+                 ConnDecompressionTime.count());
+  TheMetrics.set(Prefix + ".compression_ratio_pct",
+                 ConnUncompressedBytes?
+                 ConnCompressedBytes * 100U / ConnUncompressedBytes : 0U);
+
+  qemu_broker::MessageFramer Framer;
+  bool Continue = Framer.feed(
+    ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(Buffer.data()),
+                      Buffer.size()),
+    [this](ArrayRef<uint8_t> Msg) { return handleMessage(Msg); });
+  if (Continue && !Framer.empty()) {
+    WithColor::error() << "Truncated message in compressed batch\n";
+    Continue = false;
+  }
+
+  DecompressBuffer = std::move(Buffer);
+  return Continue;
+}
+
+void QemuBroker::onRegionResult(const RegionResult &Result) {
+  std::lock_guard<std::mutex> LK(ClientMutex);
+  if (ClientSocktFD < 0 || !ClientWantsRegionResults)
+    return;
+
+  // Results can't be interleaved with a partially sent one
+  if (!flushPendingOutput()) {
+    TheMetrics.add("qemu_broker.dropped_region_results");
+    return;
+  }
+
+  flatbuffers::FlatBufferBuilder Builder(128);
+  auto FbResult = fbs::CreateRegionResult(
+    Builder, Builder.CreateString(Result.Description.str()),
+    Result.NumInstructions, Result.NumCycles, Result.NumMicroOps,
+    Result.NumSampledOutInstructions);
+  auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_RegionResult,
+                                      FbResult.Union());
+  fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+
+  // Never block the simulation on a client that doesn't read: drop the
+  // result if the socket buffer is full.
+  const uint8_t *Buffer = Builder.GetBufferPointer();
+  size_t Size = Builder.GetSize();
+  ssize_t Len = send(ClientSocktFD, Buffer, Size,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (Len < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      ::perror("Failed to send region result");
+    TheMetrics.add("qemu_broker.dropped_region_results");
+    return;
+  }
+  // Part of the message has been sent, so we have to finish it later
+  // otherwise the stream will be corrupted.
+  if (size_t(Len) < Size) {
+    PendingOutput.assign(Buffer + Len, Buffer + Size);
+    HasPendingOutput = true;
+  }
+  TheMetrics.add("qemu_broker.sent_region_results");
+}
+
+bool QemuBroker::flushPendingOutput() {
+  size_t Offset = 0U;
+  while (Offset < PendingOutput.size()) {
+    ssize_t Len = send(ClientSocktFD, PendingOutput.data() + Offset,
+                       PendingOutput.size() - Offset,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (Len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      // The stream is broken anyway
+      ::perror("Failed to send message to client");
+      Offset = PendingOutput.size();
       break;
+    }
+    Offset += Len;
   }
+  PendingOutput.erase(PendingOutput.begin(),
+                      PendingOutput.begin() + Offset);
+  HasPendingOutput = !PendingOutput.empty();
+  return PendingOutput.empty();
+}
+
+void QemuBroker::sendToClient(const flatbuffers::FlatBufferBuilder &Builder) {
+  std::lock_guard<std::mutex> LK(ClientMutex);
+  if (ClientSocktFD < 0)
+    return;
+  const uint8_t *Buffer = Builder.GetBufferPointer();
+  PendingOutput.insert(PendingOutput.end(), Buffer,
+                       Buffer + Builder.GetSize());
+  HasPendingOutput = true;
+  flushPendingOutput();
 }
 
 void QemuBroker::initializeDisassembler() {
@@ -686,8 +1287,28 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
   if (TB) return;
 
   const auto &TheTriple = STI.getTargetTriple();
+  unsigned ISAMode = 0U;
+  uint64_t StartVAddr = TB.VAddr;
+  if (TheTriple.isARM() || TheTriple.isThumb()) {
+    // Thumb mode if the LSB is set
+    ISAMode = TB.VAddr & 0b1;
+    // We don't want LSB to interfere the disassembling process
+    StartVAddr &= (~0b1);
+  }
+
+  // Another client, or a previous translation of this TB, might
+  // have disassembled the same instructions.
+  if ((TB.Decoded = DecodedBlocks.lookup(ISAMode, StartVAddr,
+                                         TB.RawInsts))) {
+    TheMetrics.add("qemu_broker.decode_cache.hits");
+    TB.BeginMarks.resize(TB.Decoded->MCInsts.size());
+    TB.EndMarks.resize(TB.Decoded->MCInsts.size());
+    return;
+  }
+  TheMetrics.add("qemu_broker.decode_cache.misses");
+
   if (TheTriple.isARM() || TheTriple.isThumb()) {
-    if (TB.VAddr & 0b1)
+    if (ISAMode)
       // Thumb mode
       useDisassembler(TheTriple.isThumb());
     else
@@ -695,14 +1316,14 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
       useDisassembler(TheTriple.isARM());
   }
 
+  // Pinned instructions are accounted by the cache as well
+  size_t OldCacheSize = DecodedBlocks.getMemorySize();
+  auto Block = std::make_unique<qemu_broker::DecodedBlock>(ISAMode,
+                                                           StartVAddr,
+                                                           TB.RawInsts);
   bool Disassembled;
   uint64_t DisAsmSize;
   uint64_t Len;
-  uint64_t StartVAddr = TB.VAddr;
-  // We don't want LSB to interfere the disassembling process
-  if (TheTriple.isARM() || TheTriple.isThumb())
-    StartVAddr &= (~0b1);
-
   uint64_t VAddr = StartVAddr;
 
   LLVM_DEBUG(dbgs() << "Disassembling " << TB.RawInsts.size()
@@ -711,7 +1332,7 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
   unsigned SkewIdxOffset = 0U;
   for (const auto &RawInst : TB.RawInsts) {
     if (SkewIdxOffset > 0)
-      TB.SkewIndicies[RawInstIdx] = RawInstIdx + SkewIdxOffset;
+      Block->SkewIndicies[RawInstIdx] = RawInstIdx + SkewIdxOffset;
 
     ArrayRef<uint8_t> InstBytes(RawInst);
     uint64_t Index = 0U;
@@ -721,8 +1342,8 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
       LLVM_DEBUG(dbgs() << "Try to disassemble instruction " << RawInst
                         << " with Index = " << Index
                         << ", VAddr = " << format_hex(VAddr + Index, 16) << "\n");
-      auto MCI = std::make_unique<MCInst>();
-      Disassembled = CurDisAsm->getInstruction(*MCI, DisAsmSize,
+      MCInst MCI;
+      Disassembled = CurDisAsm->getInstruction(MCI, DisAsmSize,
                                                InstBytes.slice(Index),
                                                VAddr + Index,
                                                nulls());
@@ -737,9 +1358,22 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
       if (!DisAsmSize)
         DisAsmSize = 1;
 
-      TB.MCInsts.emplace_back(std::move(MCI));
+      if (EnableCompactMCInst && isCompactable(MCI)) {
+        Block->CompactInsts.append(MCI);
+        Block->MCInsts.push_back(nullptr);
+      } else {
+        if (EnableCompactMCInst)
+          Block->CompactInsts.appendEmpty();
+        if (hasVariantDesc(MCI)) {
+          // Outlive the block s.t. it can be evicted
+          Block->MCInsts.push_back(DecodedBlocks.pinInst(MCI));
+        } else {
+          Block->OwnedInsts.emplace_back(std::make_unique<MCInst>(MCI));
+          Block->MCInsts.push_back(Block->OwnedInsts.back().get());
+        }
+      }
       ++NumMCInsts;
-      TB.VAddrOffsets.emplace_back(VAddr + Index - StartVAddr);
+      Block->VAddrOffsets.emplace_back(VAddr + Index - StartVAddr);
       Index += DisAsmSize;
 
       if (NumMCInsts > 1)
@@ -750,19 +1384,111 @@ void QemuBroker::disassemble(TranslationBlock &TB) {
     ++RawInstIdx;
   }
 
-  TB.BeginMarks.resize(TB.MCInsts.size());
-  TB.EndMarks.resize(TB.MCInsts.size());
+  TB.Decoded = DecodedBlocks.insert(std::move(Block));
+  MemAcct.add(MemoryAccounting::T_BrokerStore,
+              int64_t(DecodedBlocks.getMemorySize()) - int64_t(OldCacheSize));
+  TheMetrics.set("qemu_broker.decode_cache.entries", DecodedBlocks.size());
+
+  TB.BeginMarks.resize(TB.Decoded->MCInsts.size());
+  TB.EndMarks.resize(TB.Decoded->MCInsts.size());
 }
 
-std::pair<int, Broker::RegionDescriptor>
-QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
-                        Optional<MDExchanger> MDE) {
-  static Timer TheTimer("fetchRegion", "Fetching a region", Timers);
+bool QemuBroker::hasVariantDesc(const MCInst &MCI) const {
+  const MCInstrDesc &MID = MCII.get(MCI.getOpcode());
+  if (MID.isVariadic())
+    return true;
+  const MCSchedModel &SM = STI.getSchedModel();
+  return SM.hasInstrSchedModel() &&
+         SM.getSchedClassDesc(MID.getSchedClass())->isVariant();
+}
+
+bool QemuBroker::isCompactable(const MCInst &MCI) const {
+  // We can't expand instructions whose descriptors are keyed by
+  // address into a recycled storage.
+  return !hasVariantDesc(MCI) &&
+         qemu_broker::CompactMCInsts::isEncodable(MCI);
+}
+
+void QemuBroker::releaseDecodedBlock(
+    std::shared_ptr<const qemu_broker::DecodedBlock> Block) {
+  if (!Block)
+    return;
+  if (size_t NumFreed = DecodedBlocks.release(std::move(Block))) {
+    MemAcct.add(MemoryAccounting::T_BrokerStore, -int64_t(NumFreed));
+    TheMetrics.set("qemu_broker.decode_cache.entries", DecodedBlocks.size());
+  }
+}
+
+void QemuBroker::pruneDecodedBlocks() {
+  size_t NumFreed = DecodedBlocks.prune();
+  MemAcct.add(MemoryAccounting::T_BrokerStore, -int64_t(NumFreed));
+  TheMetrics.set("qemu_broker.decode_cache.entries", DecodedBlocks.size());
+}
+
+void QemuBroker::evictColdTBs() {
+  static Timer TheTimer("evictColdTBs", "Evicting cold TBs", Timers);
   TimeRegion TR(TheTimer);
+
+  // TBs referenced by queued slices are about to be fetched
+  DenseSet<size_t> QueuedTBs;
+  {
+    std::lock_guard<std::mutex> Lock(QueueMutex);
+    for (const auto &Slice : TBQueue)
+      QueuedTBs.insert(Slice.Index);
+  }
+
+  size_t NumEvicted = 0U;
+  {
+    std::lock_guard<std::mutex> LK(TBsMutex);
+    for (size_t i = 0U, E = TBs.size(); i != E; ++i) {
+      auto &TB = TBs[i];
+      if (!TB || !*TB || QueuedTBs.count(i) || InFlightTBs.count(i) ||
+          !TB->isEvictable())
+        continue;
+      if (NumExecutedTBs - TB->LastExec < ColdTBDistance)
+        continue;
+      int64_t OldSize = TB->getMemorySize();
+      TB->evict();
+      MemAcct.add(MemoryAccounting::T_BrokerStore,
+                  int64_t(TB->getMemorySize()) - OldSize);
+      ++NumEvicted;
+    }
+  }
+
+  // Blocks that are no longer used by any TB
+  pruneDecodedBlocks();
+
+  LLVM_DEBUG(dbgs() << "Evicted " << NumEvicted << " cold TBs\n");
+  TheMetrics.add("qemu_broker.evicted_tbs", NumEvicted);
+}
+
+bool QemuBroker::onMemoryPressure(MemoryPressureResponse Response) {
+  switch (Response) {
+  case MPR_EvictCaches:
+    EvictionRequested = true;
+    return true;
+  case MPR_ReduceMetadata:
+    // Region markers are kept since regions rely on them
+    EnableMemAccessMD = false;
+    EnableInstrAddrMD = false;
+    return true;
+  }
+  return false;
+}
+
+std::pair<int, const qemu_broker::BinaryRegion*>
+QemuBroker::fetchSlices(MutableArrayRef<const MCInst*> MCIS, int Size,
+                        Optional<MDExchanger> MDE,
+                        SmallVectorImpl<RegionBoundary> *Boundaries) {
   using namespace qemu_broker;
 
+  // The caller is done with the instructions of the last fetch by now
+  for (auto &Block : InFlightBlocks)
+    releaseDecodedBlock(std::move(Block));
+  InFlightBlocks.clear();
+
   if (!Size)
-    return std::make_pair(0, RegionDescriptor(false));
+    return std::make_pair(0, nullptr);
   if (Size < 0 || Size > MCIS.size())
     Size = MCIS.size();
 
@@ -774,35 +1500,59 @@ QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
     // Only block if the queue is completely empty
     if (TBQueue.empty()) {
       if (IsEndOfStream)
-        return std::make_pair(-1, RegionDescriptor(true));
-      else
-        QueueCV.wait(Lock,
-                     [this] {
+        return std::make_pair(-1, nullptr);
+
+      auto IsReady = [this] {
                       return IsEndOfStream || !TBQueue.empty();
-                     });
+                     };
+      if (FetchTimeout.count()) {
+        if (!QueueCV.wait_for(Lock, FetchTimeout, IsReady))
+          return std::make_pair(FetchTimedOut, nullptr);
+      } else
+        QueueCV.wait(Lock, IsReady);
     }
 
     if (TBQueue.empty() && IsEndOfStream)
-      return std::make_pair(-1, RegionDescriptor(true));
+      return std::make_pair(-1, nullptr);
 
     // Fetch enough block indicies to fulfill the size requirement
     std::lock_guard<std::mutex> LK(TBsMutex);
     int S = Size;
     bool EndOfRegion = false;
-    while (S > 0 && !TBQueue.empty() && !EndOfRegion) {
+    // Multiple regions are allowed in a single batch if the caller
+    // wants region boundaries.
+    while (S > 0 && !TBQueue.empty() && (Boundaries || !EndOfRegion)) {
       auto &CurSlice = TBQueue.front();
       size_t TBIdx = CurSlice.Index;
-      if (TBIdx < TBs.size() && TBs[TBIdx]) {
-        size_t SliceLen = std::min(TBs[TBIdx]->MCInsts.size(), CurSlice.size());
-        if (SliceLen > S) {
+      int64_t OldSliceSize = CurSlice.getMemorySize();
+      if (TBIdx >= TBs.size() || !TBs[TBIdx]) {
+        // The TB is gone. Take the slice without any instruction rather
+        // than leaving it at the front forever, since it might still
+        // end a region.
+        CurSlice.EndIdx = CurSlice.BeginIdx;
+        SelectedSlices.emplace_back(std::move(CurSlice));
+        TBQueue.erase(TBQueue.begin());
+        MemAcct.add(MemoryAccounting::T_BrokerQueue, -OldSliceSize);
+      } else {
+        // A retranslated TB might have fewer instructions than the slice
+        size_t NumInsts = std::min(TBs[TBIdx]->getNumMCInsts(),
+                                   size_t(CurSlice.EndIdx));
+        size_t SliceLen = NumInsts > CurSlice.BeginIdx?
+                          NumInsts - CurSlice.BeginIdx : 0U;
+        if (SliceLen > size_t(S)) {
           // We need to split the current TB slice
           TBSlice TakenSlice = CurSlice.split(uint16_t(CurSlice.BeginIdx + S));
+          MemAcct.add(MemoryAccounting::T_BrokerQueue,
+                      int64_t(CurSlice.getMemorySize()) - OldSliceSize);
           TakenSlice.Region = nullptr;
+          InFlightTBs.insert(TBIdx);
           SelectedSlices.emplace_back(std::move(TakenSlice));
           S = 0;
         } else {
+          InFlightTBs.insert(TBIdx);
           SelectedSlices.emplace_back(std::move(CurSlice));
           TBQueue.erase(TBQueue.begin());
+          MemAcct.add(MemoryAccounting::T_BrokerQueue, -OldSliceSize);
           S -= SliceLen;
         }
       }
@@ -824,27 +1574,44 @@ QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
           MemAccessCat[TotalNumTraces] = std::move(MDA);
         }
       };
-    auto setRegionMarkerMD = [&,this](unsigned Idx, bool IsBegin) {
+    auto setRegionMarkerMD = [&,this](unsigned Idx, bool IsBegin,
+                                      StringRef Description) {
       if (MDE) {
-        auto &Registry = MDE->MDRegistry;
-        auto &IndexMap = MDE->IndexMap;
-        auto &MarkerCat = Registry[mcad::MD_BinaryRegionMarkers];
-
-        IndexMap[Idx] = TotalNumTraces;
-        RegionMarker Val
-          = IsBegin? RegionMarker::getBegin() : RegionMarker::getEnd();
-        if (auto MaybeVal = MarkerCat.get<mcad::RegionMarker>(TotalNumTraces))
-          MarkerCat[TotalNumTraces] = std::move(Val | *MaybeVal);
-        else
-          MarkerCat[TotalNumTraces] = std::move(Val);
+        MDE->IndexMap[Idx] = TotalNumTraces;
+        RegionMarker Val = IsBegin? RegionMarker::getBegin(Description)
+                                  : RegionMarker::getEnd(Description);
+        auto &Marker = MDE->TypedMD.RegionMarkers[TotalNumTraces];
+        Marker = Val | Marker;
       }
     };
+    auto setInstrAddrMD = [&,this](unsigned Idx, uint64_t Addr) {
+      if (MDE) {
+        MDE->IndexMap[Idx] = TotalNumTraces;
+        MDE->TypedMD.InstrAddrs[TotalNumTraces] = Addr;
+      }
+    };
+
+    if (ScratchMCInsts.size() < size_t(TotalSize))
+      ScratchMCInsts.resize(TotalSize);
+
+    if (SelectedSlices.size())
+      LastBatchTimestamps = SelectedSlices.front().Timestamps;
+    else
+      LastBatchTimestamps = llvm::None;
 
     std::lock_guard<std::mutex> LK(TBsMutex);
     for (auto &Slice : SelectedSlices) {
       size_t TBIdx = Slice.Index;
-      const auto &CurTB = TBs[TBIdx];
-      const auto &MCInsts = CurTB->MCInsts;
+      const TranslationBlock *CurTB = nullptr;
+      if (TBIdx < TBs.size() && TBs[TBIdx])
+        CurTB = TBs[TBIdx].getPointer();
+      // The TB might be gone, or have been retranslated but not
+      // executed yet
+      ArrayRef<const MCInst*> MCInsts;
+      if (CurTB && CurTB->Decoded) {
+        MCInsts = CurTB->Decoded->MCInsts;
+        InFlightBlocks.push_back(CurTB->Decoded);
+      }
       auto *MAs = Slice.MemoryAccesses;
       size_t MAIdx = 0U, NumMAs = 0U;
       if (MAs)
@@ -852,10 +1619,19 @@ QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
 
       size_t i, End = std::min(MCInsts.size(), size_t(Slice.EndIdx));
       assert(TotalSize >= Size);
-      for (i = Slice.BeginIdx; i != End && Size > 0; ++i, --Size) {
-        const auto *MCI = MCInsts[i].get();
+      for (i = Slice.BeginIdx; i < End && Size > 0; ++i, --Size) {
+        const auto *MCI = MCInsts[i];
+        if (!MCI) {
+          auto &Scratch = ScratchMCInsts[TotalSize - Size];
+          CurTB->Decoded->CompactInsts.decode(i, Scratch);
+          MCI = &Scratch;
+        }
         MCIS[TotalSize - Size] = MCI;
 
+        if (EnableInstrAddrMD)
+          setInstrAddrMD(TotalSize - Size,
+                         CurTB->VAddr + CurTB->Decoded->VAddrOffsets[i]);
+
         // Memory access metadata
         if (MAs && MAIdx != NumMAs) {
           if ((*MAs)[MAIdx].first == i)
@@ -864,24 +1640,59 @@ QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
         }
 
         // Region markers
-        if (CurTB->BeginMarks.test(i))
-          setRegionMarkerMD(TotalSize - Size, /*IsBegin=*/true);
-        if (CurTB->EndMarks.test(i))
-          setRegionMarkerMD(TotalSize - Size, /*IsBegin=*/false);
+        if (CurTB->BeginMarks.test(i) || CurTB->EndMarks.test(i)) {
+          StringRef Description;
+          if (const auto *Region = CurTB->MarkedRegions.lookup(i))
+            Description = Region->Description;
+          if (CurTB->BeginMarks.test(i))
+            setRegionMarkerMD(TotalSize - Size, /*IsBegin=*/true,
+                              Description);
+          if (CurTB->EndMarks.test(i))
+            setRegionMarkerMD(TotalSize - Size, /*IsBegin=*/false,
+                              Description);
+        }
 
         ++TotalNumTraces;
       }
       Slice.release();
+
+      if (Boundaries && Slice.Region)
+        Boundaries->emplace_back(unsigned(TotalSize - Size),
+                                 Slice.Region->Description);
     }
+    InFlightTBs.clear();
   }
 
-  if(SelectedSlices.size()) {
-    if (const auto *Region = SelectedSlices.back().Region)
-      // End of Region
-      return std::make_pair(TotalSize - Size,
-                            RegionDescriptor(true, Region->Description));
-  }
-  return std::make_pair(TotalSize - Size, RegionDescriptor(false));
+  if (SelectedSlices.size())
+    return std::make_pair(TotalSize - Size, SelectedSlices.back().Region);
+  return std::make_pair(TotalSize - Size, nullptr);
+}
+
+std::pair<int, Broker::RegionDescriptor>
+QemuBroker::fetchRegion(MutableArrayRef<const MCInst*> MCIS, int Size,
+                        Optional<MDExchanger> MDE) {
+  static Timer TheTimer("fetchRegion", "Fetching a region", Timers);
+  TimeRegion TR(TheTimer);
+
+  auto Res = fetchSlices(MCIS, Size, MDE, /*Boundaries=*/nullptr);
+  if (Res.first == FetchTimedOut)
+    return std::make_pair(FetchTimedOut, RegionDescriptor(false));
+  if (Res.first < 0)
+    return std::make_pair(-1, RegionDescriptor(true));
+  if (const auto *Region = Res.second)
+    // End of Region
+    return std::make_pair(Res.first,
+                          RegionDescriptor(true, Region->Description));
+  return std::make_pair(Res.first, RegionDescriptor(false));
+}
+
+int QemuBroker::fetchRegions(MutableArrayRef<const MCInst*> MCIS, int Size,
+                             SmallVectorImpl<RegionBoundary> &Boundaries,
+                             Optional<MDExchanger> MDE) {
+  static Timer TheTimer("fetchRegions", "Fetching multiple regions", Timers);
+  TimeRegion TR(TheTimer);
+
+  return fetchSlices(MCIS, Size, MDE, &Boundaries).first;
 }
 
 int QemuBroker::fetch(MutableArrayRef<const MCInst*> MCIS, int Size,
@@ -894,8 +1705,16 @@ QemuBroker::Options::Options()
     MaxNumConnections(1),
     BinaryRegionsManifestFile(),
     BinaryRegionsOpMode(qemu_broker::BinaryRegions::M_Trim),
+    SymbolCacheDir(),
+    GuestBinaryPath(),
     EnableMemoryAccessMD(true),
-    EnableTimer(false) {}
+    EnableInstrAddrMD(false),
+    EnableCompactMCInst(true),
+    UseIoUring(false),
+    EnableCompression(true),
+    EnableTimer(false),
+    AddressSpaces(),
+    KernelAddressSpace(false), UserAddressSpaces(false) {}
 
 QemuBroker::Options::Options(int argc, const char *const *argv)
   : QemuBroker::Options() {
@@ -938,15 +1757,60 @@ QemuBroker::Options::Options(int argc, const char *const *argv)
       }
     }
 
+    // Try to parse the symbol cache directory
+    if (Arg.startswith("-symbol-cache-dir") && Arg.contains('='))
+      SymbolCacheDir = Arg.split('=').second;
+
+    // Try to parse the path to the guest's main executable
+    if (Arg.startswith("-guest-binary") && Arg.contains('='))
+      GuestBinaryPath = Arg.split('=').second;
+
     // Try to parse the memory access metadata feature flag
     if (Arg.startswith("-disable-memory-access-md"))
       EnableMemoryAccessMD = false;
 
+    // Try to parse the instruction address metadata feature flag
+    if (Arg.startswith("-enable-instr-addr-md"))
+      EnableInstrAddrMD = true;
+
+    // Try to parse the flag that stores MCInst as-is
+    if (Arg.startswith("-disable-compact-mcinst"))
+      EnableCompactMCInst = false;
+
+    // Try to parse the flag that receives messages with io_uring
+    if (Arg.startswith("-use-io-uring"))
+      UseIoUring = true;
+
+    // Try to parse the flag that rejects compression from clients
+    if (Arg.startswith("-disable-compression"))
+      EnableCompression = false;
+
     // Try to parse the option that enables timer
     // Note that this flag is automatically appended
     // if `-enable-timer` is supplied on the `llvm-mcad` side
     if (Arg.startswith("-enable-timer"))
       EnableTimer = true;
+
+    // Try to parse the address spaces to analyze in system mode
+    if (Arg.startswith("-address-spaces") && Arg.contains('=')) {
+      SmallVector<StringRef, 4> Items;
+      Arg.split('=').second.split(Items, ',', /*MaxSplit=*/-1,
+                                  /*KeepEmpty=*/false);
+      for (StringRef Item : Items) {
+        Item = Item.trim();
+        uint64_t AddrSpace;
+        if (Item == "kernel")
+          KernelAddressSpace = true;
+        else if (Item == "user")
+          UserAddressSpaces = true;
+        else if (!Item.getAsInteger(0, AddrSpace))
+          AddressSpaces.push_back(AddrSpace);
+        else {
+          WithColor::error() << "Invalid address space: " << Item << "\n";
+          ::exit(1);
+        }
+      }
+    }
   }
 }
 
@@ -957,8 +1821,12 @@ mcadGetBrokerPluginInfo() {
     [](int argc, const char *const *argv, BrokerFacade &BF) {
       QemuBroker::Options BrokerOpts(argc, argv);
       BF.setBroker(std::make_unique<QemuBroker>(BrokerOpts,
-                                                BF.getSTI(), BF.getCtx(),
-                                                BF.getTarget()));
+                                                BF.getSTI(),
+                                                BF.getInstrInfo(),
+                                                BF.getCtx(),
+                                                BF.getTarget(),
+                                                BF.getMetrics(),
+                                                BF.getMemoryAccounting()));
     }
   };
 }
@@ -0,0 +1,73 @@
+#include "CompactMCInst.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/LEB128.h"
+
+using namespace llvm;
+using namespace mcad;
+using namespace qemu_broker;
+
+static inline uint64_t zigZagEncode(int64_t Val) {
+  return (uint64_t(Val) << 1) ^ uint64_t(Val >> 63);
+}
+
+static inline int64_t zigZagDecode(uint64_t Val) {
+  return int64_t(Val >> 1) ^ -int64_t(Val & 1);
+}
+
+bool CompactMCInsts::isEncodable(const MCInst &MCI) {
+  for (const MCOperand &MO : MCI) {
+    if (MO.isReg())
+      continue;
+    // We need one bit for the operand kind
+    if (MO.isImm() && !(zigZagEncode(MO.getImm()) >> 63))
+      continue;
+    return false;
+  }
+  return true;
+}
+
+void CompactMCInsts::append(const MCInst &MCI) {
+  assert(isEncodable(MCI) && "Unsupported operand kinds");
+  Offsets.push_back(Bytes.size());
+
+  uint8_t Buffer[16];
+  auto emit = [&,this](uint64_t Val) {
+    unsigned Len = encodeULEB128(Val, Buffer);
+    Bytes.append(Buffer, Buffer + Len);
+  };
+
+  unsigned Flags = MCI.getFlags();
+  emit(MCI.getOpcode());
+  emit((uint64_t(MCI.getNumOperands()) << 1) | (Flags? 1U : 0U));
+  if (Flags)
+    emit(Flags);
+  for (const MCOperand &MO : MCI) {
+    if (MO.isReg())
+      emit(uint64_t(MO.getReg()) << 1);
+    else
+      emit((zigZagEncode(MO.getImm()) << 1) | 1U);
+  }
+}
+
+void CompactMCInsts::decode(unsigned Idx, MCInst &MCI) const {
+  assert(Idx < Offsets.size() && isEncoded(Idx));
+  const uint8_t *Ptr = Bytes.data() + Offsets[Idx];
+  auto next = [&]() -> uint64_t {
+    unsigned Len;
+    uint64_t Val = decodeULEB128(Ptr, &Len);
+    Ptr += Len;
+    return Val;
+  };
+
+  MCI.clear();
+  MCI.setOpcode(unsigned(next()));
+  uint64_t Header = next();
+  MCI.setFlags(Header & 1U? unsigned(next()) : 0U);
+  for (unsigned i = 0U, NumOps = Header >> 1; i != NumOps; ++i) {
+    uint64_t Op = next();
+    if (Op & 1U)
+      MCI.addOperand(MCOperand::createImm(zigZagDecode(Op >> 1)));
+    else
+      MCI.addOperand(MCOperand::createReg(unsigned(Op >> 1)));
+  }
+}
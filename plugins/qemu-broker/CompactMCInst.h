@@ -0,0 +1,57 @@
+#ifndef LLVM_MCAD_QEMU_BROKER_COMPACTMCINST_H
+#define LLVM_MCAD_QEMU_BROKER_COMPACTMCINST_H
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+
+namespace llvm {
+class MCInst;
+
+namespace mcad {
+namespace qemu_broker {
+// A sequence of MCInst stored in a compact, variable-length encoding.
+// Each instruction is encoded as:
+//   ULEB128(Opcode)
+//   ULEB128(NumOperands << 1 | HasFlags)
+//   [ULEB128(Flags)]
+//   Operands...
+// Where every operand is a single ULEB128 value whose lowest bit tells
+// its kind: `Reg << 1` for a register, or `ZigZag(Imm) << 1 | 1` for
+// an immediate.
+//
+// A typical instruction only takes a handful of bytes, compared to
+// the >100 bytes taken by a heap-allocated MCInst.
+class CompactMCInsts {
+  SmallVector<uint8_t, 32> Bytes;
+  // Offset to the encoding of each instruction in Bytes
+  SmallVector<uint32_t, 8> Offsets;
+
+public:
+  // Whether MCI consists of only operand kinds we know how to encode
+  static bool isEncodable(const MCInst &MCI);
+
+  // Append MCI, which has to be encodable, to the end of this sequence
+  void append(const MCInst &MCI);
+  // Append an entry without any encoding. Useful for keeping the indicies
+  // in sync with instructions the caller decides to store by itself.
+  void appendEmpty() { Offsets.push_back(Bytes.size()); }
+
+  // Whether the Idx-th entry holds a valid encoding
+  bool isEncoded(unsigned Idx) const {
+    uint32_t End = Idx + 1 < Offsets.size()? Offsets[Idx + 1] : Bytes.size();
+    return End > Offsets[Idx];
+  }
+
+  // Expand the Idx-th instruction into MCI, which will be cleared
+  // first. So it's fine to reuse the same MCInst over and over again.
+  void decode(unsigned Idx, MCInst &MCI) const;
+
+  size_t size() const { return Offsets.size(); }
+
+  size_t getMemorySize() const {
+    return Bytes.capacity_in_bytes() + Offsets.capacity_in_bytes();
+  }
+};
+} // end namespace qemu_broker
+} // end namespace mcad
+} // end namespace llvm
+#endif
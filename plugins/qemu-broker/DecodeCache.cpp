@@ -0,0 +1,237 @@
+#include "DecodeCache.h"
+#include "llvm/ADT/Hashing.h"
+
+using namespace llvm;
+using namespace mcad;
+using namespace qemu_broker;
+
+size_t DecodedBlock::getMemorySize() const {
+  size_t Total = sizeof(DecodedBlock) +
+                 RawInsts.capacity_in_bytes() +
+                 MCInsts.capacity_in_bytes() +
+                 OwnedInsts.capacity_in_bytes() +
+                 OwnedInsts.size() * sizeof(MCInst) +
+                 CompactInsts.getMemorySize() +
+                 SkewIndicies.getMemorySize() +
+                 VAddrOffsets.capacity_in_bytes();
+  // Raw instructions that don't fit in the inline storage
+  for (const auto &RawInst : RawInsts)
+    if (RawInst.capacity() > 4)
+      Total += RawInst.capacity_in_bytes();
+  return Total;
+}
+
+static bool isSameBlock(const DecodedBlock &Block, unsigned ISAMode,
+                        uint64_t VAddr, ArrayRef<RawInstTy> RawInsts) {
+  return Block.ISAMode == ISAMode && Block.VAddr == VAddr &&
+         ArrayRef<RawInstTy>(Block.RawInsts) == RawInsts;
+}
+
+static hash_code hashInst(const MCInst &MCI) {
+  hash_code Hash = hash_combine(MCI.getOpcode(), MCI.getFlags(),
+                                MCI.getNumOperands());
+  for (const MCOperand &MO : MCI) {
+    if (MO.isReg())
+      Hash = hash_combine(Hash, MO.getReg());
+    else if (MO.isImm())
+      Hash = hash_combine(Hash, MO.getImm());
+    else if (MO.isSFPImm())
+      Hash = hash_combine(Hash, MO.getSFPImm());
+    else if (MO.isDFPImm())
+      Hash = hash_combine(Hash, MO.getDFPImm());
+    else if (MO.isExpr())
+      Hash = hash_combine(Hash, MO.getExpr());
+    else if (MO.isInst())
+      Hash = hash_combine(Hash, hashInst(*MO.getInst()));
+  }
+  return Hash;
+}
+
+static bool isIdenticalInst(const MCInst &LHS, const MCInst &RHS) {
+  if (LHS.getOpcode() != RHS.getOpcode() ||
+      LHS.getFlags() != RHS.getFlags() ||
+      LHS.getNumOperands() != RHS.getNumOperands())
+    return false;
+  for (unsigned i = 0U, E = LHS.getNumOperands(); i != E; ++i) {
+    const MCOperand &L = LHS.getOperand(i), &R = RHS.getOperand(i);
+    if (L.isReg() != R.isReg() || L.isImm() != R.isImm() ||
+        L.isSFPImm() != R.isSFPImm() || L.isDFPImm() != R.isDFPImm() ||
+        L.isExpr() != R.isExpr() || L.isInst() != R.isInst())
+      return false;
+    if ((L.isReg() && L.getReg() != R.getReg()) ||
+        (L.isImm() && L.getImm() != R.getImm()) ||
+        (L.isSFPImm() && L.getSFPImm() != R.getSFPImm()) ||
+        (L.isDFPImm() && L.getDFPImm() != R.getDFPImm()) ||
+        (L.isExpr() && L.getExpr() != R.getExpr()) ||
+        (L.isInst() && !isIdenticalInst(*L.getInst(), *R.getInst())))
+      return false;
+  }
+  return true;
+}
+
+DecodeCache::Table::Table(size_t NumBuckets)
+  : NumBuckets(NumBuckets), Buckets(new std::atomic<Node*>[NumBuckets]) {
+  for (size_t i = 0U; i != NumBuckets; ++i)
+    Buckets[i].store(nullptr, std::memory_order_relaxed);
+}
+
+DecodeCache::Table::~Table() {
+  for (size_t i = 0U; i != NumBuckets; ++i) {
+    Node *N = Buckets[i].load();
+    while (N) {
+      Node *Next = N->Next.load();
+      delete N;
+      N = Next;
+    }
+  }
+}
+
+DecodeCache::DecodeCache()
+  : CurTable(new Table(256)), NumReaders(0U),
+    NumEntries(0U), MemorySize(0U) {}
+
+DecodeCache::~DecodeCache() {
+  std::lock_guard<std::mutex> LK(WriteLock);
+  assert(!NumReaders && "Lookup in progress");
+  reclaim();
+  delete CurTable.load();
+}
+
+uint64_t DecodeCache::getKey(unsigned ISAMode, uint64_t VAddr,
+                             ArrayRef<RawInstTy> RawInsts) {
+  hash_code Hash = hash_combine(ISAMode, VAddr, RawInsts.size());
+  // Boundaries of raw instructions matter as well
+  for (const auto &RawInst : RawInsts)
+    Hash = hash_combine(Hash, hash_combine_range(RawInst.begin(),
+                                                 RawInst.end()));
+  return uint64_t(size_t(Hash));
+}
+
+DecodeCache::EntryTy
+DecodeCache::lookup(unsigned ISAMode, uint64_t VAddr,
+                    ArrayRef<RawInstTy> RawInsts) const {
+  uint64_t Key = getKey(ISAMode, VAddr, RawInsts);
+  // Writers won't free anything we might see from now on. Note that
+  // this has to happen before we load the table.
+  NumReaders.fetch_add(1U);
+  EntryTy Result;
+  for (Node *N = CurTable.load()->getBucket(Key).load(); N;
+       N = N->Next.load())
+    if (N->Key == Key && isSameBlock(*N->Block, ISAMode, VAddr, RawInsts)) {
+      Result = N->Block;
+      break;
+    }
+  NumReaders.fetch_sub(1U);
+  return Result;
+}
+
+DecodeCache::EntryTy DecodeCache::insert(std::unique_ptr<DecodedBlock> Block) {
+  uint64_t Key = getKey(Block->ISAMode, Block->VAddr, Block->RawInsts);
+  std::lock_guard<std::mutex> LK(WriteLock);
+  auto &Bucket = CurTable.load()->getBucket(Key);
+  for (Node *N = Bucket.load(); N; N = N->Next.load())
+    if (N->Key == Key &&
+        isSameBlock(*N->Block, Block->ISAMode, Block->VAddr, Block->RawInsts))
+      return N->Block;
+
+  MemorySize += Block->getMemorySize();
+  EntryTy Entry(std::move(Block));
+  // Readers either see the old head or the fully constructed node
+  Bucket.store(new Node(Key, Entry, Bucket.load()));
+  if (++NumEntries > CurTable.load()->NumBuckets)
+    grow();
+  reclaim();
+  return Entry;
+}
+
+void DecodeCache::grow() {
+  Table *OldTable = CurTable.load();
+  auto *NewTable = new Table(OldTable->NumBuckets * 2U);
+  for (size_t i = 0U; i != OldTable->NumBuckets; ++i)
+    for (Node *N = OldTable->Buckets[i].load(); N; N = N->Next.load()) {
+      auto &Bucket = NewTable->getBucket(N->Key);
+      Bucket.store(new Node(N->Key, N->Block, Bucket.load()));
+    }
+  CurTable.store(NewTable);
+  // Readers might still be walking through the old table
+  RetiredTables.push_back(OldTable);
+}
+
+const MCInst *DecodeCache::pinInst(const MCInst &MCI) {
+  uint64_t Key = uint64_t(size_t(hashInst(MCI)));
+  std::lock_guard<std::mutex> LK(WriteLock);
+  auto &Pinned = PinnedInsts[Key];
+  for (const auto &Inst : Pinned)
+    if (isIdenticalInst(*Inst, MCI))
+      return Inst.get();
+
+  MemorySize += sizeof(MCInst);
+  Pinned.emplace_back(std::make_unique<MCInst>(MCI));
+  return Pinned.back().get();
+}
+
+size_t DecodeCache::unlink(std::atomic<Node*> &Link, Node *N) {
+  size_t Size = N->Block->getMemorySize();
+  // Readers that are currently on N can still move past it
+  Link.store(N->Next.load());
+  RetiredNodes.push_back(N);
+  --NumEntries;
+  MemorySize -= Size;
+  return Size;
+}
+
+void DecodeCache::reclaim() {
+  // Anyone who starts reading after this point can't see any of the
+  // retired nodes or tables.
+  if (NumReaders.load())
+    return;
+  for (Node *N : RetiredNodes)
+    delete N;
+  RetiredNodes.clear();
+  for (Table *T : RetiredTables)
+    delete T;
+  RetiredTables.clear();
+}
+
+size_t DecodeCache::release(EntryTy Block) {
+  if (!Block)
+    return 0U;
+  uint64_t Key = getKey(Block->ISAMode, Block->VAddr, Block->RawInsts);
+  std::lock_guard<std::mutex> LK(WriteLock);
+  reclaim();
+  // Nobody but us and the cache holds it. Nodes in retired tables hold
+  // it as well, in which case we leave it to a later prune.
+  // A lookup racing with us might still pick it up, in which case it
+  // stays valid but is no longer shared.
+  if (Block.use_count() != 2)
+    return 0U;
+
+  std::atomic<Node*> *Link = &CurTable.load()->getBucket(Key);
+  for (Node *N = Link->load(); N; Link = &N->Next, N = Link->load())
+    if (N->Block == Block) {
+      size_t Freed = unlink(*Link, N);
+      reclaim();
+      return Freed;
+    }
+  return 0U;
+}
+
+size_t DecodeCache::prune() {
+  std::lock_guard<std::mutex> LK(WriteLock);
+  // Release the old copies first s.t. they don't keep the blocks alive
+  reclaim();
+
+  size_t Freed = 0U;
+  Table *T = CurTable.load();
+  for (size_t i = 0U; i != T->NumBuckets; ++i) {
+    std::atomic<Node*> *Link = &T->Buckets[i];
+    while (Node *N = Link->load()) {
+      if (N->Block.use_count() == 1)
+        Freed += unlink(*Link, N);
+      else
+        Link = &N->Next;
+    }
+  }
+  reclaim();
+  return Freed;
+}
@@ -0,0 +1,152 @@
+#ifndef LLVM_MCAD_QEMU_BROKER_DECODECACHE_H
+#define LLVM_MCAD_QEMU_BROKER_DECODECACHE_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/MC/MCInst.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CompactMCInst.h"
+
+namespace llvm {
+namespace mcad {
+namespace qemu_broker {
+using RawInstTy = SmallVector<uint8_t, 4>;
+
+// Everything disassembled from the raw instructions of a TB. It's
+// immutable once it's put into DecodeCache, so it can be shared by
+// TBs of different clients and read without any lock.
+// Note that we cannot use SmallVector<MCInst,...> to store MCInsts
+// because when SmallVector resizes all MCInst* retrieved previously will
+// be invalid.
+struct DecodedBlock {
+  // What the block is decoded from
+  unsigned ISAMode;
+  uint64_t VAddr;
+  SmallVector<RawInstTy, 8> RawInsts;
+
+  // An entry is null if the instruction is stored in CompactInsts instead.
+  // Otherwise it points to either OwnedInsts or an instruction pinned by
+  // DecodeCache::pinInst.
+  SmallVector<const MCInst*, 8> MCInsts;
+  SmallVector<std::unique_ptr<MCInst>, 4> OwnedInsts;
+  // Compactly encoded MCInsts, which are only expanded when being fetched.
+  // Either empty or having the same number of entries as MCInsts.
+  CompactMCInsts CompactInsts;
+  // If the size of RawInsts and MCInsts don't match (e.g. A single raw
+  // instruction is disassembled into multiple MCInst), this maps from the
+  // RawInsts index to MCInsts index.
+  DenseMap<unsigned, unsigned> SkewIndicies;
+  // Address offsets to each MCInst in this block
+  SmallVector<uint8_t, 8> VAddrOffsets;
+
+  DecodedBlock(unsigned ISAMode, uint64_t VAddr,
+               ArrayRef<RawInstTy> RawInsts)
+    : ISAMode(ISAMode), VAddr(VAddr),
+      RawInsts(RawInsts.begin(), RawInsts.end()) {}
+
+  size_t getMemorySize() const;
+};
+
+// Decoded blocks keyed by ISA mode, start address, and the hash of raw
+// instructions. Clients running the same binary, as well as TBs that are
+// retranslated, end up sharing the same blocks s.t. each unique piece
+// of code is only disassembled and stored once.
+//
+// Lookups don't take any lock: the table is a fixed number of buckets,
+// each of them a chain of immutable nodes, which are only linked and
+// unlinked by writers holding WriteLock. Unlinked nodes, as well as the
+// old table after growing, are only freed once no lookup is in progress.
+class DecodeCache {
+public:
+  using EntryTy = std::shared_ptr<const DecodedBlock>;
+
+private:
+  struct Node {
+    const uint64_t Key;
+    const EntryTy Block;
+    // The only thing that changes after being published, when the node
+    // after this one is unlinked.
+    std::atomic<Node*> Next;
+
+    Node(uint64_t Key, EntryTy Block, Node *Next)
+      : Key(Key), Block(std::move(Block)), Next(Next) {}
+  };
+
+  struct Table {
+    // Always a power of two
+    const size_t NumBuckets;
+    std::unique_ptr<std::atomic<Node*>[]> Buckets;
+
+    explicit Table(size_t NumBuckets);
+    // Also frees all the nodes that are still linked
+    ~Table();
+
+    std::atomic<Node*> &getBucket(uint64_t Key) const {
+      return Buckets[Key & (NumBuckets - 1)];
+    }
+  };
+
+  std::atomic<Table*> CurTable;
+  // Number of lookups in progress
+  mutable std::atomic<unsigned> NumReaders;
+
+  // Guards modifications of the table as well as everything below
+  std::mutex WriteLock;
+  // Waiting to be freed until nobody is reading
+  std::vector<Node*> RetiredNodes;
+  std::vector<Table*> RetiredTables;
+  // Instructions pinned by pinInst, keyed by their hash
+  DenseMap<uint64_t, SmallVector<std::unique_ptr<MCInst>, 1>> PinnedInsts;
+
+  std::atomic<size_t> NumEntries;
+  std::atomic<size_t> MemorySize;
+
+  static uint64_t getKey(unsigned ISAMode, uint64_t VAddr,
+                         ArrayRef<RawInstTy> RawInsts);
+
+  // The following functions must be called with WriteLock held.
+  void grow();
+  // Unlink N, which is currently pointed to by Link
+  size_t unlink(std::atomic<Node*> &Link, Node *N);
+  // Free retired nodes and tables if nobody is reading
+  void reclaim();
+
+public:
+  DecodeCache();
+  ~DecodeCache();
+
+  // Return null if no block is decoded from the same instructions
+  EntryTy lookup(unsigned ISAMode, uint64_t VAddr,
+                 ArrayRef<RawInstTy> RawInsts) const;
+
+  // Return the block in the cache, which might not be Block if an
+  // identical one has been inserted in the meantime.
+  EntryTy insert(std::unique_ptr<DecodedBlock> Block);
+
+  // Return a copy of MCI that lives as long as this cache. It's
+  // for instructions whose descriptors are cached by InstrBuilder using
+  // the address of their MCInst, which would dangle if we freed it
+  // with its block. Identical instructions share the same copy.
+  const MCInst *pinInst(const MCInst &MCI);
+
+  // Drop our reference to Block, and drop it from the cache as well
+  // if no TB is using it anymore. Return the number of bytes freed.
+  size_t release(EntryTy Block);
+
+  // Drop all the blocks that are not used by any TB. Return the
+  // number of bytes freed.
+  size_t prune();
+
+  size_t size() const { return NumEntries; }
+  size_t getMemorySize() const { return MemorySize; }
+};
+} // end namespace qemu_broker
+} // end namespace mcad
+} // end namespace llvm
+#endif
@@ -0,0 +1,108 @@
+#include "GuestBinary.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Object/Binary.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <system_error>
+
+using namespace llvm;
+using namespace mcad;
+using namespace qemu_broker;
+
+GuestBinary::~GuestBinary() {}
+
+std::string GuestBinary::getBuildID(const object::ELFObjectFileBase &ELFObj) {
+  for (const object::SectionRef &Section : ELFObj.sections()) {
+    auto MaybeName = llvm::expectedToOptional(Section.getName());
+    if (!MaybeName || *MaybeName != ".note.gnu.build-id")
+      continue;
+    auto MaybeContents = llvm::expectedToOptional(Section.getContents());
+    if (!MaybeContents)
+      break;
+
+    // Note header: namesz, descsz, and type. Followed by the
+    // (4-byte aligned) name and descriptor.
+    StringRef Contents = *MaybeContents;
+    if (Contents.size() < 12)
+      break;
+    auto read32 = [&](size_t Offset) -> uint32_t {
+      return ELFObj.isLittleEndian()?
+             support::endian::read32le(Contents.data() + Offset) :
+             support::endian::read32be(Contents.data() + Offset);
+    };
+    uint32_t NameSize = read32(0), DescSize = read32(4);
+    size_t DescOffset = 12 + alignTo(NameSize, 4);
+    if (DescOffset + DescSize > Contents.size())
+      break;
+    return toHex(Contents.substr(DescOffset, DescSize), /*LowerCase=*/true);
+  }
+  return "";
+}
+
+Expected<std::unique_ptr<GuestBinary>> GuestBinary::create(StringRef Path) {
+  // Never copy the file into memory, it might be huge
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!ErrOrBuffer)
+    return llvm::errorCodeToError(ErrOrBuffer.getError());
+
+  std::unique_ptr<GuestBinary> GB(new GuestBinary());
+  GB->Buffer = std::move(*ErrOrBuffer);
+
+  auto BinaryOrErr = object::createBinary(GB->Buffer->getMemBufferRef());
+  if (!BinaryOrErr)
+    return BinaryOrErr.takeError();
+  const auto *ELFObj = dyn_cast<object::ELFObjectFileBase>(BinaryOrErr->get());
+  if (!ELFObj)
+    return llvm::createStringError(std::errc::invalid_argument,
+                                   "Unsupported binary format. "
+                                   "Only ELF is supported right now");
+
+  for (const object::SectionRef &Section : ELFObj->sections()) {
+    if (!Section.isText() || Section.isVirtual())
+      continue;
+    auto ContentsOrErr = Section.getContents();
+    if (!ContentsOrErr)
+      return ContentsOrErr.takeError();
+    // Contents point into Buffer, which outlives the object file
+    GB->CodeSections.push_back({Section.getAddress(), *ContentsOrErr});
+  }
+  llvm::sort(GB->CodeSections,
+             [](const CodeSection &LHS, const CodeSection &RHS) {
+               return LHS.Addr < RHS.Addr;
+             });
+
+  // Hash the per-section hashes and addresses rather than using
+  // hash_combine, whose results can differ between the relay and MCAD.
+  SmallVector<uint64_t, 8> SectionHashes;
+  for (const auto &CS : GB->CodeSections) {
+    SectionHashes.push_back(support::endian::byte_swap<uint64_t>(
+                              CS.Addr, support::little));
+    SectionHashes.push_back(support::endian::byte_swap<uint64_t>(
+                              xxHash64(CS.Contents), support::little));
+  }
+  GB->CodeHash = xxHash64(StringRef(
+    reinterpret_cast<const char*>(SectionHashes.data()),
+    SectionHashes.size() * sizeof(uint64_t)));
+
+  GB->BuildID = getBuildID(*ELFObj);
+  return std::move(GB);
+}
+
+ArrayRef<uint8_t> GuestBinary::getCode(uint64_t Addr, size_t Size) const {
+  // Find the last section starting at or before Addr
+  auto It = llvm::upper_bound(CodeSections, Addr,
+                              [](uint64_t Addr, const CodeSection &CS) {
+                                return Addr < CS.Addr;
+                              });
+  if (It == CodeSections.begin())
+    return llvm::None;
+  const auto &CS = *std::prev(It);
+  uint64_t Offset = Addr - CS.Addr;
+  if (Offset + Size > CS.Contents.size())
+    return llvm::None;
+  return arrayRefFromStringRef(CS.Contents.substr(Offset, Size));
+}
@@ -0,0 +1,64 @@
+#ifndef LLVM_MCAD_QEMU_BROKER_GUESTBINARY_H
+#define LLVM_MCAD_QEMU_BROKER_GUESTBINARY_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm {
+// Forward declarations
+class MemoryBuffer;
+namespace object {
+class ELFObjectFileBase;
+}
+
+namespace mcad {
+namespace qemu_broker {
+// Executable code of the guest's main binary, memory-mapped from the
+// ELF file on disk.
+//
+// Both the relay and the broker use this to agree on instructions that
+// are backed by the file, such that only their addresses and sizes need
+// to go through the wire.
+class GuestBinary {
+  std::unique_ptr<MemoryBuffer> Buffer;
+
+  struct CodeSection {
+    // Address in the ELF file, not the one in guest's memory
+    uint64_t Addr;
+    StringRef Contents;
+  };
+  // Sorted by address
+  SmallVector<CodeSection, 4> CodeSections;
+
+  std::string BuildID;
+
+  uint64_t CodeHash = 0U;
+
+  GuestBinary() = default;
+
+public:
+  static Expected<std::unique_ptr<GuestBinary>> create(StringRef Path);
+
+  ~GuestBinary();
+
+  // Return the hex string of GNU build ID or empty string if there is none.
+  static std::string getBuildID(const object::ELFObjectFileBase &ELFObj);
+
+  StringRef getBuildID() const { return BuildID; }
+
+  // Return a hash of every code section and its address, which tells
+  // files apart when they don't have a build ID.
+  uint64_t getCodeHash() const { return CodeHash; }
+
+  // Return Size bytes of code at Addr, which is an address in the ELF
+  // file, or an empty array if it's not entirely inside a code section.
+  ArrayRef<uint8_t> getCode(uint64_t Addr, size_t Size) const;
+};
+} // end namespace qemu_broker
+} // end namespace mcad
+} // end namespace llvm
+#endif
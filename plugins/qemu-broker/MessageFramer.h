@@ -0,0 +1,77 @@
+#ifndef LLVM_MCAD_QEMU_BROKER_MESSAGEFRAMER_H
+#define LLVM_MCAD_QEMU_BROKER_MESSAGEFRAMER_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "flatbuffers/flatbuffers.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace llvm {
+namespace mcad {
+namespace qemu_broker {
+// Split a stream of bytes, which comes in arbitrary chunks, into
+// size-prefixed flatbuffers messages.
+// Messages lying entirely inside a chunk are handed out in place. Only
+// those straddling chunks are copied.
+class MessageFramer {
+  using SizeTy = flatbuffers::uoffset_t;
+  // Message that is not complete yet, including its size prefix
+  SmallVector<uint8_t, 1024> Partial;
+
+public:
+  // Call Handle, a callable with signature `bool(ArrayRef<uint8_t>)`, on
+  // every complete message -- including its size prefix -- in Data.
+  // Return false if any of the Handle calls returns false.
+  template <class HandlerT>
+  bool feed(ArrayRef<uint8_t> Data, HandlerT &&Handle) {
+    while (!Data.empty()) {
+      if (!Partial.empty()) {
+        // Read the size prefix first
+        if (Partial.size() < sizeof(SizeTy)) {
+          size_t Len = std::min(sizeof(SizeTy) - Partial.size(),
+                                Data.size());
+          Partial.append(Data.begin(), Data.begin() + Len);
+          Data = Data.drop_front(Len);
+          if (Partial.size() < sizeof(SizeTy))
+            break;
+        }
+
+        size_t MsgSize =
+          sizeof(SizeTy) + flatbuffers::ReadScalar<SizeTy>(Partial.data());
+        size_t Len = std::min(MsgSize - Partial.size(), Data.size());
+        Partial.append(Data.begin(), Data.begin() + Len);
+        Data = Data.drop_front(Len);
+        if (Partial.size() < MsgSize)
+          break;
+
+        if (!Handle(ArrayRef<uint8_t>(Partial)))
+          return false;
+        Partial.clear();
+        continue;
+      }
+
+      if (Data.size() < sizeof(SizeTy)) {
+        Partial.append(Data.begin(), Data.end());
+        break;
+      }
+      size_t MsgSize =
+        sizeof(SizeTy) + flatbuffers::ReadScalar<SizeTy>(Data.data());
+      if (Data.size() < MsgSize) {
+        Partial.append(Data.begin(), Data.end());
+        break;
+      }
+
+      if (!Handle(Data.take_front(MsgSize)))
+        return false;
+      Data = Data.drop_front(MsgSize);
+    }
+    return true;
+  }
+
+  // Whether there is no incomplete message left
+  bool empty() const { return Partial.empty(); }
+};
+} // end namespace qemu_broker
+} // end namespace mcad
+} // end namespace llvm
+#endif
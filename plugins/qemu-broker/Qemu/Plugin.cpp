@@ -1,14 +1,29 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/WithColor.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "GuestBinary.h"
 #include "Serialization/mcad_generated.h"
 extern "C" {
 #include "qemu/qemu-plugin.h"
@@ -41,8 +56,73 @@ static cl::opt<bool>
                                           "are part of the main executable"),
                cl::init(false), cl::Hidden);
 
+static cl::opt<std::string>
+  RegionResultsFile("region-results",
+                    cl::desc("File, or a FIFO, to write the results of "
+                             "every region sent back by MCAD to. One JSON "
+                             "object per line"),
+                    cl::init(""));
+
+static cl::opt<bool>
+  Compress("compress",
+           cl::desc("Compress messages sent to MCAD with zlib, "
+                    "if MCAD accepts it"),
+           cl::init(false));
+
+static cl::opt<unsigned>
+  CompressionBatchSize("compression-batch-size",
+                       cl::desc("Number of bytes of messages to "
+                                "compress together"),
+                       cl::init(16U * 1024U));
+
+static cl::opt<std::string>
+  GuestBinaryPath("guest-binary",
+                  cl::desc("Path to the main executable of the guest. "
+                           "Only addresses and sizes are sent for "
+                           "instructions that can be read from it, if "
+                           "MCAD has the same file"),
+                  cl::init(""));
+
+static cl::opt<std::string>
+  RecordStreamPath("record-stream",
+                   cl::desc("Also write every message sent to MCAD, "
+                            "uncompressed, to this file. It can be replayed "
+                            "by mcad-perf-harness"),
+                   cl::init(""));
+
+static cl::opt<bool>
+  DedupTBs("dedup-tbs",
+           cl::desc("Reuse the TB sent before for retranslated code "
+                    "with identical content"),
+           cl::init(true));
+
+static cl::opt<bool>
+  AddressSpaceStats("address-space-stats",
+                    cl::desc("Count the TBs executed in every address "
+                             "space and print the busiest ones upon exit. "
+                             "Only for full-system emulation"),
+                    cl::init(false));
+
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
+using RegionResultCallbackTy = void (*)(const char *Description,
+                                        uint64_t NumInstructions,
+                                        uint64_t NumCycles,
+                                        uint64_t NumMicroOps,
+                                        void *Data);
+static RegionResultCallbackTy RegionResultCallback = nullptr;
+static void *RegionResultCallbackData = nullptr;
+
+/// Let other QEMU plugins (e.g. one that talks to the guest) receive
+/// results of every region analyzed by MCAD. It has to be called before
+/// the first TB is translated.
+extern "C" QEMU_PLUGIN_EXPORT
+void mcad_relay_set_region_result_callback(RegionResultCallbackTy CB,
+                                           void *Data) {
+  RegionResultCallback = CB;
+  RegionResultCallbackData = Data;
+}
+
 static StringRef CurrentQemuTarget;
 
 namespace {
@@ -57,6 +137,171 @@ std::unordered_map<const char*, RegisterInfo> RegInfoRegistry;
 
 static int RemoteSockt = -1;
 
+/// === Message sending ===
+
+// Whether compression is accepted by MCAD
+static bool UseCompression = false;
+// Messages waiting to be compressed
+static SmallVector<char, 0> PendingBatch;
+static std::chrono::steady_clock::time_point LastBatchFlush;
+// Don't hold messages longer than this, as long as the guest is running
+static constexpr std::chrono::milliseconds MaxBatchDelay(10);
+
+static struct {
+  uint64_t UncompressedBytes = 0U;
+  uint64_t CompressedBytes = 0U;
+  std::chrono::nanoseconds Time{0};
+} CompressionStats;
+
+static void flushBatch() {
+  using namespace mcad;
+  if (PendingBatch.empty())
+    return;
+
+  auto StartTime = std::chrono::steady_clock::now();
+  SmallVector<char, 0> Compressed;
+  if (auto E = zlib::compress(StringRef(PendingBatch.data(),
+                                        PendingBatch.size()),
+                              Compressed, zlib::BestSpeedCompression)) {
+    logAllUnhandledErrors(std::move(E), WithColor::error()
+                                        << "Failed to compress messages: ");
+    PendingBatch.clear();
+    return;
+  }
+  LastBatchFlush = std::chrono::steady_clock::now();
+  CompressionStats.Time += LastBatchFlush - StartTime;
+  CompressionStats.UncompressedBytes += PendingBatch.size();
+  CompressionStats.CompressedBytes += Compressed.size();
+
+  flatbuffers::FlatBufferBuilder Builder(Compressed.size() + 64U);
+  auto FbData = Builder.CreateVector(
+    reinterpret_cast<const uint8_t*>(Compressed.data()), Compressed.size());
+  auto FbBatch = fbs::CreateCompressedBatch(Builder, PendingBatch.size(),
+                                            FbData);
+  auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_CompressedBatch,
+                                      FbBatch.Union());
+  fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+  PendingBatch.clear();
+
+  int NumBytesSent = write(RemoteSockt,
+                           Builder.GetBufferPointer(), Builder.GetSize());
+  if (NumBytesSent < 0) {
+    ::perror("Failed to send compressed messages");
+  }
+}
+
+// Copy of the messages sent, if -record-stream is given
+static std::unique_ptr<raw_fd_ostream> RecordStream;
+
+// Send, or put into the batch to be compressed, a finished message
+static int sendMessage(ArrayRef<uint8_t> Message) {
+  if (RecordStream)
+    RecordStream->write(reinterpret_cast<const char*>(Message.data()),
+                        Message.size());
+
+  if (!UseCompression)
+    return write(RemoteSockt, Message.data(), Message.size());
+
+  const char *Data = reinterpret_cast<const char*>(Message.data());
+  PendingBatch.append(Data, Data + Message.size());
+  if (PendingBatch.size() >= CompressionBatchSize ||
+      std::chrono::steady_clock::now() - LastBatchFlush >= MaxBatchDelay)
+    flushBatch();
+  return Message.size();
+}
+
+static int sendMessage(const flatbuffers::FlatBufferBuilder &Builder) {
+  return sendMessage(makeArrayRef(Builder.GetBufferPointer(),
+                                  Builder.GetSize()));
+}
+
+// The starting address of the currently loaded binary
+// TODO: What about end address?
+static llvm::Optional<uint64_t> CodeStartAddr;
+
+// Main executable of the guest, if it's provided
+static std::unique_ptr<mcad::qemu_broker::GuestBinary> TheGuestBinary;
+// Whether MCAD can read instructions from the same executable. It's
+// turned off by the receiver thread once MCAD fails to read a TB.
+static std::atomic<bool> UseFileBackedTBs(false);
+static size_t NumFileBackedTBs = 0U;
+
+namespace {
+// A file-backed TB sent back by MCAD since it couldn't read it
+struct ResendRequest {
+  uint32_t Index;
+  uint64_t PC;
+  SmallVector<uint8_t, 16> InstSizes;
+};
+} // end anonymous namespace
+
+// Filled by the receiver thread and drained by the thread running the
+// guest, which is the only one sending messages.
+static std::mutex ResendMutex;
+static std::vector<ResendRequest> ResendRequests;
+static std::atomic<bool> HasResendRequests(false);
+static size_t NumResentTBs = 0U;
+
+static void requestResend(const mcad::fbs::TranslatedBlock &TB) {
+  if (UseFileBackedTBs.exchange(false))
+    WithColor::warning() << "MCAD can't read instructions from "
+                         << GuestBinaryPath << ", sending them in full "
+                         << "from now on\n";
+
+  ResendRequest Request{TB.Index(), TB.PC(), {}};
+  if (const auto *InstSizes = TB.InstSizes())
+    Request.InstSizes.assign(InstSizes->begin(), InstSizes->end());
+  std::lock_guard<std::mutex> LK(ResendMutex);
+  ResendRequests.push_back(std::move(Request));
+  HasResendRequests = true;
+}
+
+// Send the TBs MCAD asked for again, with their instruction bytes
+static void resendTBs() {
+  using namespace mcad;
+  std::vector<ResendRequest> Requests;
+  {
+    std::lock_guard<std::mutex> LK(ResendMutex);
+    Requests.swap(ResendRequests);
+    HasResendRequests = false;
+  }
+
+  for (const auto &Request : Requests) {
+    flatbuffers::FlatBufferBuilder Builder(256);
+    std::vector<flatbuffers::Offset<fbs::Inst>> FbInsts;
+    bool IsValid = TheGuestBinary && CodeStartAddr &&
+                   Request.PC >= *CodeStartAddr;
+    uint64_t Addr = IsValid? Request.PC - *CodeStartAddr : 0U;
+    for (uint8_t Size : Request.InstSizes) {
+      if (!IsValid)
+        break;
+      // We've checked these bytes against the guest's memory when the
+      // TB was translated
+      auto InstBytes = TheGuestBinary->getCode(Addr, Size);
+      IsValid = InstBytes.size() == Size;
+      auto InstData = Builder.CreateVector(InstBytes.data(),
+                                           InstBytes.size());
+      FbInsts.push_back(fbs::CreateInst(Builder, InstData));
+      Addr += Size;
+    }
+    if (!IsValid || FbInsts.empty()) {
+      WithColor::error() << "Can't resend TB " << Request.Index << "\n";
+      continue;
+    }
+
+    auto FbTB = fbs::CreateTranslatedBlock(Builder, Request.Index,
+                                           Builder.CreateVector(FbInsts));
+    auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_TranslatedBlock,
+                                        FbTB.Union());
+    fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+    if (sendMessage(Builder) < 0) {
+      ::perror("Failed to resend TB data");
+      continue;
+    }
+    ++NumResentTBs;
+  }
+}
+
 static size_t NumTranslationBlock = 0U;
 #ifndef NDEBUG
 static SmallVector<size_t, 8> TBNumInsts;
@@ -76,12 +321,18 @@ struct ExecTransBlock {
 
   uint32_t TBIdx = 0U;
   uint64_t PC = 0U;
+  // Host monotonic time in nanoseconds
+  uint64_t Timestamp = 0U;
   SmallVector<MemAccess, 2> MemAccesses;
+  // Executed outside the selected address spaces, so it's not sent
+  bool Filtered = false;
 
   void reset() {
     MemAccesses.clear();
     TBIdx = 0U;
     PC = 0U;
+    Timestamp = 0U;
+    Filtered = false;
   }
 };
 } // end anonymous namespace
@@ -92,6 +343,10 @@ static inline void flushPreviousTBExec() {
   using namespace mcad;
   if (!CurrentExecTB)
     return;
+  if (CurrentExecTB->Filtered) {
+    CurrentExecTB->reset();
+    return;
+  }
 
   flatbuffers::FlatBufferBuilder Builder(128);
   flatbuffers::Offset<flatbuffers::Vector<const fbs::MemoryAccess*>> MAV;
@@ -106,6 +361,7 @@ static inline void flushPreviousTBExec() {
   fbs::ExecTBBuilder ETB(Builder);
   ETB.add_Index(CurrentExecTB->TBIdx);
   ETB.add_PC(CurrentExecTB->PC);
+  ETB.add_Timestamp(CurrentExecTB->Timestamp);
   if (CurrentExecTB->MemAccesses.size())
     ETB.add_MemAccesses(MAV);
   auto FbExecTB = ETB.Finish();
@@ -113,8 +369,7 @@ static inline void flushPreviousTBExec() {
                                       FbExecTB.Union());
   fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
 
-  int NumBytesSent = write(RemoteSockt,
-                           Builder.GetBufferPointer(), Builder.GetSize());
+  int NumBytesSent = sendMessage(Builder);
   if (NumBytesSent < 0) {
     ::perror("Failed to send TB exec");
   }
@@ -123,14 +378,82 @@ static inline void flushPreviousTBExec() {
   CurrentExecTB->reset();
 }
 
+/// === Address space filtering (system mode) ===
+
+// Whether QEMU emulates a full system rather than a single process
+static bool SystemMode = false;
+// Filter replied by MCAD. If it's disabled, every TB is sent right
+// after it's translated.
+static bool FilterAddressSpaces = false;
+static bool SelectKernelCode = false, SelectUserCode = false;
+static DenseSet<uint64_t> SelectedAddressSpaces;
+
+// The same TB can be executed in different address spaces (e.g. kernel
+// code, or user code on physical pages shared by several processes), so
+// TBs are only sent upon their first execution in a selected address
+// space. Indexed by TB index.
+static DenseMap<uint32_t, std::vector<uint8_t>> DeferredTBs;
+
+// Number of TBs executed in each user address space, and in the kernel,
+// for users to find out the address spaces they're interested in.
+// Only counted with -address-space-stats.
+static DenseMap<uint64_t, uint64_t> AddressSpaceExecCounts;
+static uint64_t KernelExecCount = 0U;
+static uint64_t NumFilteredTBExecs = 0U;
+
+static bool isInSelectedAddressSpace() {
+  // Don't even read the address space if nobody needs it
+  if (!FilterAddressSpaces && !AddressSpaceStats)
+    return true;
+
+  uint64_t AddrSpace;
+  bool Privileged;
+  if (!qemu_plugin_vcpu_address_space(&AddrSpace, &Privileged))
+    // e.g. MMU is not enabled yet
+    return true;
+
+  if (AddressSpaceStats) {
+    if (Privileged)
+      ++KernelExecCount;
+    else
+      ++AddressSpaceExecCounts[AddrSpace];
+  }
+
+  if (!FilterAddressSpaces)
+    return true;
+  if (Privileged)
+    return SelectKernelCode;
+  return SelectUserCode || SelectedAddressSpaces.count(AddrSpace);
+}
+
+static void sendDeferredTB(uint32_t TBIdx) {
+  auto It = DeferredTBs.find(TBIdx);
+  if (It == DeferredTBs.end())
+    return;
+  if (sendMessage(It->second) < 0)
+    ::perror("Failed to send TB data");
+  DeferredTBs.erase(It);
+}
+
 static void tbExecCallback(unsigned int CPUId, void *Data) {
   using namespace mcad;
 
   flushPreviousTBExec();
   if (!CurrentExecTB)
     CurrentExecTB = ExecTransBlock();
+  // MCAD needs them before they're executed again
+  if (HasResendRequests)
+    resendTBs();
 
   auto TBIdx = (size_t)Data;
+  if (SystemMode) {
+    if (!isInSelectedAddressSpace()) {
+      CurrentExecTB->Filtered = true;
+      ++NumFilteredTBExecs;
+      return;
+    }
+    sendDeferredTB(TBIdx);
+  }
 #ifndef NDEBUG
   if (TBIdx < TBNumInsts.size())
     NumExecInsts += TBNumInsts[TBIdx];
@@ -164,11 +487,18 @@ static void tbExecCallback(unsigned int CPUId, void *Data) {
 
   CurrentExecTB->TBIdx = TBIdx;
   CurrentExecTB->PC = VAddr;
+  // steady_clock is CLOCK_MONOTONIC on Linux, so it's comparable
+  // with the timestamps taken by llvm-mcad on the same host.
+  CurrentExecTB->Timestamp =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 static void onMemoryOps(unsigned int CPUIdx, qemu_plugin_meminfo_t MemInfo,
                         uint64_t VAddr, void *UData) {
   assert(CurrentExecTB);
+  if (CurrentExecTB->Filtered)
+    return;
   auto InstIdx = (uintptr_t)UData;
   auto &MemAccesses = CurrentExecTB->MemAccesses;
 
@@ -179,27 +509,235 @@ static void onMemoryOps(unsigned int CPUIdx, qemu_plugin_meminfo_t MemInfo,
                          static_cast<uint8_t>(2 << ShiftedSize), IsStore});
 }
 
-// The starting address of the currently loaded binary
-// TODO: What about end address?
-static llvm::Optional<uint64_t> CodeStartAddr;
+// Receive messages sent back by MCAD
+static std::thread ResultReceiver;
+
+static bool readFully(uint8_t *Buffer, size_t Size) {
+  while (Size) {
+    ssize_t Len = read(RemoteSockt, Buffer, Size);
+    if (Len <= 0)
+      return false;
+    Buffer += Len;
+    Size -= Len;
+  }
+  return true;
+}
+
+static void receiveMessages() {
+  using namespace mcad;
+
+  std::unique_ptr<raw_fd_ostream> OS;
+  if (!RegionResultsFile.empty()) {
+    // Open it here rather than the main thread since opening a FIFO
+    // blocks until there is a reader.
+    std::error_code EC;
+    OS = std::make_unique<raw_fd_ostream>(RegionResultsFile, EC,
+                                          sys::fs::OF_Append);
+    if (EC) {
+      WithColor::error() << "Failed to open " << RegionResultsFile
+                         << ": " << EC.message() << "\n";
+      OS.reset();
+    }
+  }
+
+  std::vector<uint8_t> Buffer;
+  while (true) {
+    flatbuffers::uoffset_t MsgSize;
+    Buffer.resize(sizeof(MsgSize));
+    if (!readFully(Buffer.data(), sizeof(MsgSize)))
+      break;
+    MsgSize = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(Buffer.data());
+    Buffer.resize(sizeof(MsgSize) + MsgSize);
+    if (!readFully(&Buffer[sizeof(MsgSize)], MsgSize))
+      break;
+
+    flatbuffers::Verifier V(Buffer.data(), Buffer.size());
+    if (!fbs::VerifySizePrefixedMessageBuffer(V)) {
+      WithColor::error() << "Invalid message from MCAD\n";
+      break;
+    }
+    const auto *Msg = fbs::GetSizePrefixedMessage(Buffer.data());
+    if (const auto *TB = Msg->Content_as_TranslatedBlock()) {
+      requestResend(*TB);
+      continue;
+    }
+    const auto *Result = Msg->Content_as_RegionResult();
+    if (!Result)
+      continue;
+
+    std::string Description;
+    if (const auto *Desc = Result->Description())
+      Description = Desc->str();
+    LLVM_DEBUG(dbgs() << "Region " << Description << " took "
+                      << Result->NumCycles() << " cycles\n");
+    if (OS) {
+      json::Object JO({{"region", Description},
+                       {"instructions", int64_t(Result->NumInstructions())},
+                       {"cycles", int64_t(Result->NumCycles())},
+                       {"uops", int64_t(Result->NumMicroOps())}});
+      // Only covers the simulated instructions in sampled simulation
+      if (uint64_t NumSampledOut = Result->NumSampledOutInstructions())
+        JO["sampled_out_instructions"] = int64_t(NumSampledOut);
+      (*OS) << formatv("{0}", json::Value(std::move(JO))) << "\n";
+      OS->flush();
+    }
+    if (RegionResultCallback)
+      RegionResultCallback(Description.c_str(), Result->NumInstructions(),
+                           Result->NumCycles(), Result->NumMicroOps(),
+                           RegionResultCallbackData);
+  }
+}
+
+// Negotiate features with MCAD
+static int sendHello() {
+  using namespace mcad;
+  auto Compression = fbs::Codec_None;
+  if (Compress) {
+    if (zlib::isAvailable())
+      Compression = fbs::Codec_Zlib;
+    else
+      WithColor::warning() << "zlib is not available, "
+                           << "messages will not be compressed\n";
+  }
+  if (Compression == fbs::Codec_None && !TheGuestBinary && !SystemMode)
+    // Nothing to negotiate
+    return 0;
+
+  flatbuffers::FlatBufferBuilder Builder(64);
+  flatbuffers::Offset<flatbuffers::String> FbBuildID;
+  if (TheGuestBinary)
+    FbBuildID = Builder.CreateString(TheGuestBinary->getBuildID().str());
+  auto FbHello = fbs::CreateHello(Builder, Compression,
+                                  /*FileBackedTBs=*/bool(TheGuestBinary),
+                                  FbBuildID, SystemMode,
+                                  /*AddressSpaces=*/0, /*KernelCode=*/false,
+                                  /*UserCode=*/false,
+                                  TheGuestBinary?
+                                  TheGuestBinary->getCodeHash() : 0U);
+  auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_Hello,
+                                      FbHello.Union());
+  fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
+  if (write(RemoteSockt, Builder.GetBufferPointer(), Builder.GetSize()) < 0) {
+    ::perror("Failed to send handshake");
+    return 1;
+  }
+
+  // Wait for the reply
+  std::vector<uint8_t> Buffer;
+  flatbuffers::uoffset_t MsgSize;
+  Buffer.resize(sizeof(MsgSize));
+  if (readFully(Buffer.data(), sizeof(MsgSize))) {
+    MsgSize = flatbuffers::ReadScalar<flatbuffers::uoffset_t>(Buffer.data());
+    Buffer.resize(sizeof(MsgSize) + MsgSize);
+    if (readFully(&Buffer[sizeof(MsgSize)], MsgSize)) {
+      flatbuffers::Verifier V(Buffer.data(), Buffer.size());
+      if (fbs::VerifySizePrefixedMessageBuffer(V)) {
+        const auto *Msg = fbs::GetSizePrefixedMessage(Buffer.data());
+        if (const auto *Reply = Msg->Content_as_Hello()) {
+          UseCompression = Reply->Compression() == fbs::Codec_Zlib;
+          if (Compression != fbs::Codec_None && !UseCompression)
+            WithColor::warning() << "MCAD doesn't accept compression\n";
+          UseFileBackedTBs = TheGuestBinary && Reply->FileBackedTBs();
+          if (TheGuestBinary && !UseFileBackedTBs)
+            WithColor::warning() << "MCAD can't read instructions from "
+                                 << GuestBinaryPath << "\n";
+          if (SystemMode) {
+            SelectKernelCode = Reply->KernelCode();
+            SelectUserCode = Reply->UserCode();
+            if (const auto *AddrSpaces = Reply->AddressSpaces())
+              SelectedAddressSpaces.insert(AddrSpaces->begin(),
+                                           AddrSpaces->end());
+            FilterAddressSpaces = SelectKernelCode || SelectUserCode ||
+                                  !SelectedAddressSpaces.empty();
+          }
+          LastBatchFlush = std::chrono::steady_clock::now();
+          return 0;
+        }
+      }
+    }
+  }
+  WithColor::error() << "Invalid handshake reply from MCAD\n";
+  return 1;
+}
 
 static void sendCodeStartAddr() {
   using namespace mcad;
   assert(CodeStartAddr.hasValue());
 
+  bool WantsRegionResults = !RegionResultsFile.empty() ||
+                            RegionResultCallback;
+  // MCAD sends back file-backed TBs it can't read
+  if ((WantsRegionResults || UseFileBackedTBs) &&
+      !ResultReceiver.joinable())
+    ResultReceiver = std::thread(receiveMessages);
+
   flatbuffers::FlatBufferBuilder Builder(16);
-  auto FbMD = fbs::CreateMetadata(Builder, *CodeStartAddr);
+  auto FbMD = fbs::CreateMetadata(Builder, *CodeStartAddr,
+                                  WantsRegionResults);
   auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_Metadata,
                                       FbMD.Union());
   fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
 
-  int NumBytesSent = write(RemoteSockt,
-                           Builder.GetBufferPointer(), Builder.GetSize());
+  int NumBytesSent = sendMessage(Builder);
   if (NumBytesSent < 0) {
     ::perror("Failed to send TB data");
   }
 }
 
+// Content of TBs we've sent -> their TB index
+static StringMap<uint32_t> TBAliases;
+static size_t NumAliasedTBs = 0U;
+
+// Return the current ISA mode (e.g. ARM / Thumb), which affects how the
+// same bytes are decoded. Or None if it can't be determined.
+static llvm::Optional<uint8_t> getISAMode() {
+  if (!CurrentQemuTarget.startswith_lower("arm"))
+    return 0;
+  if (!RegInfoRegistry.count("cpsr"))
+    return llvm::None;
+  uint32_t CPSR;
+  const auto &CPSRRegInfo = RegInfoRegistry["cpsr"];
+  if (qemu_plugin_vcpu_read_register(CPSRRegInfo.RegId, &CPSR,
+                                     CPSRRegInfo.Size) <= 0)
+    return llvm::None;
+  return (CPSR & 0b100000)? 1 : 0;
+}
+
+// Identify a TB by its start address, ISA mode, and instruction bytes.
+// Return false if any of them is not available.
+static bool getTBContentKey(struct qemu_plugin_tb *TB, std::string &Key) {
+  size_t NumInsn = qemu_plugin_tb_n_insns(TB);
+  auto Mode = getISAMode();
+  if (!NumInsn || !Mode)
+    return false;
+
+  raw_string_ostream OS(Key);
+  uint64_t StartVAddr =
+    qemu_plugin_insn_vaddr(qemu_plugin_tb_get_insn(TB, 0));
+  support::endian::write(OS, StartVAddr, support::little);
+  OS << char(*Mode);
+  for (auto i = 0U; i < NumInsn; ++i) {
+    const auto *QI = qemu_plugin_tb_get_insn(TB, i);
+    OS << StringRef((const char*)qemu_plugin_insn_data(QI),
+                    qemu_plugin_insn_size(QI));
+  }
+  OS.flush();
+  return true;
+}
+
+static void instrumentMemoryOps(struct qemu_plugin_tb *TB) {
+  size_t NumInsn = qemu_plugin_tb_n_insns(TB);
+  for (auto i = 0U; i < NumInsn; ++i) {
+    const auto *QI = qemu_plugin_tb_get_insn(TB, i);
+    // Instructions filtered out by address are not instrumented either
+    if (OnlyMainCode && qemu_plugin_insn_vaddr(QI) < *CodeStartAddr)
+      continue;
+    qemu_plugin_register_vcpu_mem_cb((struct qemu_plugin_insn*)QI, onMemoryOps,
+                                     QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_MEM_RW,
+                                     (void*)static_cast<uintptr_t>(i));
+  }
+}
+
 static void tbTranslateCallback(qemu_plugin_id_t Id,
                                 struct qemu_plugin_tb *TB) {
   using namespace mcad;
@@ -211,9 +749,28 @@ static void tbTranslateCallback(qemu_plugin_id_t Id,
     sendCodeStartAddr();
   }
 
+  // QEMU retranslates the same code over and over again (e.g. after its
+  // code cache is flushed), reuse the TB we've sent for it.
+  std::string ContentKey;
+  if (DedupTBs && getTBContentKey(TB, ContentKey)) {
+    auto It = TBAliases.find(ContentKey);
+    if (It != TBAliases.end()) {
+      instrumentMemoryOps(TB);
+      qemu_plugin_register_vcpu_tb_exec_cb(TB, tbExecCallback,
+                                           QEMU_PLUGIN_CB_NO_REGS,
+                                           (void*)(size_t)It->second);
+      ++NumAliasedTBs;
+      return;
+    }
+  }
+
   size_t NumInsn = qemu_plugin_tb_n_insns(TB);
   std::vector<uint8_t> RawInst;
   SmallVector<decltype(RawInst), 4> RawInsts;
+  // Whether all instructions are identical to those in the
+  // main executable
+  bool IsFileBacked = UseFileBackedTBs;
+  uint64_t StartVAddr = 0U;
   for (auto i = 0U; i < NumInsn; ++i) {
     const auto *QI = qemu_plugin_tb_get_insn(TB, i);
     size_t InsnSize = qemu_plugin_insn_size(QI);
@@ -226,41 +783,71 @@ static void tbTranslateCallback(qemu_plugin_id_t Id,
       // (e.g. interpreter)
       continue;
 
+    if (IsFileBacked) {
+      // Self-modifying or JIT'ed code doesn't match the file
+      if (i == 0U)
+        StartVAddr = VAddr;
+      IsFileBacked = VAddr >= *CodeStartAddr &&
+                     TheGuestBinary->getCode(VAddr - *CodeStartAddr,
+                                             InsnSize) ==
+                     makeArrayRef(I, InsnSize);
+    }
+
     RawInst.clear();
     for (auto j = 0U; j < InsnSize; ++j)
       RawInst.push_back(*(I++));
 
-    // instrumenting memory ops
-    qemu_plugin_register_vcpu_mem_cb((struct qemu_plugin_insn*)QI, onMemoryOps,
-                                     QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_MEM_RW,
-                                     (void*)static_cast<uintptr_t>(i));
-
     RawInsts.emplace_back(std::move(RawInst));
   }
+  instrumentMemoryOps(TB);
   if (RawInsts.empty()) return;
 
-  // Send the raw instructions
+  // Instructions skipped by the address filter break the contiguity
+  IsFileBacked &= RawInsts.size() == NumInsn;
+
   flatbuffers::FlatBufferBuilder Builder(1024);
-  std::vector<flatbuffers::Offset<fbs::Inst>> FbInsts;
-  for (const auto &Inst : RawInsts) {
-    auto InstData = Builder.CreateVector(Inst);
-    auto FbInst = fbs::CreateInst(Builder, InstData);
-    FbInsts.push_back(FbInst);
-  }
-  auto FbInstructions = Builder.CreateVector(FbInsts);
-  auto FbTB = fbs::CreateTranslatedBlock(Builder,
-                                         NumTranslationBlock, FbInstructions);
+  flatbuffers::Offset<fbs::TranslatedBlock> FbTB;
+  if (IsFileBacked) {
+    // MCAD will read the instructions from the executable by itself
+    std::vector<uint8_t> InstSizes;
+    for (const auto &Inst : RawInsts)
+      InstSizes.push_back(Inst.size());
+    FbTB = fbs::CreateTranslatedBlock(Builder, NumTranslationBlock,
+                                      /*Instructions=*/0, StartVAddr,
+                                      Builder.CreateVector(InstSizes));
+    ++NumFileBackedTBs;
+  } else {
+    // Send the raw instructions
+    std::vector<flatbuffers::Offset<fbs::Inst>> FbInsts;
+    for (const auto &Inst : RawInsts) {
+      auto InstData = Builder.CreateVector(Inst);
+      auto FbInst = fbs::CreateInst(Builder, InstData);
+      FbInsts.push_back(FbInst);
+    }
+    auto FbInstructions = Builder.CreateVector(FbInsts);
+    FbTB = fbs::CreateTranslatedBlock(Builder,
+                                      NumTranslationBlock, FbInstructions);
+  }
   auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_TranslatedBlock,
                                       FbTB.Union());
   fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
 
-  int NumBytesSent = write(RemoteSockt,
-                           Builder.GetBufferPointer(), Builder.GetSize());
-  if (NumBytesSent < 0) {
-    ::perror("Failed to send TB data");
-    return;
+  if (FilterAddressSpaces) {
+    // Wait until it's executed in a selected address space
+    DeferredTBs[NumTranslationBlock].assign(Builder.GetBufferPointer(),
+                                            Builder.GetBufferPointer() +
+                                            Builder.GetSize());
+  } else {
+    int NumBytesSent = sendMessage(Builder);
+    if (NumBytesSent < 0) {
+      ::perror("Failed to send TB data");
+      return;
+    }
   }
 
+  if (!ContentKey.empty())
+    TBAliases.insert({ContentKey, NumTranslationBlock});
+
   // Register exec callback
 #ifndef NDEBUG
   TBNumInsts.push_back(RawInsts.size());
@@ -328,14 +915,72 @@ static void onPluginExit(qemu_plugin_id_t Id, void *Data) {
                                       FbExecTB.Union());
   fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
 
-  int NumBytesSent = write(RemoteSockt,
-                           Builder.GetBufferPointer(), Builder.GetSize());
+  int NumBytesSent = sendMessage(Builder);
   if (NumBytesSent < 0) {
     ::perror("Failed to send end signal");
   }
 
+  if (NumAliasedTBs)
+    WithColor::note() << NumAliasedTBs << " retranslated blocks were "
+                      << "identical to those sent before\n";
+
+  if (SystemMode && FilterAddressSpaces)
+    WithColor::note() << NumFilteredTBExecs << " executed blocks outside "
+                      << "the selected address spaces were not sent\n";
+  if (SystemMode && AddressSpaceStats) {
+    // List the busiest address spaces
+    SmallVector<std::pair<uint64_t, uint64_t>, 8> Counts(
+      AddressSpaceExecCounts.begin(), AddressSpaceExecCounts.end());
+    llvm::sort(Counts, [](const std::pair<uint64_t, uint64_t> &LHS,
+                          const std::pair<uint64_t, uint64_t> &RHS) {
+                         return LHS.second > RHS.second;
+                       });
+    WithColor::note() << KernelExecCount << " blocks were executed in the "
+                      << "kernel and " << Counts.size() << " user address "
+                      << "spaces were seen\n";
+    for (const auto &Entry : makeArrayRef(Counts).take_front(8))
+      WithColor::note() << "  " << format_hex(Entry.first, 18) << ": "
+                        << Entry.second << " blocks executed\n";
+  }
+
+  if (NumFileBackedTBs) {
+    WithColor::note() << NumFileBackedTBs << " out of "
+                      << NumTranslationBlock << " translated blocks were "
+                      << "read from " << GuestBinaryPath << " by MCAD\n";
+    if (NumResentTBs)
+      WithColor::note() << NumResentTBs << " of them were resent since "
+                        << "MCAD couldn't read them\n";
+  }
+
+  if (UseCompression) {
+    flushBatch();
+    uint64_t Compressed = CompressionStats.CompressedBytes,
+             Uncompressed = CompressionStats.UncompressedBytes;
+    WithColor::note()
+      << "Compressed " << Uncompressed << " bytes of messages into "
+      << Compressed << " bytes ("
+      << format("%.2f", Compressed? double(Uncompressed) / Compressed : 0.0)
+      << "x), taking "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(
+           CompressionStats.Time).count()
+      << " ms\n";
+  }
+
+  if (ResultReceiver.joinable()) {
+    // Results that are still on their way will be received until MCAD
+    // closes the connection.
+    ::shutdown(RemoteSockt, SHUT_WR);
+    ResultReceiver.join();
+  }
+
   ::shutdown(RemoteSockt, SHUT_RDWR);
   ::close(RemoteSockt);
+
+  if (RecordStream) {
+    RecordStream->close();
+    WithColor::note() << "Recorded the message stream to "
+                      << RecordStreamPath << "\n";
+  }
 }
 
 static int connectInetSocket() {
@@ -390,6 +1035,7 @@ int qemu_plugin_install(qemu_plugin_id_t Id, const qemu_info_t *Info,
 
   CurrentQemuTarget = Info->target_name;
   LLVM_DEBUG(dbgs() << "Using QEMU target " << CurrentQemuTarget << "\n");
+  SystemMode = Info->system_emulation;
 
   // Connect to MCAD
   if (ConnectPort) {
@@ -400,6 +1046,32 @@ int qemu_plugin_install(qemu_plugin_id_t Id, const qemu_info_t *Info,
       return Ret;
   }
 
+  if (!GuestBinaryPath.empty() && SystemMode) {
+    WithColor::warning() << "-guest-binary is ignored in system mode\n";
+  } else if (!GuestBinaryPath.empty()) {
+    using namespace mcad::qemu_broker;
+    auto GBOrErr = GuestBinary::create(GuestBinaryPath);
+    if (!GBOrErr)
+      logAllUnhandledErrors(GBOrErr.takeError(),
+                            WithColor::warning() << "Failed to load "
+                                                 << GuestBinaryPath << ": ");
+    else
+      TheGuestBinary = std::move(*GBOrErr);
+  }
+
+  if (int Ret = sendHello())
+    return Ret;
+
+  if (!RecordStreamPath.empty()) {
+    std::error_code EC;
+    RecordStream = std::make_unique<raw_fd_ostream>(RecordStreamPath, EC);
+    if (EC) {
+      WithColor::error() << "Failed to open " << RecordStreamPath << ": "
+                         << EC.message() << "\n";
+      RecordStream.reset();
+    }
+  }
+
   NumTranslationBlock = 0U;
 
   qemu_plugin_register_vcpu_tb_trans_cb(Id, tbTranslateCallback);
@@ -20,23 +20,65 @@ struct Inst;
 
 struct TranslatedBlock;
 
+struct RegionResult;
+
+struct Hello;
+
+struct CompressedBatch;
+
 struct Message;
 
+enum Codec {
+  Codec_None = 0,
+  Codec_Zlib = 1,
+  Codec_MIN = Codec_None,
+  Codec_MAX = Codec_Zlib
+};
+
+inline const Codec (&EnumValuesCodec())[2] {
+  static const Codec values[] = {
+    Codec_None,
+    Codec_Zlib
+  };
+  return values;
+}
+
+inline const char * const *EnumNamesCodec() {
+  static const char * const names[] = {
+    "None",
+    "Zlib",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameCodec(Codec e) {
+  if (e < Codec_None || e > Codec_Zlib) return "";
+  const size_t index = static_cast<size_t>(e);
+  return EnumNamesCodec()[index];
+}
+
 enum Msg {
   Msg_NONE = 0,
   Msg_Metadata = 1,
   Msg_ExecTB = 2,
   Msg_TranslatedBlock = 3,
+  Msg_RegionResult = 4,
+  Msg_Hello = 5,
+  Msg_CompressedBatch = 6,
   Msg_MIN = Msg_NONE,
-  Msg_MAX = Msg_TranslatedBlock
+  Msg_MAX = Msg_CompressedBatch
 };
 
-inline const Msg (&EnumValuesMsg())[4] {
+inline const Msg (&EnumValuesMsg())[7] {
   static const Msg values[] = {
     Msg_NONE,
     Msg_Metadata,
     Msg_ExecTB,
-    Msg_TranslatedBlock
+    Msg_TranslatedBlock,
+    Msg_RegionResult,
+    Msg_Hello,
+    Msg_CompressedBatch
   };
   return values;
 }
@@ -47,13 +89,16 @@ inline const char * const *EnumNamesMsg() {
     "Metadata",
     "ExecTB",
     "TranslatedBlock",
+    "RegionResult",
+    "Hello",
+    "CompressedBatch",
     nullptr
   };
   return names;
 }
 
 inline const char *EnumNameMsg(Msg e) {
-  if (e < Msg_NONE || e > Msg_TranslatedBlock) return "";
+  if (e < Msg_NONE || e > Msg_CompressedBatch) return "";
   const size_t index = static_cast<size_t>(e);
   return EnumNamesMsg()[index];
 }
@@ -74,6 +119,18 @@ template<> struct MsgTraits<TranslatedBlock> {
   static const Msg enum_value = Msg_TranslatedBlock;
 };
 
+template<> struct MsgTraits<RegionResult> {
+  static const Msg enum_value = Msg_RegionResult;
+};
+
+template<> struct MsgTraits<Hello> {
+  static const Msg enum_value = Msg_Hello;
+};
+
+template<> struct MsgTraits<CompressedBatch> {
+  static const Msg enum_value = Msg_CompressedBatch;
+};
+
 bool VerifyMsg(flatbuffers::Verifier &verifier, const void *obj, Msg type);
 bool VerifyMsgVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -118,14 +175,19 @@ FLATBUFFERS_STRUCT_END(MemoryAccess, 24);
 
 struct Metadata FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
-    VT_LOADADDR = 4
+    VT_LOADADDR = 4,
+    VT_WANTSREGIONRESULTS = 6
   };
   uint64_t LoadAddr() const {
     return GetField<uint64_t>(VT_LOADADDR, 0);
   }
+  bool WantsRegionResults() const {
+    return GetField<uint8_t>(VT_WANTSREGIONRESULTS, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint64_t>(verifier, VT_LOADADDR) &&
+           VerifyField<uint8_t>(verifier, VT_WANTSREGIONRESULTS) &&
            verifier.EndTable();
   }
 };
@@ -136,6 +198,9 @@ struct MetadataBuilder {
   void add_LoadAddr(uint64_t LoadAddr) {
     fbb_.AddElement<uint64_t>(Metadata::VT_LOADADDR, LoadAddr, 0);
   }
+  void add_WantsRegionResults(bool WantsRegionResults) {
+    fbb_.AddElement<uint8_t>(Metadata::VT_WANTSREGIONRESULTS, static_cast<uint8_t>(WantsRegionResults), 0);
+  }
   explicit MetadataBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -150,9 +215,11 @@ struct MetadataBuilder {
 
 inline flatbuffers::Offset<Metadata> CreateMetadata(
     flatbuffers::FlatBufferBuilder &_fbb,
-    uint64_t LoadAddr = 0) {
+    uint64_t LoadAddr = 0,
+    bool WantsRegionResults = false) {
   MetadataBuilder builder_(_fbb);
   builder_.add_LoadAddr(LoadAddr);
+  builder_.add_WantsRegionResults(WantsRegionResults);
   return builder_.Finish();
 }
 
@@ -160,7 +227,8 @@ struct ExecTB FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
     VT_INDEX = 4,
     VT_PC = 6,
-    VT_MEMACCESSES = 8
+    VT_MEMACCESSES = 8,
+    VT_TIMESTAMP = 10
   };
   uint32_t Index() const {
     return GetField<uint32_t>(VT_INDEX, 0);
@@ -171,12 +239,16 @@ struct ExecTB FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<const MemoryAccess *> *MemAccesses() const {
     return GetPointer<const flatbuffers::Vector<const MemoryAccess *> *>(VT_MEMACCESSES);
   }
+  uint64_t Timestamp() const {
+    return GetField<uint64_t>(VT_TIMESTAMP, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint32_t>(verifier, VT_INDEX) &&
            VerifyField<uint64_t>(verifier, VT_PC) &&
            VerifyOffset(verifier, VT_MEMACCESSES) &&
            verifier.VerifyVector(MemAccesses()) &&
+           VerifyField<uint64_t>(verifier, VT_TIMESTAMP) &&
            verifier.EndTable();
   }
 };
@@ -193,6 +265,9 @@ struct ExecTBBuilder {
   void add_MemAccesses(flatbuffers::Offset<flatbuffers::Vector<const MemoryAccess *>> MemAccesses) {
     fbb_.AddOffset(ExecTB::VT_MEMACCESSES, MemAccesses);
   }
+  void add_Timestamp(uint64_t Timestamp) {
+    fbb_.AddElement<uint64_t>(ExecTB::VT_TIMESTAMP, Timestamp, 0);
+  }
   explicit ExecTBBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -209,8 +284,10 @@ inline flatbuffers::Offset<ExecTB> CreateExecTB(
     flatbuffers::FlatBufferBuilder &_fbb,
     uint32_t Index = 0,
     uint64_t PC = 0,
-    flatbuffers::Offset<flatbuffers::Vector<const MemoryAccess *>> MemAccesses = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<const MemoryAccess *>> MemAccesses = 0,
+    uint64_t Timestamp = 0) {
   ExecTBBuilder builder_(_fbb);
+  builder_.add_Timestamp(Timestamp);
   builder_.add_PC(PC);
   builder_.add_MemAccesses(MemAccesses);
   builder_.add_Index(Index);
@@ -221,13 +298,15 @@ inline flatbuffers::Offset<ExecTB> CreateExecTBDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     uint32_t Index = 0,
     uint64_t PC = 0,
-    const std::vector<MemoryAccess> *MemAccesses = nullptr) {
+    const std::vector<MemoryAccess> *MemAccesses = nullptr,
+    uint64_t Timestamp = 0) {
   auto MemAccesses__ = MemAccesses ? _fbb.CreateVectorOfStructs<MemoryAccess>(*MemAccesses) : 0;
   return llvm::mcad::fbs::CreateExecTB(
       _fbb,
       Index,
       PC,
-      MemAccesses__);
+      MemAccesses__,
+      Timestamp);
 }
 
 struct Inst FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
@@ -283,7 +362,9 @@ inline flatbuffers::Offset<Inst> CreateInstDirect(
 struct TranslatedBlock FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
     VT_INDEX = 4,
-    VT_INSTRUCTIONS = 6
+    VT_INSTRUCTIONS = 6,
+    VT_PC = 8,
+    VT_INSTSIZES = 10
   };
   uint32_t Index() const {
     return GetField<uint32_t>(VT_INDEX, 0);
@@ -291,12 +372,21 @@ struct TranslatedBlock FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<flatbuffers::Offset<Inst>> *Instructions() const {
     return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<Inst>> *>(VT_INSTRUCTIONS);
   }
+  uint64_t PC() const {
+    return GetField<uint64_t>(VT_PC, 0);
+  }
+  const flatbuffers::Vector<uint8_t> *InstSizes() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_INSTSIZES);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint32_t>(verifier, VT_INDEX) &&
            VerifyOffset(verifier, VT_INSTRUCTIONS) &&
            verifier.VerifyVector(Instructions()) &&
            verifier.VerifyVectorOfTables(Instructions()) &&
+           VerifyField<uint64_t>(verifier, VT_PC) &&
+           VerifyOffset(verifier, VT_INSTSIZES) &&
+           verifier.VerifyVector(InstSizes()) &&
            verifier.EndTable();
   }
 };
@@ -310,6 +400,12 @@ struct TranslatedBlockBuilder {
   void add_Instructions(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Inst>>> Instructions) {
     fbb_.AddOffset(TranslatedBlock::VT_INSTRUCTIONS, Instructions);
   }
+  void add_PC(uint64_t PC) {
+    fbb_.AddElement<uint64_t>(TranslatedBlock::VT_PC, PC, 0);
+  }
+  void add_InstSizes(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> InstSizes) {
+    fbb_.AddOffset(TranslatedBlock::VT_INSTSIZES, InstSizes);
+  }
   explicit TranslatedBlockBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -325,8 +421,12 @@ struct TranslatedBlockBuilder {
 inline flatbuffers::Offset<TranslatedBlock> CreateTranslatedBlock(
     flatbuffers::FlatBufferBuilder &_fbb,
     uint32_t Index = 0,
-    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Inst>>> Instructions = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Inst>>> Instructions = 0,
+    uint64_t PC = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> InstSizes = 0) {
   TranslatedBlockBuilder builder_(_fbb);
+  builder_.add_PC(PC);
+  builder_.add_InstSizes(InstSizes);
   builder_.add_Instructions(Instructions);
   builder_.add_Index(Index);
   return builder_.Finish();
@@ -335,12 +435,313 @@ inline flatbuffers::Offset<TranslatedBlock> CreateTranslatedBlock(
 inline flatbuffers::Offset<TranslatedBlock> CreateTranslatedBlockDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     uint32_t Index = 0,
-    const std::vector<flatbuffers::Offset<Inst>> *Instructions = nullptr) {
+    const std::vector<flatbuffers::Offset<Inst>> *Instructions = nullptr,
+    uint64_t PC = 0,
+    const std::vector<uint8_t> *InstSizes = nullptr) {
   auto Instructions__ = Instructions ? _fbb.CreateVector<flatbuffers::Offset<Inst>>(*Instructions) : 0;
+  auto InstSizes__ = InstSizes ? _fbb.CreateVector<uint8_t>(*InstSizes) : 0;
   return llvm::mcad::fbs::CreateTranslatedBlock(
       _fbb,
       Index,
-      Instructions__);
+      Instructions__,
+      PC,
+      InstSizes__);
+}
+
+struct RegionResult FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
+    VT_DESCRIPTION = 4,
+    VT_NUMINSTRUCTIONS = 6,
+    VT_NUMCYCLES = 8,
+    VT_NUMMICROOPS = 10,
+    VT_NUMSAMPLEDOUTINSTRUCTIONS = 12
+  };
+  const flatbuffers::String *Description() const {
+    return GetPointer<const flatbuffers::String *>(VT_DESCRIPTION);
+  }
+  uint64_t NumInstructions() const {
+    return GetField<uint64_t>(VT_NUMINSTRUCTIONS, 0);
+  }
+  uint64_t NumCycles() const {
+    return GetField<uint64_t>(VT_NUMCYCLES, 0);
+  }
+  uint64_t NumMicroOps() const {
+    return GetField<uint64_t>(VT_NUMMICROOPS, 0);
+  }
+  uint64_t NumSampledOutInstructions() const {
+    return GetField<uint64_t>(VT_NUMSAMPLEDOUTINSTRUCTIONS, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_DESCRIPTION) &&
+           verifier.VerifyString(Description()) &&
+           VerifyField<uint64_t>(verifier, VT_NUMINSTRUCTIONS) &&
+           VerifyField<uint64_t>(verifier, VT_NUMCYCLES) &&
+           VerifyField<uint64_t>(verifier, VT_NUMMICROOPS) &&
+           VerifyField<uint64_t>(verifier, VT_NUMSAMPLEDOUTINSTRUCTIONS) &&
+           verifier.EndTable();
+  }
+};
+
+struct RegionResultBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_Description(flatbuffers::Offset<flatbuffers::String> Description) {
+    fbb_.AddOffset(RegionResult::VT_DESCRIPTION, Description);
+  }
+  void add_NumInstructions(uint64_t NumInstructions) {
+    fbb_.AddElement<uint64_t>(RegionResult::VT_NUMINSTRUCTIONS, NumInstructions, 0);
+  }
+  void add_NumCycles(uint64_t NumCycles) {
+    fbb_.AddElement<uint64_t>(RegionResult::VT_NUMCYCLES, NumCycles, 0);
+  }
+  void add_NumMicroOps(uint64_t NumMicroOps) {
+    fbb_.AddElement<uint64_t>(RegionResult::VT_NUMMICROOPS, NumMicroOps, 0);
+  }
+  void add_NumSampledOutInstructions(uint64_t NumSampledOutInstructions) {
+    fbb_.AddElement<uint64_t>(RegionResult::VT_NUMSAMPLEDOUTINSTRUCTIONS, NumSampledOutInstructions, 0);
+  }
+  explicit RegionResultBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  RegionResultBuilder &operator=(const RegionResultBuilder &);
+  flatbuffers::Offset<RegionResult> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<RegionResult>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<RegionResult> CreateRegionResult(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> Description = 0,
+    uint64_t NumInstructions = 0,
+    uint64_t NumCycles = 0,
+    uint64_t NumMicroOps = 0,
+    uint64_t NumSampledOutInstructions = 0) {
+  RegionResultBuilder builder_(_fbb);
+  builder_.add_NumSampledOutInstructions(NumSampledOutInstructions);
+  builder_.add_NumMicroOps(NumMicroOps);
+  builder_.add_NumCycles(NumCycles);
+  builder_.add_NumInstructions(NumInstructions);
+  builder_.add_Description(Description);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<RegionResult> CreateRegionResultDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *Description = nullptr,
+    uint64_t NumInstructions = 0,
+    uint64_t NumCycles = 0,
+    uint64_t NumMicroOps = 0,
+    uint64_t NumSampledOutInstructions = 0) {
+  auto Description__ = Description ? _fbb.CreateString(Description) : 0;
+  return llvm::mcad::fbs::CreateRegionResult(
+      _fbb,
+      Description__,
+      NumInstructions,
+      NumCycles,
+      NumMicroOps,
+      NumSampledOutInstructions);
+}
+
+struct Hello FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
+    VT_COMPRESSION = 4,
+    VT_FILEBACKEDTBS = 6,
+    VT_BUILDID = 8,
+    VT_SYSTEMMODE = 10,
+    VT_ADDRESSSPACES = 12,
+    VT_KERNELCODE = 14,
+    VT_USERCODE = 16,
+    VT_CODEHASH = 18
+  };
+  Codec Compression() const {
+    return static_cast<Codec>(GetField<uint8_t>(VT_COMPRESSION, 0));
+  }
+  bool FileBackedTBs() const {
+    return GetField<uint8_t>(VT_FILEBACKEDTBS, 0) != 0;
+  }
+  const flatbuffers::String *BuildID() const {
+    return GetPointer<const flatbuffers::String *>(VT_BUILDID);
+  }
+  bool SystemMode() const {
+    return GetField<uint8_t>(VT_SYSTEMMODE, 0) != 0;
+  }
+  const flatbuffers::Vector<uint64_t> *AddressSpaces() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_ADDRESSSPACES);
+  }
+  bool KernelCode() const {
+    return GetField<uint8_t>(VT_KERNELCODE, 0) != 0;
+  }
+  bool UserCode() const {
+    return GetField<uint8_t>(VT_USERCODE, 0) != 0;
+  }
+  uint64_t CodeHash() const {
+    return GetField<uint64_t>(VT_CODEHASH, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_COMPRESSION) &&
+           VerifyField<uint8_t>(verifier, VT_FILEBACKEDTBS) &&
+           VerifyOffset(verifier, VT_BUILDID) &&
+           verifier.VerifyString(BuildID()) &&
+           VerifyField<uint8_t>(verifier, VT_SYSTEMMODE) &&
+           VerifyOffset(verifier, VT_ADDRESSSPACES) &&
+           verifier.VerifyVector(AddressSpaces()) &&
+           VerifyField<uint8_t>(verifier, VT_KERNELCODE) &&
+           VerifyField<uint8_t>(verifier, VT_USERCODE) &&
+           VerifyField<uint64_t>(verifier, VT_CODEHASH) &&
+           verifier.EndTable();
+  }
+};
+
+struct HelloBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_Compression(Codec Compression) {
+    fbb_.AddElement<uint8_t>(Hello::VT_COMPRESSION, static_cast<uint8_t>(Compression), 0);
+  }
+  void add_FileBackedTBs(bool FileBackedTBs) {
+    fbb_.AddElement<uint8_t>(Hello::VT_FILEBACKEDTBS, static_cast<uint8_t>(FileBackedTBs), 0);
+  }
+  void add_BuildID(flatbuffers::Offset<flatbuffers::String> BuildID) {
+    fbb_.AddOffset(Hello::VT_BUILDID, BuildID);
+  }
+  void add_SystemMode(bool SystemMode) {
+    fbb_.AddElement<uint8_t>(Hello::VT_SYSTEMMODE, static_cast<uint8_t>(SystemMode), 0);
+  }
+  void add_AddressSpaces(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> AddressSpaces) {
+    fbb_.AddOffset(Hello::VT_ADDRESSSPACES, AddressSpaces);
+  }
+  void add_KernelCode(bool KernelCode) {
+    fbb_.AddElement<uint8_t>(Hello::VT_KERNELCODE, static_cast<uint8_t>(KernelCode), 0);
+  }
+  void add_UserCode(bool UserCode) {
+    fbb_.AddElement<uint8_t>(Hello::VT_USERCODE, static_cast<uint8_t>(UserCode), 0);
+  }
+  void add_CodeHash(uint64_t CodeHash) {
+    fbb_.AddElement<uint64_t>(Hello::VT_CODEHASH, CodeHash, 0);
+  }
+  explicit HelloBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  HelloBuilder &operator=(const HelloBuilder &);
+  flatbuffers::Offset<Hello> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<Hello>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<Hello> CreateHello(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    Codec Compression = Codec_None,
+    bool FileBackedTBs = false,
+    flatbuffers::Offset<flatbuffers::String> BuildID = 0,
+    bool SystemMode = false,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> AddressSpaces = 0,
+    bool KernelCode = false,
+    bool UserCode = false,
+    uint64_t CodeHash = 0) {
+  HelloBuilder builder_(_fbb);
+  builder_.add_CodeHash(CodeHash);
+  builder_.add_AddressSpaces(AddressSpaces);
+  builder_.add_BuildID(BuildID);
+  builder_.add_UserCode(UserCode);
+  builder_.add_KernelCode(KernelCode);
+  builder_.add_SystemMode(SystemMode);
+  builder_.add_FileBackedTBs(FileBackedTBs);
+  builder_.add_Compression(Compression);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<Hello> CreateHelloDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    Codec Compression = Codec_None,
+    bool FileBackedTBs = false,
+    const char *BuildID = nullptr,
+    bool SystemMode = false,
+    const std::vector<uint64_t> *AddressSpaces = nullptr,
+    bool KernelCode = false,
+    bool UserCode = false,
+    uint64_t CodeHash = 0) {
+  auto BuildID__ = BuildID ? _fbb.CreateString(BuildID) : 0;
+  auto AddressSpaces__ = AddressSpaces ? _fbb.CreateVector<uint64_t>(*AddressSpaces) : 0;
+  return llvm::mcad::fbs::CreateHello(
+      _fbb,
+      Compression,
+      FileBackedTBs,
+      BuildID__,
+      SystemMode,
+      AddressSpaces__,
+      KernelCode,
+      UserCode,
+      CodeHash);
+}
+
+struct CompressedBatch FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
+    VT_UNCOMPRESSEDSIZE = 4,
+    VT_DATA = 6
+  };
+  uint32_t UncompressedSize() const {
+    return GetField<uint32_t>(VT_UNCOMPRESSEDSIZE, 0);
+  }
+  const flatbuffers::Vector<uint8_t> *Data() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_DATA);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_UNCOMPRESSEDSIZE) &&
+           VerifyOffset(verifier, VT_DATA) &&
+           verifier.VerifyVector(Data()) &&
+           verifier.EndTable();
+  }
+};
+
+struct CompressedBatchBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_UncompressedSize(uint32_t UncompressedSize) {
+    fbb_.AddElement<uint32_t>(CompressedBatch::VT_UNCOMPRESSEDSIZE, UncompressedSize, 0);
+  }
+  void add_Data(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> Data) {
+    fbb_.AddOffset(CompressedBatch::VT_DATA, Data);
+  }
+  explicit CompressedBatchBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  CompressedBatchBuilder &operator=(const CompressedBatchBuilder &);
+  flatbuffers::Offset<CompressedBatch> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<CompressedBatch>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<CompressedBatch> CreateCompressedBatch(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t UncompressedSize = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> Data = 0) {
+  CompressedBatchBuilder builder_(_fbb);
+  builder_.add_Data(Data);
+  builder_.add_UncompressedSize(UncompressedSize);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<CompressedBatch> CreateCompressedBatchDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t UncompressedSize = 0,
+    const std::vector<uint8_t> *Data = nullptr) {
+  auto Data__ = Data ? _fbb.CreateVector<uint8_t>(*Data) : 0;
+  return llvm::mcad::fbs::CreateCompressedBatch(
+      _fbb,
+      UncompressedSize,
+      Data__);
 }
 
 struct Message FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
@@ -364,6 +765,15 @@ struct Message FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const TranslatedBlock *Content_as_TranslatedBlock() const {
     return Content_type() == Msg_TranslatedBlock ? static_cast<const TranslatedBlock *>(Content()) : nullptr;
   }
+  const RegionResult *Content_as_RegionResult() const {
+    return Content_type() == Msg_RegionResult ? static_cast<const RegionResult *>(Content()) : nullptr;
+  }
+  const Hello *Content_as_Hello() const {
+    return Content_type() == Msg_Hello ? static_cast<const Hello *>(Content()) : nullptr;
+  }
+  const CompressedBatch *Content_as_CompressedBatch() const {
+    return Content_type() == Msg_CompressedBatch ? static_cast<const CompressedBatch *>(Content()) : nullptr;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_CONTENT_TYPE) &&
@@ -385,6 +795,18 @@ template<> inline const TranslatedBlock *Message::Content_as<TranslatedBlock>()
   return Content_as_TranslatedBlock();
 }
 
+template<> inline const RegionResult *Message::Content_as<RegionResult>() const {
+  return Content_as_RegionResult();
+}
+
+template<> inline const Hello *Message::Content_as<Hello>() const {
+  return Content_as_Hello();
+}
+
+template<> inline const CompressedBatch *Message::Content_as<CompressedBatch>() const {
+  return Content_as_CompressedBatch();
+}
+
 struct MessageBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -433,6 +855,18 @@ inline bool VerifyMsg(flatbuffers::Verifier &verifier, const void *obj, Msg type
       auto ptr = reinterpret_cast<const TranslatedBlock *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case Msg_RegionResult: {
+      auto ptr = reinterpret_cast<const RegionResult *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case Msg_Hello: {
+      auto ptr = reinterpret_cast<const Hello *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case Msg_CompressedBatch: {
+      auto ptr = reinterpret_cast<const CompressedBatch *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
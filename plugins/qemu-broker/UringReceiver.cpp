@@ -0,0 +1,203 @@
+#include "UringReceiver.h"
+#include "llvm/Support/MathExtras.h"
+#include <cerrno>
+#include <system_error>
+
+#ifdef MCAD_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+using namespace llvm;
+using namespace mcad;
+using namespace qemu_broker;
+
+static Error makeErrnoError(int Errno, const Twine &Msg) {
+  return createStringError(std::error_code(Errno, std::generic_category()),
+                           Msg);
+}
+
+#ifdef MCAD_HAVE_LIBURING
+// Buffer group of our provided buffers
+static constexpr int BufferGroupId = 0;
+// To tell completions of different requests apart
+static constexpr uint64_t ReceiveTag = 1U;
+static constexpr uint64_t CancelTag = 2U;
+
+struct UringReceiver::RingState {
+  io_uring Ring;
+  bool IsInitialized = false;
+  io_uring_buf_ring *BufRing = nullptr;
+  unsigned NumBufRingEntries = 0U;
+
+  ~RingState() {
+    if (BufRing)
+      io_uring_free_buf_ring(&Ring, BufRing, NumBufRingEntries,
+                             BufferGroupId);
+    if (IsInitialized)
+      io_uring_queue_exit(&Ring);
+  }
+};
+
+UringReceiver::UringReceiver(unsigned NumBuffers, unsigned BufferSize)
+  : State(std::make_unique<RingState>()),
+    NumBuffers(NumBuffers), BufferSize(BufferSize),
+    Buffers(new uint8_t[size_t(NumBuffers) * BufferSize]) {}
+
+UringReceiver::~UringReceiver() {}
+
+Expected<std::unique_ptr<UringReceiver>>
+UringReceiver::create(unsigned NumBuffers, unsigned BufferSize) {
+  assert(isPowerOf2_32(NumBuffers) && "NumBuffers is not a power of two");
+  std::unique_ptr<UringReceiver> R(new UringReceiver(NumBuffers, BufferSize));
+  auto &S = *R->State;
+
+  int Ret = io_uring_queue_init(/*entries=*/8, &S.Ring, /*flags=*/0);
+  if (Ret < 0)
+    return makeErrnoError(-Ret, "Failed to create io_uring");
+  S.IsInitialized = true;
+
+  S.BufRing = io_uring_setup_buf_ring(&S.Ring, NumBuffers, BufferGroupId,
+                                      /*flags=*/0, &Ret);
+  if (!S.BufRing)
+    return makeErrnoError(-Ret, "Failed to register provided buffers");
+  S.NumBufRingEntries = NumBuffers;
+
+  int Mask = io_uring_buf_ring_mask(NumBuffers);
+  for (unsigned i = 0U; i < NumBuffers; ++i)
+    io_uring_buf_ring_add(S.BufRing, R->getBuffer(i), BufferSize, i,
+                          Mask, i);
+  io_uring_buf_ring_advance(S.BufRing, NumBuffers);
+
+  return std::move(R);
+}
+
+void UringReceiver::recycleBuffer(unsigned Id) {
+  auto &S = *State;
+  io_uring_buf_ring_add(S.BufRing, getBuffer(Id), BufferSize, Id,
+                        io_uring_buf_ring_mask(NumBuffers), 0);
+  io_uring_buf_ring_advance(S.BufRing, 1);
+}
+
+Error UringReceiver::armReceive(int FD) {
+  auto &S = *State;
+  io_uring_sqe *SQE = io_uring_get_sqe(&S.Ring);
+  assert(SQE && "Submission queue is full?");
+  io_uring_prep_recv_multishot(SQE, FD, nullptr, 0, /*flags=*/0);
+  SQE->flags |= IOSQE_BUFFER_SELECT;
+  SQE->buf_group = BufferGroupId;
+  io_uring_sqe_set_data64(SQE, ReceiveTag);
+
+  int Ret = io_uring_submit(&S.Ring);
+  if (Ret < 0)
+    return makeErrnoError(-Ret, "Failed to submit receive request");
+  return Error::success();
+}
+
+void UringReceiver::cancelReceive(int FD) {
+  auto &S = *State;
+  io_uring_sqe *SQE = io_uring_get_sqe(&S.Ring);
+  assert(SQE && "Submission queue is full?");
+  io_uring_prep_cancel_fd(SQE, FD, /*flags=*/0);
+  io_uring_sqe_set_data64(SQE, CancelTag);
+  if (io_uring_submit(&S.Ring) < 0)
+    return;
+
+  bool IsReceiveDone = false, IsCancelDone = false;
+  while (!IsReceiveDone || !IsCancelDone) {
+    io_uring_cqe *CQE;
+    int Ret = io_uring_wait_cqe(&S.Ring, &CQE);
+    if (Ret == -EINTR)
+      continue;
+    if (Ret < 0)
+      return;
+
+    if (io_uring_cqe_get_data64(CQE) == CancelTag) {
+      IsCancelDone = true;
+    } else {
+      if (CQE->flags & IORING_CQE_F_BUFFER)
+        recycleBuffer(CQE->flags >> IORING_CQE_BUFFER_SHIFT);
+      IsReceiveDone = !(CQE->flags & IORING_CQE_F_MORE);
+    }
+    io_uring_cqe_seen(&S.Ring, CQE);
+  }
+}
+
+Expected<bool>
+UringReceiver::receive(int FD, function_ref<bool(ArrayRef<uint8_t>)> OnData) {
+  auto &S = *State;
+  if (auto E = armReceive(FD))
+    return std::move(E);
+
+  bool HasReceived = false;
+  while (true) {
+    io_uring_cqe *CQE;
+    int Ret = io_uring_wait_cqe(&S.Ring, &CQE);
+    if (Ret == -EINTR)
+      continue;
+    if (Ret < 0)
+      return makeErrnoError(-Ret, "Failed to wait for completion");
+
+    int Res = CQE->res;
+    unsigned Flags = CQE->flags;
+    io_uring_cqe_seen(&S.Ring, CQE);
+
+    bool IsArmed = Flags & IORING_CQE_F_MORE;
+    if (Res == -ENOBUFS) {
+      // We were not fast enough to give buffers back, but they're
+      // all available again by now.
+      if (!IsArmed)
+        if (auto E = armReceive(FD))
+          return std::move(E);
+      continue;
+    }
+    if (Res == -EINVAL && !HasReceived)
+      // Multishot receive is not supported
+      return false;
+    if (Res < 0)
+      return makeErrnoError(-Res, "Failed to receive from client");
+    if (!Res)
+      // EOF
+      return true;
+
+    HasReceived = true;
+    assert((Flags & IORING_CQE_F_BUFFER) && "No buffer was selected?");
+    unsigned Id = Flags >> IORING_CQE_BUFFER_SHIFT;
+    bool Continue = OnData(ArrayRef<uint8_t>(getBuffer(Id), size_t(Res)));
+    recycleBuffer(Id);
+
+    if (!Continue) {
+      if (IsArmed)
+        cancelReceive(FD);
+      return true;
+    }
+    if (!IsArmed)
+      if (auto E = armReceive(FD))
+        return std::move(E);
+  }
+}
+#else
+struct UringReceiver::RingState {};
+
+UringReceiver::UringReceiver(unsigned NumBuffers, unsigned BufferSize)
+  : NumBuffers(NumBuffers), BufferSize(BufferSize) {}
+
+UringReceiver::~UringReceiver() {}
+
+Expected<std::unique_ptr<UringReceiver>>
+UringReceiver::create(unsigned NumBuffers, unsigned BufferSize) {
+  return makeErrnoError(ENOSYS, "Built without io_uring support");
+}
+
+void UringReceiver::recycleBuffer(unsigned Id) {}
+
+Error UringReceiver::armReceive(int FD) {
+  return makeErrnoError(ENOSYS, "Built without io_uring support");
+}
+
+void UringReceiver::cancelReceive(int FD) {}
+
+Expected<bool>
+UringReceiver::receive(int FD, function_ref<bool(ArrayRef<uint8_t>)> OnData) {
+  return false;
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef LLVM_MCAD_QEMU_BROKER_URINGRECEIVER_H
+#define LLVM_MCAD_QEMU_BROKER_URINGRECEIVER_H
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+namespace mcad {
+namespace qemu_broker {
+// Receive data from a socket with io_uring.
+//
+// Instead of issuing a read syscall for every chunk, a single multishot
+// receive request keeps filling buffers picked from a ring of provided
+// buffers, which is registered with the kernel upfront. Data is then
+// handed to the caller in place and its buffer is given back to the ring
+// right after that.
+class UringReceiver {
+  struct RingState;
+  std::unique_ptr<RingState> State;
+
+  unsigned NumBuffers, BufferSize;
+  std::unique_ptr<uint8_t[]> Buffers;
+
+  UringReceiver(unsigned NumBuffers, unsigned BufferSize);
+
+  uint8_t *getBuffer(unsigned Id) {
+    return &Buffers[size_t(Id) * BufferSize];
+  }
+  void recycleBuffer(unsigned Id);
+
+  Error armReceive(int FD);
+  // Cancel the pending receive on FD and wait until it's gone
+  void cancelReceive(int FD);
+
+public:
+  // Return an error if io_uring, or any of its feature we need, is not
+  // available. NumBuffers has to be a power of two.
+  static Expected<std::unique_ptr<UringReceiver>>
+  create(unsigned NumBuffers = 64, unsigned BufferSize = 16 * 1024);
+
+  ~UringReceiver();
+
+  // Receive from FD until EOF or OnData returns false. Data passed to
+  // OnData only stays valid during that call.
+  // Return false, without consuming anything from FD, if multishot receive
+  // is not supported by the kernel. In which case the caller should fall
+  // back to other ways.
+  Expected<bool> receive(int FD,
+                         function_ref<bool(ArrayRef<uint8_t>)> OnData);
+};
+} // end namespace qemu_broker
+} // end namespace mcad
+} // end namespace llvm
+#endif
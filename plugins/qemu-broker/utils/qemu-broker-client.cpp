@@ -8,6 +8,7 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/WithColor.h"
+#include <chrono>
 #include <string>
 
 #include <arpa/inet.h>
@@ -117,7 +118,11 @@ static void sendTB(int Sockt) {
 
 static void tbExec(int Sockt) {
   flatbuffers::FlatBufferBuilder Builder(128);
-  auto FbExecTB = fbs::CreateExecTB(Builder, TBExecIdx, TBExecAddr);
+  uint64_t Timestamp =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  auto FbExecTB = fbs::CreateExecTB(Builder, TBExecIdx, TBExecAddr,
+                                    /*MemAccesses=*/0, Timestamp);
   auto FbMessage = fbs::CreateMessage(Builder, fbs::Msg_ExecTB,
                                       FbExecTB.Union());
   fbs::FinishSizePrefixedMessageBuffer(Builder, FbMessage);
@@ -0,0 +1,603 @@
+// Compare the incremental simulation of llvm-mcad against the classic,
+// batch-mode MCA pipeline on the same assembly files.
+//
+// The batch pipeline is built in-process, the way llvm-mca does: every
+// region is parsed and lowered into mca::Instruction up front and then
+// simulated in a single run. The incremental one is llvm-mcad itself,
+// reading the same file with AsmFileBroker, under different
+// `-mca-max-chunk-size`. Throughput of both, as well as how much the
+// cycles and uOps of every region diverge from the batch results, are
+// reported.
+//
+// Usage:
+//   mcad-batch-bench -llvm-mcad=path/to/llvm-mcad -mtriple=x86_64
+//                    -mcpu=skylake -chunk-sizes=100,1000,10000 input.s
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrAnalysis.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/MCA/Context.h"
+#include "llvm/MCA/HardwareUnits/RegisterFile.h"
+#include "llvm/MCA/HardwareUnits/RetireControlUnit.h"
+#include "llvm/MCA/HardwareUnits/Scheduler.h"
+#include "llvm/MCA/InstrBuilder.h"
+#include "llvm/MCA/Instruction.h"
+#include "llvm/MCA/Pipeline.h"
+#include "llvm/MCA/SourceMgr.h"
+#include "llvm/MCA/Stages/DispatchStage.h"
+#include "llvm/MCA/Stages/EntryStage.h"
+#include "llvm/MCA/Stages/ExecuteStage.h"
+#include "llvm/MCA/Stages/RetireStage.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Brokers/AsmUtils/CodeRegion.h"
+#include "Brokers/AsmUtils/CodeRegionGenerator.h"
+#include "MCAViews/SummaryView.h"
+#include "PipelinePrinter.h"
+
+using namespace llvm;
+
+static cl::list<std::string>
+  InputFiles(cl::Positional, cl::desc("<assembly files>"), cl::OneOrMore);
+
+static cl::opt<std::string>
+  LLVMMcadPath("llvm-mcad", cl::desc("Path to the llvm-mcad to measure"),
+               cl::Required);
+
+static cl::opt<std::string>
+  TripleName("mtriple", cl::desc("Target triple to use"), cl::init(""));
+
+static cl::opt<std::string>
+  CPUName("mcpu", cl::value_desc("cpu-name"),
+          cl::desc("Specific CPU to use (i.e. `-mcpu`)"),
+          cl::init("native"));
+
+static cl::list<unsigned>
+  ChunkSizes("chunk-sizes",
+             cl::desc("Values of `-mca-max-chunk-size` to run llvm-mcad "
+                      "with. Default to 100,1000,10000,100000"),
+             cl::CommaSeparated);
+
+static cl::opt<bool>
+  PreserveCallInst("use-call-inst",
+                   cl::desc("Include call instructions in MCA simulation"),
+                   cl::init(false));
+
+static cl::opt<unsigned>
+  NumRepeats("repeat",
+             cl::desc("Run every configuration this many times and keep "
+                      "the fastest one"),
+             cl::init(3U));
+
+static cl::opt<unsigned>
+  Timeout("timeout", cl::desc("Kill an llvm-mcad run after this many seconds"),
+          cl::init(600U));
+
+static cl::opt<std::string>
+  OutputFile("o", cl::desc("Write the results to this file in JSON format"),
+             cl::init(""));
+
+namespace {
+struct RegionStats {
+  std::string Description;
+  uint64_t Instructions = 0U, Cycles = 0U, UOps = 0U;
+
+  json::Value toJSON() const {
+    return json::Object({{"description", Description},
+                         {"instructions", int64_t(Instructions)},
+                         {"cycles", int64_t(Cycles)},
+                         {"uops", int64_t(UOps)}});
+  }
+};
+
+struct RunResult {
+  std::string Input;
+  // Zero for the batch pipeline
+  unsigned ChunkSize = 0U;
+  // The time spent on everything but llvm-mcad's own start up, which is
+  // measured separately.
+  double WallMs = 0.0;
+  std::vector<RegionStats> Regions;
+
+  // Divergence against the batch pipeline, in percentage
+  double MaxCyclesDiff = 0.0, MaxUOpsDiff = 0.0;
+  // Number of regions that don't exist or have different number of
+  // instructions in the batch results.
+  unsigned NumMismatchedRegions = 0U;
+
+  bool isBatch() const { return !ChunkSize; }
+
+  uint64_t getNumInstructions() const {
+    uint64_t Total = 0U;
+    for (const auto &R : Regions)
+      Total += R.Instructions;
+    return Total;
+  }
+
+  double getInstsPerSec() const {
+    return WallMs > 0.0? getNumInstructions() * 1000.0 / WallMs : 0.0;
+  }
+
+  json::Value toJSON() const {
+    json::Array RegionArray;
+    for (const auto &R : Regions)
+      RegionArray.push_back(R.toJSON());
+    json::Object JO({{"input", Input},
+                     {"mode", isBatch()? "batch" : "incremental"},
+                     {"wall_ms", WallMs},
+                     {"instructions", int64_t(getNumInstructions())},
+                     {"insts_per_sec", getInstsPerSec()},
+                     {"regions", std::move(RegionArray)}});
+    if (!isBatch()) {
+      JO["chunk_size"] = int64_t(ChunkSize);
+      JO["max_cycles_diff_pct"] = MaxCyclesDiff;
+      JO["max_uops_diff_pct"] = MaxUOpsDiff;
+      JO["mismatched_regions"] = int64_t(NumMismatchedRegions);
+    }
+    return std::move(JO);
+  }
+};
+
+// MC components shared by every batch run
+struct MCComponents {
+  const Target *TheTarget = nullptr;
+  std::unique_ptr<MCSubtargetInfo> STI;
+  std::unique_ptr<MCRegisterInfo> MRI;
+  std::unique_ptr<MCAsmInfo> MAI;
+  std::unique_ptr<MCInstrInfo> MCII;
+  std::unique_ptr<MCInstrAnalysis> MCIA;
+};
+} // end anonymous namespace
+
+static Expected<MCComponents> createMCComponents() {
+  MCComponents MC;
+  std::string Error;
+  MC.TheTarget = TargetRegistry::lookupTarget(TripleName, Error);
+  if (!MC.TheTarget)
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             Error);
+
+  MC.STI.reset(MC.TheTarget->createMCSubtargetInfo(TripleName, CPUName, ""));
+  if (!MC.STI || !MC.STI->isCPUStringValid(CPUName))
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "Invalid CPU `%s`", CPUName.c_str());
+  MC.MRI.reset(MC.TheTarget->createMCRegInfo(TripleName));
+  MC.MCII.reset(MC.TheTarget->createMCInstrInfo());
+  if (MC.MRI) {
+    MCTargetOptions MCOptions;
+    MC.MAI.reset(MC.TheTarget->createMCAsmInfo(*MC.MRI, TripleName,
+                                               MCOptions));
+  }
+  if (!MC.MRI || !MC.MAI || !MC.MCII)
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "Failed to create MC components for %s",
+                             TripleName.c_str());
+  MC.MCIA.reset(MC.TheTarget->createMCInstrAnalysis(MC.MCII.get()));
+  return std::move(MC);
+}
+
+// Build a pipeline with the same hardware units and stages as
+// MCAWorker::createPipeline, but on a source manager that has all
+// the instructions from the beginning.
+static std::unique_ptr<mca::Pipeline>
+createBatchPipeline(mca::Context &MCA, const MCSubtargetInfo &STI,
+                    const MCRegisterInfo &MRI, mca::SourceMgr &SrcMgr) {
+  using namespace mca;
+  // Same as the options llvm-mcad uses
+  PipelineOptions PO(/*MicroOpQueue=*/0, /*DecoderThroughput=*/0,
+                     /*DispatchWidth=*/0,
+                     /*RegisterFileSize=*/0,
+                     /*LoadQueueSize=*/0, /*StoreQueueSize=*/0,
+                     /*AssumeNoAlias=*/true,
+                     /*EnableBottleneckAnalysis=*/false);
+  const MCSchedModel &SM = STI.getSchedModel();
+
+  auto RCU = std::make_unique<RetireControlUnit>(SM);
+  auto PRF = std::make_unique<RegisterFile>(SM, MRI, PO.RegisterFileSize);
+  auto LSU = std::make_unique<LSUnit>(SM, PO.LoadQueueSize,
+                                       PO.StoreQueueSize, PO.AssumeNoAlias,
+                                       MCA.getMetadataRegistry());
+  auto HWS = std::make_unique<Scheduler>(SM, *LSU, /*CacheManager=*/nullptr);
+
+  auto Fetch = std::make_unique<EntryStage>(SrcMgr, MCA.getMetadataRegistry());
+  auto Dispatch = std::make_unique<DispatchStage>(STI, MRI, PO.DispatchWidth,
+                                                   *RCU, *PRF);
+  auto Execute =
+      std::make_unique<ExecuteStage>(*HWS, PO.EnableBottleneckAnalysis);
+  auto Retire = std::make_unique<RetireStage>(*RCU, *PRF, *LSU);
+
+  MCA.addHardwareUnit(std::move(RCU));
+  MCA.addHardwareUnit(std::move(PRF));
+  MCA.addHardwareUnit(std::move(LSU));
+  MCA.addHardwareUnit(std::move(HWS));
+
+  auto StagePipeline = std::make_unique<Pipeline>();
+  StagePipeline->appendStage(std::move(Fetch));
+  StagePipeline->appendStage(std::move(Dispatch));
+  StagePipeline->appendStage(std::move(Execute));
+  StagePipeline->appendStage(std::move(Retire));
+  return StagePipeline;
+}
+
+// Parse, lower, and simulate every region in Path with the batch pipeline
+static Expected<RunResult> runBatchOnce(const MCComponents &MC,
+                                        StringRef Path) {
+  auto StartTime = std::chrono::steady_clock::now();
+
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path);
+  if (!ErrOrBuffer)
+    return errorCodeToError(ErrOrBuffer.getError());
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(std::move(*ErrOrBuffer), SMLoc());
+
+  Triple TheTriple(TripleName);
+  MCContext Ctx(TheTriple, MC.MAI.get(), MC.MRI.get(), MC.STI.get(),
+                &SrcMgr);
+  std::unique_ptr<MCObjectFileInfo> MOFI(
+    MC.TheTarget->createMCObjectFileInfo(Ctx, /*PIC=*/false));
+  Ctx.setObjectFileInfo(MOFI.get());
+
+  mca::AsmCodeRegionGenerator CRG(*MC.TheTarget, SrcMgr, Ctx, *MC.MAI,
+                                  *MC.STI, *MC.MCII);
+  auto RegionsOrErr = CRG.parseCodeRegions();
+  if (!RegionsOrErr)
+    return RegionsOrErr.takeError();
+
+  mca::InstrBuilder IB(*MC.STI, *MC.MCII, *MC.MRI, MC.MCIA.get());
+  const MCSchedModel &SM = MC.STI->getSchedModel();
+
+  RunResult Result;
+  Result.Input = Path.str();
+  unsigned RegionIdx = 0U;
+  for (const auto &Region : *RegionsOrErr) {
+    ArrayRef<MCInst> MCIs = Region->getInstructions();
+    if (MCIs.empty())
+      continue;
+
+    // Drop the same instructions as MCAWorker::buildInstructions,
+    // including those InstrBuilder fails to handle.
+    SmallVector<std::unique_ptr<mca::Instruction>, 16> Insts;
+    for (const MCInst &MCI : MCIs) {
+      const auto &MCID = MC.MCII->get(MCI.getOpcode());
+      if (MCID.isReturn() || (!PreserveCallInst && MCID.isCall()))
+        continue;
+      auto InstOrErr = IB.createInstruction(MCI);
+      if (!InstOrErr) {
+        consumeError(InstOrErr.takeError());
+        continue;
+      }
+      Insts.push_back(std::move(*InstOrErr));
+    }
+
+    mca::Context MCA(*MC.MRI, *MC.STI);
+    mca::CircularSourceMgr S(Insts, /*Iterations=*/1);
+    auto P = createBatchPipeline(MCA, *MC.STI, *MC.MRI, S);
+    // Number of MCInst, just like what llvm-mcad counts. SummaryView only
+    // takes reference of it, so it has to outlive the printer.
+    size_t NumMCIs = MCIs.size();
+    std::function<size_t(void)> GetNumInstructions = [NumMCIs] {
+      return NumMCIs;
+    };
+    mca::PipelinePrinter Printer(*P, mca::View::OK_READABLE);
+    auto SV = std::make_unique<mca::SummaryView>(SM, GetNumInstructions, 0U);
+    const mca::SummaryView *SummaryView = SV.get();
+    Printer.addView(std::move(SV));
+
+    if (!Insts.empty()) {
+      Expected<unsigned> Cycles = P->run();
+      if (!Cycles)
+        return Cycles.takeError();
+    }
+    Printer.flush();
+
+    mca::SummaryView::DisplayValues DV;
+    SummaryView->collectData(DV);
+    RegionStats Stats;
+    Stats.Description = Region->getDescription().str();
+    if (Stats.Description.empty())
+      Stats.Description = "Region [" + std::to_string(RegionIdx++) + "]";
+    Stats.Instructions = DV.TotalInstructions;
+    Stats.Cycles = DV.TotalCycles;
+    Stats.UOps = DV.TotalUOps;
+    Result.Regions.push_back(std::move(Stats));
+  }
+
+  auto EndTime = std::chrono::steady_clock::now();
+  Result.WallMs = std::chrono::duration<double, std::milli>(EndTime - StartTime)
+                    .count();
+  return std::move(Result);
+}
+
+// Pick up the numbers of every region from the summary views printed by
+// llvm-mcad.
+static std::vector<RegionStats> parseSummaries(StringRef Output) {
+  std::vector<RegionStats> Regions;
+  StringRef Description;
+  SmallVector<StringRef, 64> Lines;
+  Output.split(Lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (StringRef Line : Lines) {
+    Line = Line.trim();
+    if (Line.consume_front("=== Printing report for ") &&
+        Line.consume_back(" ===")) {
+      Description = Line;
+      continue;
+    }
+
+    uint64_t Value;
+    if (Line.consume_front("Instructions:")) {
+      Regions.emplace_back();
+      Regions.back().Description = Description.str();
+      Description = "";
+      if (!Line.trim().getAsInteger(10, Value))
+        Regions.back().Instructions = Value;
+    } else if (!Regions.empty() && Line.consume_front("Total Cycles:")) {
+      if (!Line.trim().getAsInteger(10, Value))
+        Regions.back().Cycles = Value;
+    } else if (!Regions.empty() && Line.consume_front("Total uOps:")) {
+      if (!Line.trim().getAsInteger(10, Value))
+        Regions.back().UOps = Value;
+    }
+  }
+  return Regions;
+}
+
+// Run llvm-mcad on Path with the given chunk size. Return the wall time
+// and the summaries it prints.
+static Expected<RunResult> runIncrementalOnce(StringRef Path,
+                                              unsigned ChunkSize) {
+  SmallString<128> OutputPath, LogPath;
+  if (auto EC = sys::fs::createTemporaryFile("mcad-bench", "out", OutputPath))
+    return errorCodeToError(EC);
+  if (auto EC = sys::fs::createTemporaryFile("mcad-bench", "log", LogPath))
+    return errorCodeToError(EC);
+  auto CleanUp = make_scope_exit([&] {
+    sys::fs::remove(OutputPath);
+    sys::fs::remove(LogPath);
+  });
+
+  std::vector<std::string> Args{
+    LLVMMcadPath, "-mtriple=" + TripleName, "-mcpu=" + CPUName,
+    "-input-asm-file=" + Path.str(),
+    "-mca-output=" + std::string(OutputPath.str())};
+  if (ChunkSize)
+    Args.push_back("-mca-max-chunk-size=" + std::to_string(ChunkSize));
+  if (PreserveCallInst)
+    Args.push_back("-use-call-inst");
+  SmallVector<StringRef, 8> ArgRefs(Args.begin(), Args.end());
+  Optional<StringRef> Redirects[] = {StringRef(""), StringRef(""),
+                                     StringRef(LogPath)};
+
+  std::string ErrMsg;
+  auto StartTime = std::chrono::steady_clock::now();
+  int ExitCode = sys::ExecuteAndWait(LLVMMcadPath, ArgRefs, llvm::None,
+                                     Redirects, Timeout, /*MemoryLimit=*/0,
+                                     &ErrMsg);
+  auto EndTime = std::chrono::steady_clock::now();
+  if (ExitCode) {
+    std::string Log;
+    if (auto ErrOrBuffer = MemoryBuffer::getFile(LogPath))
+      Log = (*ErrOrBuffer)->getBuffer().take_back(2048).str();
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "llvm-mcad exited with %d: %s\n%s", ExitCode,
+                             ErrMsg.c_str(), Log.c_str());
+  }
+
+  RunResult Result;
+  Result.Input = Path.str();
+  Result.ChunkSize = ChunkSize;
+  Result.WallMs = std::chrono::duration<double, std::milli>(EndTime - StartTime)
+                    .count();
+  auto ErrOrBuffer = MemoryBuffer::getFile(OutputPath);
+  if (!ErrOrBuffer)
+    return errorCodeToError(ErrOrBuffer.getError());
+  Result.Regions = parseSummaries((*ErrOrBuffer)->getBuffer());
+  return std::move(Result);
+}
+
+// Keep the fastest one of all repetitions
+template<typename RunFuncTy>
+static Expected<RunResult> repeat(RunFuncTy RunOnce) {
+  Optional<RunResult> Best;
+  for (unsigned i = 0U; i < std::max(NumRepeats.getValue(), 1U); ++i) {
+    auto ROrErr = RunOnce();
+    if (!ROrErr)
+      return ROrErr.takeError();
+    if (!Best || ROrErr->WallMs < Best->WallMs)
+      Best = std::move(*ROrErr);
+  }
+  return std::move(*Best);
+}
+
+// Time llvm-mcad takes to start up and shut down, which is measured on
+// an empty input.
+static Expected<double> measureStartUpTime() {
+  SmallString<128> EmptyInput;
+  if (auto EC = sys::fs::createTemporaryFile("mcad-bench", "s", EmptyInput))
+    return errorCodeToError(EC);
+  auto CleanUp = make_scope_exit([&] { sys::fs::remove(EmptyInput); });
+
+  auto ROrErr = repeat([&] { return runIncrementalOnce(EmptyInput, 0U); });
+  if (!ROrErr)
+    return ROrErr.takeError();
+  return ROrErr->WallMs;
+}
+
+static double getDiffPercent(uint64_t Value, uint64_t Base) {
+  if (!Base)
+    return Value? 100.0 : 0.0;
+  return (double(Value) - double(Base)) * 100.0 / double(Base);
+}
+
+// Compare regions of R with those from the batch pipeline
+static void computeDivergence(RunResult &R, const RunResult &Batch) {
+  R.MaxCyclesDiff = R.MaxUOpsDiff = 0.0;
+  R.NumMismatchedRegions = 0U;
+  size_t NumRegions = std::max(R.Regions.size(), Batch.Regions.size());
+  for (size_t i = 0U; i < NumRegions; ++i) {
+    if (i >= R.Regions.size() || i >= Batch.Regions.size() ||
+        R.Regions[i].Instructions != Batch.Regions[i].Instructions) {
+      ++R.NumMismatchedRegions;
+      continue;
+    }
+    const auto &Cur = R.Regions[i], &Base = Batch.Regions[i];
+    double CyclesDiff = getDiffPercent(Cur.Cycles, Base.Cycles),
+           UOpsDiff = getDiffPercent(Cur.UOps, Base.UOps);
+    if (std::abs(CyclesDiff) > std::abs(R.MaxCyclesDiff))
+      R.MaxCyclesDiff = CyclesDiff;
+    if (std::abs(UOpsDiff) > std::abs(R.MaxUOpsDiff))
+      R.MaxUOpsDiff = UOpsDiff;
+  }
+}
+
+static void printResults(ArrayRef<RunResult> Results, raw_ostream &OS) {
+  OS << formatv("{0,-32} {1,8} {2,10} {3,14} {4,9} {5,12} {6,12} {7,10}\n",
+                "input", "chunk", "wall ms", "insts/s", "vs batch",
+                "cycles diff", "uOps diff", "mismatch");
+  const RunResult *Batch = nullptr;
+  for (const auto &R : Results) {
+    StringRef Input = sys::path::filename(R.Input);
+    if (R.isBatch()) {
+      Batch = &R;
+      OS << formatv("{0,-32} {1,8} {2,10:f1} {3,14:f0} {4,9} {5,12} {6,12} "
+                    "{7,10}\n",
+                    Input, "batch", R.WallMs, R.getInstsPerSec(), "-", "-",
+                    "-", "-");
+      continue;
+    }
+    std::string Slowdown = "-";
+    if (Batch && Batch->WallMs > 0.0)
+      Slowdown = formatv("{0:f2}x", R.WallMs / Batch->WallMs).str();
+    OS << formatv("{0,-32} {1,8} {2,10:f1} {3,14:f0} {4,9} {5,11:f2}% "
+                  "{6,11:f2}% {7,10}\n",
+                  Input, R.ChunkSize, R.WallMs, R.getInstsPerSec(), Slowdown,
+                  R.MaxCyclesDiff, R.MaxUOpsDiff, R.NumMismatchedRegions);
+  }
+}
+
+static Error writeResults(StringRef Path, ArrayRef<RunResult> Results,
+                          double StartUpMs) {
+  json::Array Runs;
+  for (const auto &R : Results)
+    Runs.push_back(R.toJSON());
+  json::Object JO({{"llvm-mcad", LLVMMcadPath},
+                   {"triple", TripleName},
+                   {"cpu", CPUName},
+                   {"startup_ms", StartUpMs},
+                   {"runs", std::move(Runs)}});
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC)
+    return errorCodeToError(EC);
+  OS << formatv("{0:2}", json::Value(std::move(JO))) << "\n";
+  return Error::success();
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  InitializeAllTargetInfos();
+  InitializeAllTargetMCs();
+  InitializeAllAsmParsers();
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "MCAD incremental vs. batch MCA benchmark");
+
+  if (TripleName.empty())
+    TripleName = Triple::normalize(sys::getDefaultTargetTriple());
+  // Resolve it here s.t. both sides use the same CPU
+  if (CPUName == "native")
+    CPUName = std::string(sys::getHostCPUName());
+  if (ChunkSizes.empty())
+    for (unsigned Size : {100U, 1000U, 10000U, 100000U})
+      ChunkSizes.push_back(Size);
+
+  auto MCOrErr = createMCComponents();
+  if (!MCOrErr) {
+    logAllUnhandledErrors(MCOrErr.takeError(), WithColor::error());
+    return 1;
+  }
+
+  auto StartUpOrErr = measureStartUpTime();
+  if (!StartUpOrErr) {
+    logAllUnhandledErrors(StartUpOrErr.takeError(),
+                          WithColor::error() << "llvm-mcad: ");
+    return 1;
+  }
+  double StartUpMs = *StartUpOrErr;
+  outs() << formatv("llvm-mcad takes {0:f1} ms to start up, which is "
+                    "excluded from the wall time of its runs\n\n",
+                    StartUpMs);
+
+  std::vector<RunResult> Results;
+  unsigned NumFailures = 0U;
+  for (const auto &Input : InputFiles) {
+    auto BatchOrErr = repeat([&] { return runBatchOnce(*MCOrErr, Input); });
+    if (!BatchOrErr) {
+      logAllUnhandledErrors(BatchOrErr.takeError(),
+                            WithColor::error() << Input << ": ");
+      ++NumFailures;
+      continue;
+    }
+    Results.push_back(std::move(*BatchOrErr));
+    size_t BatchIdx = Results.size() - 1;
+
+    for (unsigned ChunkSize : ChunkSizes) {
+      if (!ChunkSize)
+        continue;
+      auto ROrErr = repeat([&] {
+        return runIncrementalOnce(Input, ChunkSize);
+      });
+      if (!ROrErr) {
+        logAllUnhandledErrors(ROrErr.takeError(),
+                              WithColor::error() << Input << " (chunk size "
+                                                 << ChunkSize << "): ");
+        ++NumFailures;
+        continue;
+      }
+      ROrErr->WallMs = std::max(ROrErr->WallMs - StartUpMs, 0.0);
+      computeDivergence(*ROrErr, Results[BatchIdx]);
+      Results.push_back(std::move(*ROrErr));
+    }
+  }
+
+  printResults(Results, outs());
+
+  if (!OutputFile.empty())
+    if (auto E = writeResults(OutputFile, Results, StartUpMs)) {
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << OutputFile << ": ");
+      return 1;
+    }
+
+  return NumFailures? 1 : 0;
+}
@@ -0,0 +1,10 @@
+# Long chains of dependent integer and vector operations, which stress
+# the scheduler and the register file.
+.rept 50000
+  addq   %rax, %rbx
+  imulq  %rbx, %rcx
+  xorq   %rcx, %rax
+  vaddps %xmm0, %xmm1, %xmm1
+  vmulps %xmm1, %xmm2, %xmm2
+  vfmadd231ps %xmm2, %xmm3, %xmm0
+.endr
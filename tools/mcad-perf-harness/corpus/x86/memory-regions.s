@@ -0,0 +1,27 @@
+# Loads and stores in several regions, which stress the LSU, the cache
+# simulation, and the per-region reports.
+# LLVM-MCA-BEGIN copy
+.rept 20000
+  movq  (%rsi), %rax
+  movq  %rax, (%rdi)
+  addq  $8, %rsi
+  addq  $8, %rdi
+.endr
+# LLVM-MCA-END copy
+
+# LLVM-MCA-BEGIN reduce
+.rept 20000
+  addq  (%rsi), %rax
+  addq  8(%rsi), %rbx
+  addq  $16, %rsi
+.endr
+# LLVM-MCA-END reduce
+
+# LLVM-MCA-BEGIN copy
+.rept 20000
+  movq  (%rsi), %rax
+  movq  %rax, (%rdi)
+  addq  $8, %rsi
+  addq  $8, %rdi
+.endr
+# LLVM-MCA-END copy
@@ -0,0 +1,638 @@
+// Run a corpus of recorded workloads -- assembly files and QEMU relay
+// message streams (see the relay's `-record-stream` option) -- through
+// llvm-mcad in several modes. Wall time, throughput, peak memory, and a
+// checksum of the output of every run are compared against a baseline.
+//
+// Usage:
+//   mcad-perf-harness corpus/manifest.json -llvm-mcad=path/to/llvm-mcad
+//                     -baseline=corpus/baseline.json -o results.json
+// The baseline is only written with -update-baseline. Comparing against a
+// missing or empty baseline fails.
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+  ManifestFile(cl::Positional, cl::desc("<corpus manifest>"), cl::Required);
+
+static cl::opt<std::string>
+  LLVMMcadPath("llvm-mcad", cl::desc("Path to the llvm-mcad to measure"),
+               cl::Required);
+
+static cl::opt<std::string>
+  QemuBrokerPlugin("qemu-broker-plugin",
+                   cl::desc("Path to libMCADQemuBroker.so. Workloads "
+                            "recorded from QEMU are skipped without it"),
+                   cl::init(""));
+
+static cl::opt<std::string>
+  BaselineFile("baseline",
+               cl::desc("Results to compare with. It's only written with "
+                        "-update-baseline"),
+               cl::init(""));
+
+static cl::opt<bool>
+  UpdateBaseline("update-baseline",
+                 cl::desc("Replace the baseline with the results of this "
+                          "run instead of comparing with it"),
+                 cl::init(false));
+
+static cl::opt<std::string>
+  OutputFile("o", cl::desc("Write the results to this file in JSON format"),
+             cl::init(""));
+
+static cl::opt<unsigned>
+  NumRepeats("repeat",
+             cl::desc("Run every workload this many times and keep the "
+                      "fastest one"),
+             cl::init(3U));
+
+static cl::opt<double>
+  TimeTolerance("time-tolerance",
+                cl::desc("Percentage of wall time increase, or throughput "
+                         "decrease, that is considered a regression"),
+                cl::init(10.0));
+
+static cl::opt<double>
+  RSSTolerance("rss-tolerance",
+               cl::desc("Percentage of peak memory increase that is "
+                        "considered a regression"),
+               cl::init(10.0));
+
+static cl::opt<unsigned>
+  Timeout("timeout", cl::desc("Kill a run after this many seconds"),
+          cl::init(600U));
+
+static cl::opt<std::string>
+  WorkloadFilter("filter",
+                 cl::desc("Only run workloads whose name contains this"),
+                 cl::init(""));
+
+namespace {
+struct Workload {
+  std::string Name;
+  // Exactly one of them is set
+  std::string AsmInput, Stream;
+  std::string Triple, CPU;
+  std::vector<std::string> Modes;
+  // Arguments appended to every run
+  std::vector<std::string> Args;
+  // Used by the cache-sim mode
+  std::string CacheConfig;
+  // Used by the regions mode on streams
+  std::string BinaryRegions;
+};
+
+struct RunResult {
+  std::string Workload, Mode;
+  double WallMs = 0.0;
+  int64_t Instructions = 0;
+  uint64_t PeakRSSKiB = 0U;
+  std::string Checksum;
+
+  std::string getKey() const { return Workload + "/" + Mode; }
+
+  double getInstsPerSec() const {
+    return WallMs > 0.0? Instructions * 1000.0 / WallMs : 0.0;
+  }
+
+  json::Value toJSON() const {
+    return json::Object({{"workload", Workload},
+                         {"mode", Mode},
+                         {"wall_ms", WallMs},
+                         {"instructions", Instructions},
+                         {"insts_per_sec", getInstsPerSec()},
+                         {"peak_rss_kib", int64_t(PeakRSSKiB)},
+                         {"checksum", Checksum}});
+  }
+
+  static Optional<RunResult> fromJSON(const json::Object &JO) {
+    RunResult R;
+    auto Workload = JO.getString("workload"), Mode = JO.getString("mode"),
+         Checksum = JO.getString("checksum");
+    auto WallMs = JO.getNumber("wall_ms");
+    auto Instructions = JO.getInteger("instructions"),
+         PeakRSS = JO.getInteger("peak_rss_kib");
+    if (!Workload || !Mode || !Checksum || !WallMs || !Instructions ||
+        !PeakRSS)
+      return llvm::None;
+    R.Workload = Workload->str();
+    R.Mode = Mode->str();
+    R.Checksum = Checksum->str();
+    R.WallMs = *WallMs;
+    R.Instructions = *Instructions;
+    R.PeakRSSKiB = *PeakRSS;
+    return R;
+  }
+};
+} // end anonymous namespace
+
+static Expected<std::vector<Workload>> readManifest(StringRef Path) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path);
+  if (!ErrOrBuffer)
+    return errorCodeToError(ErrOrBuffer.getError());
+  auto JsonOrErr = json::parse((*ErrOrBuffer)->getBuffer());
+  if (!JsonOrErr)
+    return JsonOrErr.takeError();
+
+  const json::Object *TopLevel = JsonOrErr->getAsObject();
+  const json::Array *RawWorkloads =
+    TopLevel? TopLevel->getArray("workloads") : nullptr;
+  if (!RawWorkloads)
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "Expecting a `workloads` array");
+
+  // Paths are relative to the manifest
+  StringRef BaseDir = sys::path::parent_path(Path);
+  auto getPath = [&](const json::Object &JO, StringRef Key) -> std::string {
+    auto Str = JO.getString(Key);
+    if (!Str)
+      return "";
+    SmallString<128> P(BaseDir);
+    sys::path::append(P, *Str);
+    return std::string(P.str());
+  };
+  auto getStrings = [](const json::Object &JO, StringRef Key) {
+    std::vector<std::string> Strs;
+    if (const auto *Arr = JO.getArray(Key))
+      for (const auto &Elt : *Arr)
+        if (auto Str = Elt.getAsString())
+          Strs.push_back(Str->str());
+    return Strs;
+  };
+
+  std::vector<Workload> Workloads;
+  for (const auto &Elt : *RawWorkloads) {
+    const json::Object *JO = Elt.getAsObject();
+    if (!JO)
+      continue;
+    Workload W;
+    if (auto Name = JO->getString("name"))
+      W.Name = Name->str();
+    W.AsmInput = getPath(*JO, "input");
+    W.Stream = getPath(*JO, "stream");
+    if (auto Triple = JO->getString("triple"))
+      W.Triple = Triple->str();
+    if (auto CPU = JO->getString("cpu"))
+      W.CPU = CPU->str();
+    W.Modes = getStrings(*JO, "modes");
+    W.Args = getStrings(*JO, "args");
+    W.CacheConfig = getPath(*JO, "cache-config");
+    W.BinaryRegions = getPath(*JO, "binary-regions");
+
+    if (W.Name.empty() || W.Triple.empty() ||
+        W.AsmInput.empty() == W.Stream.empty())
+      return createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Workload `%s` needs a name, a triple, and either an input or "
+        "a stream", W.Name.c_str());
+    Workloads.push_back(std::move(W));
+  }
+  return Workloads;
+}
+
+// Extra llvm-mcad arguments of a mode. Return false if the mode doesn't
+// apply to W.
+static bool getModeArgs(const Workload &W, StringRef Mode,
+                        std::vector<std::string> &Args) {
+  bool IsStream = !W.Stream.empty();
+  if (Mode == "asm")
+    return !IsStream;
+  if (Mode == "qemu")
+    return IsStream;
+  if (Mode == "timeline") {
+    Args.push_back("-mca-show-timeline-view");
+    return true;
+  }
+  if (Mode == "cache-sim") {
+    if (W.CacheConfig.empty())
+      return false;
+    Args.push_back("-cache-sim-config=" + W.CacheConfig);
+    return true;
+  }
+  if (Mode == "regions") {
+    // Regions in assembly files are delimited by LLVM-MCA-BEGIN/END
+    // comments in the input itself.
+    Args.push_back("-aggregate-regions");
+    if (IsStream) {
+      if (W.BinaryRegions.empty())
+        return false;
+      Args.push_back("-broker-plugin-arg-binary-regions=" + W.BinaryRegions);
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool sendFully(int FD, const char *Data, size_t Size) {
+  while (Size) {
+    ssize_t Len = ::write(FD, Data, Size);
+    if (Len < 0)
+      return false;
+    Data += Len;
+    Size -= Len;
+  }
+  return true;
+}
+
+// Act as the QEMU relay and send the recorded stream to SocketPath
+static Error replayStream(StringRef SocketPath, StringRef StreamFile,
+                          std::chrono::seconds ConnectTimeout) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(StreamFile, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+  if (!ErrOrBuffer)
+    return errorCodeToError(ErrOrBuffer.getError());
+  StringRef Stream = (*ErrOrBuffer)->getBuffer();
+
+  sockaddr_un Addr;
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path))
+    return createStringError(std::make_error_code(std::errc::filename_too_long),
+                             "Socket path is too long");
+  ::strcpy(Addr.sun_path, SocketPath.str().c_str());
+
+  // Wait for llvm-mcad to start listening
+  int Sockt = -1;
+  auto Deadline = std::chrono::steady_clock::now() + ConnectTimeout;
+  while (true) {
+    Sockt = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Sockt < 0)
+      return errorCodeToError(std::error_code(errno, std::generic_category()));
+    if (!::connect(Sockt, (sockaddr*)&Addr, sizeof(Addr)))
+      break;
+    ::close(Sockt);
+    if (std::chrono::steady_clock::now() >= Deadline)
+      return createStringError(std::make_error_code(std::errc::timed_out),
+                               "Failed to connect to llvm-mcad");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  bool Sent = sendFully(Sockt, Stream.data(), Stream.size());
+  // Drain region results, if the recorded relay asked for them, until
+  // llvm-mcad closes the connection.
+  ::shutdown(Sockt, SHUT_WR);
+  char Buffer[4096];
+  while (::read(Sockt, Buffer, sizeof(Buffer)) > 0);
+  ::close(Sockt);
+  if (!Sent)
+    return createStringError(std::make_error_code(std::errc::broken_pipe),
+                             "Failed to send the stream");
+  return Error::success();
+}
+
+static std::string getChecksum(StringRef Path) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path);
+  if (!ErrOrBuffer)
+    return "";
+  MD5 Hash;
+  Hash.update((*ErrOrBuffer)->getBuffer());
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  return std::string(Result.digest().str());
+}
+
+static int64_t getInstructionCount(StringRef MetricsPath) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(MetricsPath);
+  if (!ErrOrBuffer)
+    return 0;
+  auto JsonOrErr = json::parse((*ErrOrBuffer)->getBuffer());
+  if (!JsonOrErr) {
+    consumeError(JsonOrErr.takeError());
+    return 0;
+  }
+  if (const auto *JO = JsonOrErr->getAsObject())
+    if (auto Num = JO->getInteger("simulation.instructions"))
+      return *Num;
+  return 0;
+}
+
+static void removeFiles(ArrayRef<StringRef> Paths) {
+  for (StringRef P : Paths)
+    sys::fs::remove(P);
+}
+
+static Expected<RunResult> runOnce(const Workload &W, StringRef Mode,
+                                   ArrayRef<std::string> ModeArgs) {
+  SmallString<128> OutputPath, MetricsPath, LogPath, SocketPath;
+  if (auto EC = sys::fs::createTemporaryFile("mcad-perf", "out", OutputPath))
+    return errorCodeToError(EC);
+  if (auto EC = sys::fs::createTemporaryFile("mcad-perf", "json",
+                                             MetricsPath))
+    return errorCodeToError(EC);
+  if (auto EC = sys::fs::createTemporaryFile("mcad-perf", "log", LogPath))
+    return errorCodeToError(EC);
+  auto CleanUp = make_scope_exit([&] {
+    removeFiles({OutputPath, MetricsPath, LogPath, SocketPath});
+  });
+
+  std::vector<std::string> Args{
+    LLVMMcadPath, "-mtriple=" + W.Triple,
+    "-mca-output=" + std::string(OutputPath.str()),
+    "-metrics-output=" + std::string(MetricsPath.str())};
+  if (!W.CPU.empty())
+    Args.push_back("-mcpu=" + W.CPU);
+  if (W.Stream.empty()) {
+    Args.push_back("-input-asm-file=" + W.AsmInput);
+  } else {
+    SmallString<64> TempDir;
+    sys::path::system_temp_directory(/*ErasedOnReboot=*/true, TempDir);
+    sys::path::append(TempDir, "mcad-perf-%%%%%%.sock");
+    sys::fs::createUniquePath(TempDir, SocketPath, /*MakeAbsolute=*/false);
+    Args.push_back("-load-broker-plugin=" + QemuBrokerPlugin);
+    Args.push_back("-broker-plugin-arg-host=" + std::string(SocketPath.str()));
+  }
+  Args.insert(Args.end(), W.Args.begin(), W.Args.end());
+  Args.insert(Args.end(), ModeArgs.begin(), ModeArgs.end());
+  SmallVector<StringRef, 16> ArgRefs(Args.begin(), Args.end());
+
+  Optional<StringRef> Redirects[] = {StringRef(""), StringRef(""),
+                                     StringRef(LogPath)};
+  std::string ErrMsg;
+  Optional<sys::ProcessStatistics> Stats;
+  int ExitCode;
+  auto StartTime = std::chrono::steady_clock::now();
+  if (W.Stream.empty()) {
+    ExitCode = sys::ExecuteAndWait(LLVMMcadPath, ArgRefs, llvm::None,
+                                   Redirects, Timeout, /*MemoryLimit=*/0,
+                                   &ErrMsg, /*ExecutionFailed=*/nullptr,
+                                   &Stats);
+  } else {
+    sys::ProcessInfo PI = sys::ExecuteNoWait(LLVMMcadPath, ArgRefs,
+                                             llvm::None, Redirects,
+                                             /*MemoryLimit=*/0, &ErrMsg);
+    if (!PI.Pid)
+      return createStringError(std::make_error_code(std::errc::io_error),
+                               ErrMsg);
+    if (auto E = replayStream(SocketPath, W.Stream,
+                              std::chrono::seconds(Timeout))) {
+      ::kill(PI.Pid, SIGKILL);
+      sys::Wait(PI, /*SecondsToWait=*/0, /*WaitUntilTerminates=*/true);
+      return E;
+    }
+    PI = sys::Wait(PI, Timeout, /*WaitUntilTerminates=*/false, &ErrMsg,
+                   &Stats);
+    ExitCode = PI.ReturnCode;
+  }
+  auto EndTime = std::chrono::steady_clock::now();
+
+  if (ExitCode) {
+    std::string Log;
+    if (auto ErrOrBuffer = MemoryBuffer::getFile(LogPath))
+      Log = (*ErrOrBuffer)->getBuffer().take_back(2048).str();
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "llvm-mcad exited with %d: %s\n%s", ExitCode,
+                             ErrMsg.c_str(), Log.c_str());
+  }
+
+  RunResult R;
+  R.Workload = W.Name;
+  R.Mode = Mode.str();
+  R.WallMs = std::chrono::duration<double, std::milli>(EndTime - StartTime)
+               .count();
+  R.Instructions = getInstructionCount(MetricsPath);
+  R.PeakRSSKiB = Stats? Stats->PeakMemory : 0U;
+  R.Checksum = getChecksum(OutputPath);
+  return R;
+}
+
+// Keep the fastest run and the largest peak memory of all repetitions
+static Expected<RunResult> run(const Workload &W, StringRef Mode,
+                               ArrayRef<std::string> ModeArgs) {
+  Optional<RunResult> Best;
+  for (unsigned i = 0U; i < std::max(NumRepeats.getValue(), 1U); ++i) {
+    auto ROrErr = runOnce(W, Mode, ModeArgs);
+    if (!ROrErr)
+      return ROrErr.takeError();
+    if (!Best) {
+      Best = *ROrErr;
+      continue;
+    }
+    if (ROrErr->Checksum != Best->Checksum)
+      WithColor::warning() << W.Name << "/" << Mode
+                           << ": output differs between repetitions\n";
+    uint64_t PeakRSS = std::max(Best->PeakRSSKiB, ROrErr->PeakRSSKiB);
+    if (ROrErr->WallMs < Best->WallMs)
+      Best = *ROrErr;
+    Best->PeakRSSKiB = PeakRSS;
+  }
+  return *Best;
+}
+
+static Expected<StringMap<RunResult>> readResults(StringRef Path) {
+  auto ErrOrBuffer = MemoryBuffer::getFile(Path);
+  if (!ErrOrBuffer)
+    return errorCodeToError(ErrOrBuffer.getError());
+  auto JsonOrErr = json::parse((*ErrOrBuffer)->getBuffer());
+  if (!JsonOrErr)
+    return JsonOrErr.takeError();
+
+  StringMap<RunResult> Results;
+  const json::Object *TopLevel = JsonOrErr->getAsObject();
+  if (const json::Array *Runs = TopLevel? TopLevel->getArray("runs")
+                                        : nullptr)
+    for (const auto &Elt : *Runs)
+      if (const auto *JO = Elt.getAsObject())
+        if (auto R = RunResult::fromJSON(*JO))
+          Results.insert({R->getKey(), std::move(*R)});
+  return Results;
+}
+
+static Error writeResults(StringRef Path, ArrayRef<RunResult> Results) {
+  json::Array Runs;
+  for (const auto &R : Results)
+    Runs.push_back(R.toJSON());
+  json::Object JO({{"llvm-mcad", LLVMMcadPath},
+                   {"manifest", ManifestFile},
+                   {"runs", std::move(Runs)}});
+
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC)
+    return errorCodeToError(EC);
+  OS << formatv("{0:2}", json::Value(std::move(JO))) << "\n";
+  return Error::success();
+}
+
+static std::string formatChange(double Current, double Base) {
+  if (Base <= 0.0)
+    return "-";
+  double Change = (Current - Base) * 100.0 / Base;
+  return formatv("{0}{1:f1}%", Change >= 0.0? "+" : "", Change).str();
+}
+
+// Print every result along with its change against the baseline. Return
+// the number of regressions.
+static unsigned compareResults(ArrayRef<RunResult> Results,
+                               const StringMap<RunResult> *Baseline,
+                               raw_ostream &OS) {
+  OS << formatv("{0,-36} {1,10} {2,8} {3,14} {4,8} {5,10} {6,8}  {7}\n",
+                "workload/mode", "wall ms", "", "insts/s", "",
+                "RSS MiB", "", "status");
+
+  unsigned NumRegressions = 0U;
+  for (const auto &R : Results) {
+    const RunResult *Base = nullptr;
+    if (Baseline) {
+      auto It = Baseline->find(R.getKey());
+      if (It != Baseline->end())
+        Base = &It->second;
+    }
+
+    SmallVector<std::string, 2> Problems;
+    std::string TimeChange = "-", ThroughputChange = "-", RSSChange = "-";
+    if (Base) {
+      TimeChange = formatChange(R.WallMs, Base->WallMs);
+      ThroughputChange = formatChange(R.getInstsPerSec(),
+                                      Base->getInstsPerSec());
+      RSSChange = formatChange(R.PeakRSSKiB, Base->PeakRSSKiB);
+
+      double TimeTol = TimeTolerance / 100.0, RSSTol = RSSTolerance / 100.0;
+      if (R.WallMs > Base->WallMs * (1.0 + TimeTol))
+        Problems.push_back("slower");
+      else if (R.getInstsPerSec() < Base->getInstsPerSec() * (1.0 - TimeTol))
+        Problems.push_back("lower throughput");
+      if (Base->PeakRSSKiB &&
+          R.PeakRSSKiB > Base->PeakRSSKiB * (1.0 + RSSTol))
+        Problems.push_back("more memory");
+      if (R.Checksum != Base->Checksum ||
+          R.Instructions != Base->Instructions)
+        Problems.push_back("output changed");
+    }
+    NumRegressions += !Problems.empty();
+
+    std::string Status = !Base? "new" :
+                         Problems.empty()? "ok" : join(Problems, ", ");
+    OS << formatv("{0,-36} {1,10:f1} {2,8} {3,14:f0} {4,8} {5,10:f1} {6,8}  "
+                  "{7}\n",
+                  R.getKey(), R.WallMs, TimeChange, R.getInstsPerSec(),
+                  ThroughputChange, R.PeakRSSKiB / 1024.0, RSSChange, Status);
+  }
+  return NumRegressions;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "MCAD end-to-end performance harness");
+
+  auto WorkloadsOrErr = readManifest(ManifestFile);
+  if (!WorkloadsOrErr) {
+    logAllUnhandledErrors(WorkloadsOrErr.takeError(),
+                          WithColor::error() << ManifestFile << ": ");
+    return 1;
+  }
+
+  std::vector<RunResult> Results;
+  unsigned NumFailures = 0U;
+  for (const auto &W : *WorkloadsOrErr) {
+    if (!WorkloadFilter.empty() && !StringRef(W.Name).contains(WorkloadFilter))
+      continue;
+    if (!W.Stream.empty() && QemuBrokerPlugin.empty()) {
+      WithColor::note() << "Skipping " << W.Name
+                        << " since -qemu-broker-plugin is not given\n";
+      continue;
+    }
+    if (!sys::fs::exists(W.Stream.empty()? W.AsmInput : W.Stream)) {
+      WithColor::note() << "Skipping " << W.Name
+                        << " since its input doesn't exist\n";
+      continue;
+    }
+
+    for (const auto &Mode : W.Modes) {
+      std::vector<std::string> ModeArgs;
+      if (!getModeArgs(W, Mode, ModeArgs)) {
+        WithColor::warning() << "Mode " << Mode << " doesn't apply to "
+                             << W.Name << "\n";
+        continue;
+      }
+      errs() << "Running " << W.Name << "/" << Mode << "...\n";
+      auto ROrErr = run(W, Mode, ModeArgs);
+      if (!ROrErr) {
+        logAllUnhandledErrors(ROrErr.takeError(),
+                              WithColor::error() << W.Name << "/" << Mode
+                                                 << ": ");
+        ++NumFailures;
+        continue;
+      }
+      Results.push_back(std::move(*ROrErr));
+    }
+  }
+
+  if (!OutputFile.empty())
+    if (auto E = writeResults(OutputFile, Results)) {
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << OutputFile << ": ");
+      return 1;
+    }
+
+  Optional<StringMap<RunResult>> Baseline;
+  bool WriteBaseline = UpdateBaseline;
+  // A baseline without any run would let every regression through
+  bool MissingBaseline = false;
+  if (!BaselineFile.empty() && !UpdateBaseline) {
+    if (!sys::fs::exists(BaselineFile)) {
+      MissingBaseline = true;
+    } else {
+      auto BaselineOrErr = readResults(BaselineFile);
+      if (!BaselineOrErr) {
+        logAllUnhandledErrors(BaselineOrErr.takeError(),
+                              WithColor::error() << BaselineFile << ": ");
+        return 1;
+      }
+      Baseline = std::move(*BaselineOrErr);
+      MissingBaseline = Baseline->empty();
+    }
+  }
+
+  unsigned NumRegressions =
+    compareResults(Results, Baseline? Baseline.getPointer() : nullptr,
+                   outs());
+
+  if (WriteBaseline && !BaselineFile.empty()) {
+    if (NumFailures)
+      WithColor::warning() << "Some workloads failed, the baseline is not "
+                           << "written\n";
+    else if (auto E = writeResults(BaselineFile, Results)) {
+      logAllUnhandledErrors(std::move(E),
+                            WithColor::error() << BaselineFile << ": ");
+      return 1;
+    }
+  }
+
+  if (NumRegressions)
+    WithColor::error() << NumRegressions << " out of " << Results.size()
+                       << " runs regressed against " << BaselineFile << "\n";
+  if (MissingBaseline)
+    WithColor::error() << "No baseline runs found in " << BaselineFile
+                       << ", rerun with -update-baseline to record them\n";
+  return (NumRegressions || NumFailures || MissingBaseline)? 1 : 0;
+}
@@ -0,0 +1,176 @@
+// Replay the event log written by llvm-mcad's `-event-log` option (see
+// EventLog.h) into views, without re-running the pipeline.
+//
+// Usage:
+//   mcad-replay events.log -views=summary,marker-stats
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/MC/MCInstrAnalysis.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/MCA/InstrBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLog.h"
+#include "MCAViews/MarkerStatsView.h"
+#include "MCAViews/SummaryView.h"
+#include "TypedMetadata.h"
+
+using namespace llvm;
+using namespace mcad;
+
+static cl::opt<std::string>
+  InputFilename(cl::Positional, cl::desc("<event log>"), cl::Required);
+
+namespace {
+enum ViewKind { VK_Summary, VK_MarkerStats };
+} // end anonymous namespace
+
+static cl::list<ViewKind>
+  ViewKinds("views", cl::desc("Views to replay events into"),
+            cl::values(clEnumValN(VK_Summary, "summary",
+                                  "Summary of the simulation"),
+                       clEnumValN(VK_MarkerStats, "marker-stats",
+                                  "Statistics between paired region "
+                                  "markers")),
+            cl::CommaSeparated);
+
+static cl::opt<bool>
+  PrintJson("print-json", cl::desc("Print views in JSON format"),
+            cl::init(false));
+
+namespace {
+// Create a fresh set of views for every region and print them at the end
+// of it, just like what MCAWorker does.
+class ViewPrinter : public event_log::ReplayTarget {
+  const MCSchedModel &SM;
+  const TypedMetadata &TypedMD;
+  raw_ostream &OS;
+
+  size_t NumInstructions;
+  // SummaryView only takes reference of it
+  std::function<size_t(void)> GetNumInstructions;
+
+  SmallVector<std::unique_ptr<mca::View>, 2> Views;
+  SmallVector<mca::View*, 2> ViewPtrs;
+
+  void createViews() {
+    Views.clear();
+    ViewPtrs.clear();
+    bool ShowMarkerStats = is_contained(ViewKinds, VK_MarkerStats);
+    for (ViewKind Kind : ViewKinds) {
+      switch (Kind) {
+      case VK_Summary:
+        // Only dump summaries on markers if marker statistics are not
+        // collected.
+        Views.push_back(std::make_unique<mca::SummaryView>(
+          SM, GetNumInstructions, 0U,
+          ShowMarkerStats? nullptr : &TypedMD, &OS));
+        break;
+      case VK_MarkerStats:
+        Views.push_back(std::make_unique<mca::MarkerStatsView>(TypedMD));
+        break;
+      }
+      ViewPtrs.push_back(Views.back().get());
+    }
+  }
+
+public:
+  ViewPrinter(const MCSchedModel &SM, const TypedMetadata &TMD,
+              raw_ostream &OS)
+    : SM(SM), TypedMD(TMD), OS(OS), NumInstructions(0U),
+      GetNumInstructions([this] { return NumInstructions; }) {
+    createViews();
+  }
+
+  ArrayRef<mca::View*> getViews() override { return ViewPtrs; }
+
+  void onInstructionsSeen(size_t NumInsts) override {
+    NumInstructions = std::max(NumInstructions, NumInsts);
+  }
+
+  void onRegionEnd(StringRef Description, size_t NumInsts) override {
+    NumInstructions = NumInsts;
+    if (!Description.empty())
+      OS << "\n=== Printing report for " << Description << " ===\n";
+    for (auto *V : ViewPtrs)
+      V->printView(PrintJson? mca::View::OK_JSON : mca::View::OK_READABLE,
+                   OS);
+    createViews();
+    NumInstructions = 0U;
+  }
+};
+} // end anonymous namespace
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  InitializeAllTargetInfos();
+  InitializeAllTargetMCs();
+
+  cl::ParseCommandLineOptions(argc, argv, "MCAD event log replay tool");
+
+  if (ViewKinds.empty())
+    ViewKinds.push_back(VK_Summary);
+
+  auto ReaderOrErr = event_log::Reader::create(InputFilename);
+  if (!ReaderOrErr) {
+    logAllUnhandledErrors(ReaderOrErr.takeError(),
+                          WithColor::error() << InputFilename << ": ");
+    return 1;
+  }
+  auto &R = **ReaderOrErr;
+
+  // Opcodes and registers are only meaningful to the same LLVM
+  if (R.getLLVMVersion() != LLVM_VERSION_STRING) {
+    WithColor::error() << "The log was written by LLVM "
+                       << R.getLLVMVersion() << ", but this is LLVM "
+                       << LLVM_VERSION_STRING << "\n";
+    return 1;
+  }
+
+  std::string TripleName = R.getTriple().str(), Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget(TripleName, Error);
+  if (!TheTarget) {
+    WithColor::error() << Error << "\n";
+    return 1;
+  }
+
+  std::unique_ptr<MCSubtargetInfo> STI(
+    TheTarget->createMCSubtargetInfo(TripleName, R.getCPU(),
+                                     R.getFeatures()));
+  std::unique_ptr<MCRegisterInfo> MRI(TheTarget->createMCRegInfo(TripleName));
+  std::unique_ptr<MCInstrInfo> MCII(TheTarget->createMCInstrInfo());
+  if (!STI || !MRI || !MCII) {
+    WithColor::error() << "Failed to create MC components for "
+                       << TripleName << "\n";
+    return 1;
+  }
+  std::unique_ptr<MCInstrAnalysis> MCIA(
+    TheTarget->createMCInstrAnalysis(MCII.get()));
+
+  mca::InstrBuilder IB(*STI, *MCII, *MRI, MCIA.get());
+  IB.useLoadLatency(R.useLoadLatency());
+
+  TypedMetadata TypedMD;
+  ViewPrinter Printer(STI->getSchedModel(), TypedMD, outs());
+  if (auto E = R.replay(IB, TypedMD, Printer)) {
+    logAllUnhandledErrors(std::move(E),
+                          WithColor::error() << InputFilename << ": ");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,308 @@
+// Query the columnar results store written by llvm-mcad's
+// `-results-store` option (see ResultsStore.h).
+//
+// Usage:
+//   mcad-results-query results.mcr -where='cycles>1000'
+//                      -group-by-description -sort-by=cycles -top=10
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+#include "ResultsStore.h"
+
+using namespace llvm;
+using namespace mcad;
+using namespace results_store;
+
+static cl::opt<std::string>
+  InputFilename(cl::Positional, cl::desc("<results store>"), cl::Required);
+
+static cl::list<std::string>
+  Filters("where",
+          cl::desc("Only keep rows matching <column><op><value>, where "
+                   "<op> is one of ==, !=, <, <=, >, >=, or =~ (regex, "
+                   "only for description). Can be specified multiple "
+                   "times"));
+
+static cl::opt<bool>
+  GroupByDescription("group-by-description",
+                     cl::desc("Sum up rows with the same description. "
+                              "Adds a `count` column"),
+                     cl::init(false));
+
+static cl::opt<std::string>
+  SortBy("sort-by", cl::desc("Sort rows by this column, in descending order"),
+         cl::init(""));
+
+static cl::opt<unsigned>
+  TopN("top", cl::desc("Only print the first N rows. Print all of them "
+                       "if it's zero"),
+       cl::init(0U));
+
+static cl::list<std::string>
+  OutputColumns("columns", cl::desc("Columns to print"), cl::CommaSeparated);
+
+static cl::opt<bool>
+  ListColumns("list-columns", cl::desc("Print all columns and exit"),
+              cl::init(false));
+
+// Pseudo column index of `count` in grouped rows
+static constexpr unsigned CountColumn = ~0U;
+
+namespace {
+struct Filter {
+  enum OpKind { EQ, NE, LT, LE, GT, GE, Match } Op;
+  unsigned Column;
+  double Value;
+  std::string Str;
+  std::unique_ptr<Regex> RE;
+
+  bool matches(const Reader &R, unsigned Group, size_t Row) const {
+    if (R.getColumnType(Column) == CT_String) {
+      StringRef Val = R.getString(R.getColumn(Group, Column)[Row]);
+      switch (Op) {
+      case EQ:
+        return Val == Str;
+      case NE:
+        return Val != Str;
+      case Match:
+        return RE->match(Val);
+      default:
+        llvm_unreachable("Unsupported string comparison");
+      }
+    }
+
+    double Val = R.getNumber(Group, Column, Row);
+    switch (Op) {
+    case EQ:
+      return Val == Value;
+    case NE:
+      return Val != Value;
+    case LT:
+      return Val < Value;
+    case LE:
+      return Val <= Value;
+    case GT:
+      return Val > Value;
+    case GE:
+      return Val >= Value;
+    default:
+      llvm_unreachable("Unsupported numeric comparison");
+    }
+  }
+};
+
+// A row to print. Either a single region instance or a group of them.
+struct OutputRow {
+  StringRef Description;
+  size_t Count;
+  // Values of every column, or their sums if it's a group
+  std::vector<double> Values;
+};
+} // end anonymous namespace
+
+static bool parseFilter(const Reader &R, StringRef Spec, Filter &F) {
+  // Longer operators go first
+  static const std::pair<StringRef, Filter::OpKind> Ops[] = {
+    {"==", Filter::EQ}, {"!=", Filter::NE}, {"<=", Filter::LE},
+    {">=", Filter::GE}, {"=~", Filter::Match},
+    {"<", Filter::LT}, {">", Filter::GT}};
+
+  size_t Pos = StringRef::npos, Len = 0U;
+  for (const auto &Op : Ops) {
+    size_t P = Spec.find(Op.first);
+    if (P < Pos) {
+      Pos = P;
+      Len = Op.first.size();
+      F.Op = Op.second;
+    }
+  }
+  if (Pos == StringRef::npos) {
+    WithColor::error() << "No operator in filter: " << Spec << "\n";
+    return false;
+  }
+
+  StringRef Name = Spec.take_front(Pos).trim(),
+            Value = Spec.drop_front(Pos + Len).trim();
+  auto Col = R.lookupColumn(Name);
+  if (!Col) {
+    WithColor::error() << "Unknown column: " << Name << "\n";
+    return false;
+  }
+  F.Column = *Col;
+
+  if (R.getColumnType(F.Column) == CT_String) {
+    if (F.Op != Filter::EQ && F.Op != Filter::NE && F.Op != Filter::Match) {
+      WithColor::error() << "Only ==, !=, and =~ can be used on "
+                         << Name << "\n";
+      return false;
+    }
+    F.Str = Value.str();
+    if (F.Op == Filter::Match) {
+      F.RE = std::make_unique<Regex>(F.Str);
+      std::string Error;
+      if (!F.RE->isValid(Error)) {
+        WithColor::error() << "Invalid regex " << F.Str << ": "
+                           << Error << "\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (F.Op == Filter::Match) {
+    WithColor::error() << "=~ can only be used on strings\n";
+    return false;
+  }
+  if (Value.getAsDouble(F.Value)) {
+    WithColor::error() << "Invalid number: " << Value << "\n";
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  cl::ParseCommandLineOptions(argc, argv, "MCAD results store query tool");
+
+  auto ReaderOrErr = Reader::create(InputFilename);
+  if (!ReaderOrErr) {
+    logAllUnhandledErrors(ReaderOrErr.takeError(),
+                          WithColor::error() << InputFilename << ": ");
+    return 1;
+  }
+  const Reader &R = **ReaderOrErr;
+  raw_ostream &OS = outs();
+
+  if (ListColumns) {
+    for (unsigned i = 0U; i < R.getNumColumns(); ++i) {
+      static const char *TypeNames[] = {"uint", "double", "string"};
+      OS << R.getColumnName(i) << "\t" << TypeNames[R.getColumnType(i)]
+         << "\n";
+    }
+    return 0;
+  }
+
+  std::vector<Filter> Fs(Filters.size());
+  for (unsigned i = 0U; i < Filters.size(); ++i)
+    if (!parseFilter(R, Filters[i], Fs[i]))
+      return 1;
+
+  // Resolve output and sorting columns
+  auto resolveColumn = [&](StringRef Name) -> Optional<unsigned> {
+    if (Name == "count" && GroupByDescription)
+      return CountColumn;
+    auto Col = R.lookupColumn(Name);
+    if (!Col)
+      WithColor::error() << "Unknown column: " << Name << "\n";
+    return Col;
+  };
+  SmallVector<unsigned, 8> PrintColumns;
+  if (OutputColumns.empty()) {
+    PrintColumns = {FC_Description, FC_Instructions, FC_Cycles,
+                    FC_MicroOps, FC_IPC};
+    if (GroupByDescription)
+      PrintColumns.insert(PrintColumns.begin() + 1, CountColumn);
+  } else {
+    for (const auto &Name : OutputColumns) {
+      auto Col = resolveColumn(Name);
+      if (!Col)
+        return 1;
+      PrintColumns.push_back(*Col);
+    }
+  }
+  Optional<unsigned> SortColumn;
+  if (!SortBy.empty() && !(SortColumn = resolveColumn(SortBy)))
+    return 1;
+
+  // Scan every row group
+  std::vector<OutputRow> Rows;
+  StringMap<size_t> GroupIndices;
+  for (unsigned G = 0U; G < R.getNumRowGroups(); ++G) {
+    auto Descriptions = R.getColumn(G, FC_Description);
+    for (size_t Row = 0U, E = R.getNumRows(G); Row < E; ++Row) {
+      if (!llvm::all_of(Fs, [&](const Filter &F) {
+                          return F.matches(R, G, Row);
+                        }))
+        continue;
+
+      StringRef Desc = R.getString(Descriptions[Row]);
+      OutputRow *Out;
+      if (GroupByDescription) {
+        auto Res = GroupIndices.insert(std::make_pair(Desc, Rows.size()));
+        if (Res.second)
+          Rows.push_back({Desc, 0U,
+                          std::vector<double>(R.getNumColumns(), 0.0)});
+        Out = &Rows[Res.first->second];
+      } else {
+        Rows.push_back({Desc, 0U,
+                        std::vector<double>(R.getNumColumns(), 0.0)});
+        Out = &Rows.back();
+      }
+
+      ++Out->Count;
+      for (unsigned Col = 0U; Col < R.getNumColumns(); ++Col)
+        if (R.getColumnType(Col) != CT_String)
+          Out->Values[Col] += R.getNumber(G, Col, Row);
+    }
+  }
+
+  // IPC of a group is not the sum of its instances
+  if (GroupByDescription)
+    for (auto &Row : Rows) {
+      double Cycles = Row.Values[FC_Cycles];
+      Row.Values[FC_IPC] = Cycles? Row.Values[FC_Instructions] / Cycles : 0.0;
+    }
+
+  auto getValue = [](const OutputRow &Row, unsigned Col) {
+    return Col == CountColumn? double(Row.Count) : Row.Values[Col];
+  };
+  if (SortColumn) {
+    unsigned Col = *SortColumn;
+    if (Col == FC_Description)
+      llvm::stable_sort(Rows, [](const OutputRow &LHS, const OutputRow &RHS) {
+                          return LHS.Description < RHS.Description;
+                        });
+    else
+      llvm::stable_sort(Rows, [&](const OutputRow &LHS,
+                                  const OutputRow &RHS) {
+                          return getValue(LHS, Col) > getValue(RHS, Col);
+                        });
+  }
+  if (TopN && Rows.size() > TopN)
+    Rows.resize(TopN);
+
+  // Print as tab-separated values
+  ListSeparator Tab("\t");
+  for (unsigned Col : PrintColumns)
+    OS << Tab << (Col == CountColumn? StringRef("count")
+                                    : R.getColumnName(Col));
+  OS << "\n";
+  for (const auto &Row : Rows) {
+    ListSeparator Tab("\t");
+    for (unsigned Col : PrintColumns) {
+      OS << Tab;
+      if (Col == CountColumn)
+        OS << Row.Count;
+      else if (R.getColumnType(Col) == CT_String)
+        OS << Row.Description;
+      else if (R.getColumnType(Col) == CT_Double)
+        OS << format("%.2f", Row.Values[Col]);
+      else
+        OS << uint64_t(Row.Values[Col]);
+    }
+    OS << "\n";
+  }
+
+  return 0;
+}